@@ -1,12 +1,49 @@
 #include "arch/arch.h"
 #include "arch/x86_64/gdt.h"
 #include "arch/x86_64/idt.h"
+#include "arch/x86_64/memory.h"
+#include "arch/x86_64/string.h"
+#include "lib/string.h"
 #include "board/board.h"
 
+#define CPUID_EDX_SSE2 (1 << 26)
+
+static const string_ops_t sse2_string_ops = {
+    .strlen = x86_64_sse2_strlen,
+    .strcmp = x86_64_sse2_strcmp,
+    .memchr = x86_64_sse2_memchr,
+};
+
+static bool x86_64_sse_init(void)
+{
+    uint32_t eax = 1, ebx, ecx, edx;
+    __asm__ volatile("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+
+    if (!(edx & CPUID_EDX_SSE2)) {
+        return false;
+    }
+
+    uint64_t cr0, cr4;
+    __asm__ volatile("mov %%cr0, %0" : "=r"(cr0));
+    __asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+    cr0 = (cr0 & ~CR0_EM) | CR0_MP;
+    cr4 |= CR4_OSFXSR | CR4_OSXMMEXCPT;
+    __asm__ volatile("mov %0, %%cr0" :: "r"(cr0));
+    __asm__ volatile("mov %0, %%cr4" :: "r"(cr4));
+
+    return true;
+}
+
 arch_result arch_init(void)
 {
     x86_64_gdt_init();
 
+    // Before the IDT is loaded: interrupt entry saves SSE state with fxsave
+    bool sse2 = x86_64_sse_init();
+    if (sse2) {
+        string_set_ops(&sse2_string_ops);
+    }
+
     arch_interrupt_init();
     
     arch_result result = arch_memory_init();
@@ -24,7 +61,13 @@ arch_result arch_init(void)
         return result;
     }
     
-    arch_debug_printf("x86_64: arch initialization complete\n");
+    arch_debug_printf("x86_64: arch initialization complete (%s string routines)\n", sse2 ? "SSE2" : "word");
     
     return ARCH_OK;
-}
\ No newline at end of file
+}
+
+unsigned int arch_cpu_id(void)
+{
+    // Only the bootstrap processor is brought up
+    return 0;
+}
@@ -2,12 +2,16 @@
 #include "arch/arch.h"
 #include "arch/x86_64/idt.h"
 #include "arch/x86_64/pic.h"
+#include "kernel/trace.h"
 
 static void (*interrupt_handlers[256])(void) = {0};
+static uint64_t interrupt_idle_cycles = 0;
 
 extern void exception_0(void), exception_2(void), exception_4(void);
 extern void exception_8(void), exception_13(void), exception_14(void);
-extern void irq_0x20(void), irq_0x21(void), irq_0x24(void);
+extern void irq_0x20(void), irq_0x21(void), irq_0x23(void), irq_0x24(void);
+extern void irq_0x25(void), irq_0x29(void), irq_0x2A(void), irq_0x2B(void);
+extern void irq_0x2E(void), irq_0x2F(void);
 
 arch_result arch_interrupt_init(void)
 {
@@ -21,7 +25,14 @@ arch_result arch_interrupt_init(void)
     x86_64_idt_set_entry(14, exception_14, IDT_FLAG_INTERRUPT_GATE);
     x86_64_idt_set_entry(0x20, irq_0x20, IDT_FLAG_INTERRUPT_GATE);
     x86_64_idt_set_entry(0x21, irq_0x21, IDT_FLAG_INTERRUPT_GATE);
+    x86_64_idt_set_entry(0x23, irq_0x23, IDT_FLAG_INTERRUPT_GATE);
     x86_64_idt_set_entry(0x24, irq_0x24, IDT_FLAG_INTERRUPT_GATE);
+    x86_64_idt_set_entry(0x25, irq_0x25, IDT_FLAG_INTERRUPT_GATE);
+    x86_64_idt_set_entry(0x29, irq_0x29, IDT_FLAG_INTERRUPT_GATE);
+    x86_64_idt_set_entry(0x2A, irq_0x2A, IDT_FLAG_INTERRUPT_GATE);
+    x86_64_idt_set_entry(0x2B, irq_0x2B, IDT_FLAG_INTERRUPT_GATE);
+    x86_64_idt_set_entry(0x2E, irq_0x2E, IDT_FLAG_INTERRUPT_GATE);
+    x86_64_idt_set_entry(0x2F, irq_0x2F, IDT_FLAG_INTERRUPT_GATE);
 
     x86_64_pic_remap();
 
@@ -31,6 +42,7 @@ arch_result arch_interrupt_init(void)
 static void default_exception_handler(const char *name)
 {
     arch_debug_printf("Exception: %s\n", name);
+    arch_debug_flush();
     arch_halt();
 }
 
@@ -69,7 +81,9 @@ void arch_handle_interrupt(unsigned vector)
 {
     if (vector < 256 && interrupt_handlers[vector]) {
         void (*handler)(void) = (void (*)(void))interrupt_handlers[vector];
+        trace_event(TRACE_IRQ_ENTRY, vector, 0);
         handler();
+        trace_event(TRACE_IRQ_EXIT, vector, 0);
     }
 }
 
@@ -82,3 +96,33 @@ void arch_interrupt_disable(void)
 {
     __asm__ volatile("cli");
 }
+
+void arch_interrupt_wait(void)
+{
+    uint64_t start = arch_cycles();
+
+    // sti takes effect after the next instruction, so a pending interrupt still wakes hlt
+    __asm__ volatile("sti; hlt; cli" : : : "memory");
+
+    interrupt_idle_cycles += arch_cycles() - start;
+}
+
+uint64_t arch_idle_cycles(void)
+{
+    return interrupt_idle_cycles;
+}
+
+uint64_t arch_interrupt_save(void)
+{
+    uint64_t rflags;
+    __asm__ volatile("pushfq; popq %0; cli" : "=r"(rflags) : : "memory");
+    return rflags;
+}
+
+void arch_interrupt_restore(uint64_t state)
+{
+    // Only IF (bit 9) is restored
+    if (state & (1 << 9)) {
+        __asm__ volatile("sti" : : : "memory");
+    }
+}
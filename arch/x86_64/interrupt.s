@@ -43,8 +43,33 @@ common_interrupt_handler:
     
     movq 120(%rsp), %rdi    # Vector is at offset 120 (15*8 + 8)
     movq %rsp, %rsi         # Context pointer
+
+    # Compiled C may use any SSE register, so save the whole FPU/SSE state.
+    # fxsave wants a 16-byte aligned area; rbx is pushed above and callee-saved
+    movq %rsp, %rbx
+    andq $-16, %rsp
+    subq $512, %rsp
+    fxsave (%rsp)
+
     call arch_handle_interrupt
-    
+
+    fxrstor (%rsp)
+    movq %rbx, %rsp
+
+    # Send EOI for hardware interrupts (0x20-0x2F) while rax is still saved
+    movq 120(%rsp), %rax
+    cmpq $0x20, %rax
+    jb skip_eoi
+    cmpq $0x30, %rax
+    jae skip_eoi
+    cmpq $0x28, %rax
+    mov $0x20, %al
+    jb 1f
+    out %al, $0xA0          # Slave PIC first for IRQ 8-15
+1:
+    out %al, $0x20
+skip_eoi:
+
     popq %r15
     popq %r14
     popq %r13
@@ -62,15 +87,6 @@ common_interrupt_handler:
     popq %rax
     
     addq $16, %rsp
-    
-    # Send EOI for hardware interrupts (0x20-0x2F)
-    cmpq $0x20, -16(%rsp)  # Check vector 
-    jb skip_eoi
-    cmpq $0x30, -16(%rsp)
-    jae skip_eoi
-    mov $0x20, %al
-    out %al, $0x20
-skip_eoi:
     iretq
 
 EXCEPTION_HANDLER_NOERR 0   # Divide by zero
@@ -82,4 +98,11 @@ EXCEPTION_HANDLER_ERR   14  # Page fault
 
 IRQ_HANDLER 0x20  # Timer
 IRQ_HANDLER 0x21  # PS2 Keyboard
-IRQ_HANDLER 0x24  # Serial
+IRQ_HANDLER 0x23  # Serial (COM2/COM4)
+IRQ_HANDLER 0x24  # Serial (COM1/COM3)
+IRQ_HANDLER 0x25  # PCI INTx
+IRQ_HANDLER 0x29  # PCI INTx
+IRQ_HANDLER 0x2A  # PCI INTx
+IRQ_HANDLER 0x2B  # PCI INTx
+IRQ_HANDLER 0x2E  # Primary ATA
+IRQ_HANDLER 0x2F  # Secondary ATA
@@ -2,6 +2,10 @@
 .globl inw
 .globl outb
 .globl outw
+.globl inl
+.globl outl
+.globl insw
+.globl outsw
 
 inb:
   mov %di, %dx
@@ -13,6 +17,11 @@ inw:
   in %dx, %ax
   ret
 
+inl:
+  mov %di, %dx
+  in %dx, %eax
+  ret
+
 outb:
   mov %di, %dx
   mov %si, %ax
@@ -24,3 +33,24 @@ outw:
   mov %si, %ax
   out %ax, %dx
   ret
+
+outl:
+  mov %di, %dx
+  mov %esi, %eax
+  out %eax, %dx
+  ret
+
+insw:
+  cld
+  mov %rdx, %rcx
+  mov %di, %dx
+  mov %rsi, %rdi
+  rep insw
+  ret
+
+outsw:
+  cld
+  mov %rdx, %rcx
+  mov %di, %dx
+  rep outsw
+  ret
@@ -61,6 +61,8 @@ arch_result arch_memory_map_page(uint64_t va, uint64_t pa, int flags)
 			fatal("Unable to get page for PDPT\n");
 		}
 
+		arch_memory_zero(virtual_address(p), PAGE_SIZE);
+
 		pml4[pml4_offset] = (pml4e)p | flags;
 	}
 
@@ -75,15 +77,17 @@ arch_result arch_memory_map_page(uint64_t va, uint64_t pa, int flags)
 			fatal("Unable to get page for PD\n");
 		}
 
+		arch_memory_zero(virtual_address(p), PAGE_SIZE);
+
 		pdpt[pdpt_offset] = (pdpte)p | flags;
 	}
 
 	pd = (pde *)virtual_address((pdpt[pdpt_offset] >> 12) << 12);
 
-	if (pd[pd_offset] & (PAGE_PS | PAGE_PRESENT))
+	// Already covered by a 2 MiB page
+	if (pd[pd_offset] & PAGE_PS)
 	{
-		pd[pd_offset] = flags | PAGE_PS;
-		return pml4[pml4_offset];
+		return ARCH_ERROR;
 	}
 
 	if (!(pd[pd_offset] & PAGE_PRESENT))
@@ -95,6 +99,8 @@ arch_result arch_memory_map_page(uint64_t va, uint64_t pa, int flags)
 			fatal("Unable to get page for PT\n");
 		}
 
+		arch_memory_zero(virtual_address(p), PAGE_SIZE);
+
 		pd[pd_offset] = (pde)p | flags;
 	}
 
@@ -171,17 +177,66 @@ arch_result arch_memory_unmap_page(uint64_t va)
 	return ARCH_OK;
 }
 
+arch_result arch_memory_translate(uint64_t va, uint64_t *pa)
+{
+	pdpte *pdpt;
+	pde *pd;
+	pte *pt;
+
+	unsigned short pml4_offset = (va >> 39) & 0x1FF;
+	unsigned short pdpt_offset = (va >> 30) & 0x1FF;
+	unsigned short pd_offset = (va >> 21) & 0x1FF;
+	unsigned short pt_offset = (va >> 12) & 0x1FF;
+
+	if (!(pml4[pml4_offset] & PAGE_PRESENT))
+		return ARCH_ERROR;
+
+	pdpt = (pdpte *)virtual_address((pml4[pml4_offset] >> 12) << 12);
+
+	if (!(pdpt[pdpt_offset] & PAGE_PRESENT))
+		return ARCH_ERROR;
+
+	if (pdpt[pdpt_offset] & PAGE_PS)
+	{
+		*pa = ((pdpt[pdpt_offset] >> 30) << 30) + (va & 0x3FFFFFFF);
+		return ARCH_OK;
+	}
+
+	pd = (pde *)virtual_address((pdpt[pdpt_offset] >> 12) << 12);
+
+	if (!(pd[pd_offset] & PAGE_PRESENT))
+		return ARCH_ERROR;
+
+	if (pd[pd_offset] & PAGE_PS)
+	{
+		*pa = ((pd[pd_offset] >> 21) << 21) + (va & 0x1FFFFF);
+		return ARCH_OK;
+	}
+
+	pt = (pte *)virtual_address((pd[pd_offset] >> 12) << 12);
+
+	if (!(pt[pt_offset] & PAGE_PRESENT))
+		return ARCH_ERROR;
+
+	*pa = ((pt[pt_offset] >> 12) << 12) + (va & 0xFFF);
+
+	return ARCH_OK;
+}
+
 void *arch_memory_allocate_page(void)
 {
 	void *page = NULL;
 
-	if (free_regions[0].size > 0)
+	// Exhausted regions keep their place in the sorted list, so skip them
+	for (int r = 0; r < total_regions; r++)
 	{
-		page = (void *)free_regions[0].start;
-		free_regions[0].start += PAGE_SIZE;
-		free_regions[0].size--;
-
-		sort(free_regions, total_regions);
+		if (free_regions[r].size > 0)
+		{
+			page = (void *)free_regions[r].start;
+			free_regions[r].start += PAGE_SIZE;
+			free_regions[r].size--;
+			break;
+		}
 	}
 
 	return page;
@@ -251,22 +306,22 @@ void arch_memory_map_userpages(uint64_t pdpt)
 
 arch_result arch_memory_init(void)
 {
-	total_regions = 4;
+	total_regions = 3;
 	total_memory = 0x200000;
 
+	// Sizes are in pages. Page tables sit below 0x6000, the kernel image and
+	// .bss from KERNEL_PHYS up, video memory and ROMs from 0xA0000 to 1 MiB
+	// and the boot stack at the top of the mapped 2 MiB.
 	free_regions[0].start = PAGE_SIZE * 6;
-	free_regions[0].size = 0xA0000 - free_regions[0].start;
-
-	free_regions[1].start = 0xC0000;
-	free_regions[1].size = 0xF0000 - 0xC0000;
+	free_regions[0].size = (KERNEL_PHYS - free_regions[0].start) / PAGE_SIZE;
 
-	free_regions[2].start = 0xF0000 + ALIGN_UP((uint64_t)KERNEL_END - (uint64_t)KERNEL_VMA, PAGE_SIZE);
-	free_regions[2].size = 0x100000 - free_regions[2].start;
+	free_regions[1].start = ALIGN_UP(physical_address(KERNEL_END), PAGE_SIZE);
+	free_regions[1].size = (0xA0000 - free_regions[1].start) / PAGE_SIZE;
 
-	free_regions[3].start = 0x100000;
-	free_regions[3].size = total_memory - 0x100000;
+	free_regions[2].start = 0x100000;
+	free_regions[2].size = (total_memory - KERNEL_STACK_SIZE - 0x100000) / PAGE_SIZE;
 
-	total_memory_free = free_regions[0].size + free_regions[1].size + free_regions[2].size + free_regions[3].size;
+	total_memory_free = (free_regions[0].size + free_regions[1].size + free_regions[2].size) * PAGE_SIZE;
 	total_memory_reserved = total_memory - total_memory_free;
 
 	/* Remove bootstrap identity mapping */
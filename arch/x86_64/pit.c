@@ -1,14 +1,12 @@
+#include "arch/arch.h"
 #include "arch/x86_64/io.h"
-#include "definitions.h"
+#include "arch/x86_64/pit.h"
 
 #define PIT_CHANNEL_0   0x40    // Channel 0 data port
 #define PIT_CHANNEL_1   0x41    // Channel 1 data port  
 #define PIT_CHANNEL_2   0x42    // Channel 2 data port
 #define PIT_COMMAND     0x43    // Mode/Command register
 
-// PIT frequency: ~1.193182 MHz
-#define PIT_FREQUENCY   1193182
-
 #define PIT_CHANNEL_0_SELECT    0x00    // Select channel 0
 #define PIT_CHANNEL_1_SELECT    0x40    // Select channel 1
 #define PIT_CHANNEL_2_SELECT    0x80    // Select channel 2
@@ -28,7 +26,7 @@
 #define PIT_BINARY              0x00    // Binary mode
 #define PIT_BCD                 0x01    // BCD mode
 
-void x86_64_pit_init(unsigned int frequency_hz)
+uint16_t x86_64_pit_init(unsigned int frequency_hz)
 {
     uint32_t divisor = PIT_FREQUENCY / frequency_hz;
     
@@ -50,4 +48,20 @@ void x86_64_pit_init(unsigned int frequency_hz)
     
     outb(PIT_CHANNEL_0, (uint8_t)(divisor & 0xFF));
     outb(PIT_CHANNEL_0, (uint8_t)((divisor >> 8) & 0xFF));
-}
\ No newline at end of file
+
+    return (uint16_t)divisor;
+}
+
+uint16_t x86_64_pit_read_count(void)
+{
+    // The latch and the two byte reads must not interleave with another reader
+    uint64_t state = arch_interrupt_save();
+
+    outb(PIT_COMMAND, PIT_CHANNEL_0_SELECT | PIT_ACCESS_LATCH);
+    uint16_t count = inb(PIT_CHANNEL_0);
+    count |= (uint16_t)inb(PIT_CHANNEL_0) << 8;
+
+    arch_interrupt_restore(state);
+
+    return count;
+}
@@ -0,0 +1,129 @@
+.code64
+
+.globl x86_64_sse2_strlen
+.globl x86_64_sse2_strcmp
+.globl x86_64_sse2_memchr
+
+.section .text
+
+# Only xmm0-xmm3 are used; the interrupt entry preserves exactly those.
+
+# uint64_t x86_64_sse2_strlen(const char *str)
+# Aligned 16-byte loads never cross a page, so the first block is loaded
+# from below str and the bytes before it are shifted out of the mask.
+x86_64_sse2_strlen:
+  mov %rdi, %rax
+  mov %edi, %ecx
+  and $15, %ecx
+  and $-16, %rax
+  pxor %xmm0, %xmm0
+  movdqa (%rax), %xmm1
+  pcmpeqb %xmm0, %xmm1
+  pmovmskb %xmm1, %edx
+  shr %cl, %edx
+  test %edx, %edx
+  jz 1f
+  bsf %edx, %eax
+  ret
+1:
+  add $16, %rax
+  movdqa (%rax), %xmm1
+  pcmpeqb %xmm0, %xmm1
+  pmovmskb %xmm1, %edx
+  test %edx, %edx
+  jz 1b
+  bsf %edx, %edx
+  add %rdx, %rax
+  sub %rdi, %rax
+  ret
+
+# int x86_64_sse2_strcmp(const char *s1, const char *s2)
+# Compares 16 bytes per step with unaligned loads. A step that would run
+# into the next page of either string falls back to a single byte.
+x86_64_sse2_strcmp:
+  pxor %xmm0, %xmm0
+1:
+  mov %edi, %eax
+  and $0xFFF, %eax
+  cmp $0xFF0, %eax
+  ja 3f
+  mov %esi, %eax
+  and $0xFFF, %eax
+  cmp $0xFF0, %eax
+  ja 3f
+  movdqu (%rdi), %xmm1
+  movdqu (%rsi), %xmm2
+  movdqa %xmm1, %xmm3
+  pcmpeqb %xmm2, %xmm1
+  pcmpeqb %xmm0, %xmm3
+  pmovmskb %xmm1, %eax
+  pmovmskb %xmm3, %edx
+  not %eax
+  or %edx, %eax
+  and $0xFFFF, %eax
+  jnz 2f
+  add $16, %rdi
+  add $16, %rsi
+  jmp 1b
+2:
+  bsf %eax, %eax
+  movzbl (%rdi,%rax), %edx
+  movzbl (%rsi,%rax), %ecx
+  mov %edx, %eax
+  sub %ecx, %eax
+  ret
+3:
+  movzbl (%rdi), %eax
+  movzbl (%rsi), %ecx
+  cmp %ecx, %eax
+  jne 4f
+  test %eax, %eax
+  jz 4f
+  inc %rdi
+  inc %rsi
+  jmp 1b
+4:
+  sub %ecx, %eax
+  ret
+
+# void *x86_64_sse2_memchr(const void *ptr, int c, size_t n)
+x86_64_sse2_memchr:
+  test %rdx, %rdx
+  jz 3f
+  movd %esi, %xmm0
+  punpcklbw %xmm0, %xmm0
+  punpcklwd %xmm0, %xmm0
+  pshufd $0, %xmm0, %xmm0
+  mov %rdi, %rax
+  mov %edi, %ecx
+  and $15, %ecx
+  and $-16, %rax
+  add %rcx, %rdx          # Remaining bytes counted from the aligned block
+  jnc 0f
+  mov $-1, %rdx
+0:
+  movdqa (%rax), %xmm1
+  pcmpeqb %xmm0, %xmm1
+  pmovmskb %xmm1, %esi
+  shr %cl, %esi
+  shl %cl, %esi
+1:
+  test %esi, %esi
+  jnz 2f
+  cmp $16, %rdx
+  jbe 3f
+  add $16, %rax
+  sub $16, %rdx
+  movdqa (%rax), %xmm1
+  pcmpeqb %xmm0, %xmm1
+  pmovmskb %xmm1, %esi
+  jmp 1b
+2:
+  bsf %esi, %esi
+  cmp %rdx, %rsi
+  jae 3f
+  add %rsi, %rax
+  ret
+3:
+  xor %eax, %eax
+  ret
@@ -1,11 +1,21 @@
 #include "arch/arch.h"
 #include "arch/x86_64/pit.h"
 
+#define TIMER_MAX_CALLBACKS 8
+
 static uint32_t timer_frequency_hz = 0;
-static uint64_t timer_ticks = 0;
+static uint16_t timer_divisor = 0;
+static uint64_t timer_last_ns = 0;
+static volatile uint64_t timer_ticks = 0;
+static void (*timer_callbacks[TIMER_MAX_CALLBACKS])(void) = {0};
 
 void timer_handler(void) {
     timer_ticks++;
+
+    for (int i = 0; i < TIMER_MAX_CALLBACKS && timer_callbacks[i]; i++) {
+        timer_callbacks[i]();
+    }
+
     if (timer_ticks % timer_frequency_hz == 0) {
         arch_debug_printf("Timer: %lu seconds\n", timer_ticks / timer_frequency_hz);
     }
@@ -14,13 +24,58 @@ void timer_handler(void) {
 arch_result arch_timer_init(uint32_t frequency_hz)
 {
     timer_frequency_hz = frequency_hz;
-    x86_64_pit_init(frequency_hz);
+    timer_divisor = x86_64_pit_init(frequency_hz);
     return ARCH_OK;
 }
 
-uint64_t arch_time_ns(void) 
+arch_result arch_timer_add_callback(void (*callback)(void))
+{
+    if (!callback) {
+        return ARCH_INVALID;
+    }
+
+    for (int i = 0; i < TIMER_MAX_CALLBACKS; i++) {
+        if (!timer_callbacks[i]) {
+            timer_callbacks[i] = callback;
+            return ARCH_OK;
+        }
+    }
+
+    return ARCH_ERROR;
+}
+
+uint64_t arch_time_ns(void)
+{
+    uint64_t ticks;
+    uint16_t count;
+
+    if (timer_divisor == 0) {
+        return 0;
+    }
+
+    // Interpolate within the tick from the PIT counter; retry if a tick lands in between
+    do {
+        ticks = timer_ticks;
+        count = x86_64_pit_read_count();
+    } while (ticks != timer_ticks);
+
+    uint64_t pit_clocks = ticks * timer_divisor + (timer_divisor - count);
+    uint64_t ns = pit_clocks / PIT_FREQUENCY * 1000000000ULL +
+                  pit_clocks % PIT_FREQUENCY * 1000000000ULL / PIT_FREQUENCY;
+
+    // With interrupts disabled the counter can wrap before the tick is counted
+    if (ns < timer_last_ns) {
+        return timer_last_ns;
+    }
+    timer_last_ns = ns;
+
+    return ns;
+}
+
+uint64_t arch_cycles(void)
 {
-    // TODO: handle case where timer_frequency_hz is variable
-    return (uint64_t)timer_ticks * 1000000ULL / timer_frequency_hz;
+    uint32_t low, high;
+    __asm__ volatile("rdtsc" : "=a"(low), "=d"(high));
+    return ((uint64_t)high << 32) | low;
 }
 
@@ -1,10 +1,71 @@
 #include "board/board.h"
+#include "arch/x86_64/memory.h"
+#include "board/pc/boot.h"
 #include "board/pc/serial.h"
+#include "board/pc/disk.h"
+#include "board/pc/virtio.h"
 #include "board/pc/vga.h"
 
+static const boot_info_t *board_boot_info(void)
+{
+    const boot_info_t *info = virtual_address(BOOT_INFO_ADDRESS);
+
+    return info->magic == BOOT_INFO_MAGIC ? info : NULL;
+}
+
+// Log the BIOS memory map stage 2 handed over
+static void board_memory_map(void)
+{
+    const boot_info_t *info = board_boot_info();
+
+    if (!info || info->e820_count == 0) {
+        arch_debug_printf("Memory map: not provided by the BIOS\n");
+        return;
+    }
+
+    uint64_t usable = 0;
+    for (uint32_t i = 0; i < info->e820_count && i < BOOT_E820_MAX; i++) {
+        const boot_e820_entry_t *entry = &info->e820[i];
+
+        if (!(entry->attributes & 1) || entry->length == 0) {
+            continue;
+        }
+        if (entry->type == BOOT_E820_USABLE) {
+            usable += entry->length;
+        }
+        arch_debug_printf("Memory map: %p-%p %s\n", (void *)entry->base, (void *)(entry->base + entry->length - 1),
+                          entry->type == BOOT_E820_USABLE ? "usable" : "reserved");
+    }
+
+    arch_debug_printf("Memory map: %lu KiB usable, kernel loaded from drive %x in %u sectors\n", usable / 1024,
+                      info->drive, info->kernel_sectors);
+}
+
 arch_result board_init(void)
 {
+    board_memory_map();
     vga_init();
+    x86_serial_init();
+    x86_disk_init();
+    x86_virtio_init();
     
     return ARCH_OK;
-}
\ No newline at end of file
+}
+uint32_t board_boot_stamps(board_boot_stamp_t *stamps, uint32_t max)
+{
+    // In the order boot.s takes them
+    static const char *names[BOOT_TSC_STAMPS] = { "bios", "kernel load", "long mode" };
+    const boot_info_t *info = board_boot_info();
+    uint32_t count = max < BOOT_TSC_STAMPS ? max : BOOT_TSC_STAMPS;
+
+    if (!info) {
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        stamps[i].name = names[i];
+        stamps[i].cycles = info->tsc[i];
+    }
+
+    return count;
+}
@@ -1,27 +1,146 @@
 #include "arch/x86_64/memory.h"
 #include "arch/x86_64/gdt.h"
+#include "board/pc/boot.h"
+
+# Two stages: the boot sector checks for LBA support and loads stage 2 from
+# the sectors right behind it, then stage 2 collects the E820 memory map,
+# loads the kernel in chunks and switches to long mode. Both fill in
+# boot_info_t (include/board/pc/boot.h) at BOOT_INFO_ADDRESS.
+
+# Store the TSC in the index'th boot stamp for the kernel's boot profile
+.macro BOOT_STAMP index
+  rdtsc
+  mov %eax, BOOT_INFO_ADDRESS + BOOT_INFO_TSC + \index * 8
+  mov %edx, BOOT_INFO_ADDRESS + BOOT_INFO_TSC + \index * 8 + 4
+.endm
 
 .code16
 _start:
   # Disable interrupts until kernel can setup interrupt routines
   cli
 
-  # Load kernel sectors from disk using LBA addressing (BIOS int 13h, function 42h)
+  # Not every BIOS enters with zeroed segments or at 0000:7C00
+  xor %ax, %ax
+  mov %ax, %ds
+  mov %ax, %es
+  mov %ax, %ss
+  mov $0x7c00, %sp
+  cld
+  ljmp $0, $stage1
+
+stage1:
+  # The TSC counts from reset, so this is the time the BIOS took
+  BOOT_STAMP 0
+
+  # Load from the drive the BIOS booted
+  movzbl %dl, %eax
+  mov %eax, BOOT_INFO_ADDRESS + BOOT_INFO_DRIVE
+
+  # Load sectors from disk using LBA addressing (BIOS int 13h, function 42h)
   # First check if LBA extensions are available
   mov $0x41, %ah       # Check extensions present
   mov $0x55aa, %bx     # Magic number
-  mov $0x80, %dl       # Drive 0x80 (first hard disk)
   int $0x13
   jc disk_error        # No LBA support
   cmp $0xaa55, %bx
   jne disk_error       # No LBA support
-  
+
+  # Stage 2 sits right behind the boot sector
+  movw $(BOOT_SECTORS - 1), dap_sectors
+  movw $0x7e00, dap_offset
+  movl $1, dap_lba
+  call disk_read
+  jmp stage2
+
+# Read the sectors the DAP describes, resetting the drive between attempts
+# Returns the sector count in %bp; clobbers %ax, %cx, %dx and %si
+disk_read:
+  mov dap_sectors, %bp   # A failed call may leave the count of sectors it did transfer
+  mov $BOOT_READ_RETRIES, %cx
+1:
+  mov %bp, dap_sectors
   mov $dap, %si        # DS:SI points to DAP
   mov $0x42, %ah
-  mov $0x80, %dl       # Drive 0x80 (first hard disk)
+  mov BOOT_INFO_ADDRESS + BOOT_INFO_DRIVE, %dl
+  int $0x13
+  jc 2f
+  test %ah, %ah        # Some BIOSes only report the error in AH
+  jz 3f
+2:
+  xor %ah, %ah         # Reset the drive
+  mov BOOT_INFO_ADDRESS + BOOT_INFO_DRIVE, %dl
   int $0x13
-  jc disk_error
-    
+  loop 1b
+  jmp disk_error
+3:
+  ret
+
+disk_error:
+  mov $disk_error_message, %si
+1:
+  lodsb
+  test %al, %al
+  jz 2f
+  mov $0x0e, %ah       # Teletype output
+  xor %bx, %bx
+  int $0x10
+  jmp 1b
+2:
+  hlt
+  jmp 2b
+
+disk_error_message:
+  .asciz "Disk read error"
+
+# Disk Address Packet (DAP)
+.align 4
+dap:
+  .byte 0x10           # Size of DAP (16 bytes)
+  .byte 0x00           # Reserved (must be 0)
+dap_sectors:
+  .word 0              # Number of sectors to read, at most BOOT_READ_MAX
+dap_offset:
+  .word 0
+dap_segment:
+  .word 0
+dap_lba:
+  .quad 0              # Starting LBA sector
+
+# Pad to 510 bytes (512 - 2 for signature)
+.fill 510 - (. - _start), 1, 0x00
+.word 0xAA55  # Boot sector signature
+
+stage2:
+  movl $0, BOOT_INFO_ADDRESS + BOOT_INFO_E820_COUNT
+  call e820
+
+  # The kernel follows the loader. Chunks of up to BOOT_READ_MAX sectors stay
+  # within one 64 KiB segment, so each one starts at offset 0 of the next.
+  movl $KERNEL_SECTORS, BOOT_INFO_ADDRESS + BOOT_INFO_KERNEL_SECTORS
+  mov $KERNEL_SECTORS, %ebx
+  movw $0, dap_offset
+  movw $(KERNEL_PHYS >> 4), dap_segment
+  movl $BOOT_SECTORS, dap_lba
+1:
+  test %ebx, %ebx
+  jz 2f
+  mov $BOOT_READ_MAX, %ax
+  cmp $BOOT_READ_MAX, %ebx
+  jae 3f
+  mov %bx, %ax
+3:
+  mov %ax, dap_sectors
+  call disk_read
+  movzwl %bp, %eax
+  sub %eax, %ebx
+  add %eax, dap_lba
+  shl $5, %ax          # 512 byte sectors in 16 byte paragraphs
+  add %ax, dap_segment
+  jmp 1b
+2:
+  BOOT_STAMP 1
+  movl $BOOT_INFO_MAGIC, BOOT_INFO_ADDRESS + BOOT_INFO_MAGIC_OFFSET
+
   lgdt gdt_descriptor_16
   
   # Enable protected mode
@@ -30,6 +149,29 @@ _start:
   mov %eax, %cr0
   ljmp $0x08, $protected_mode
 
+# Copy the BIOS memory map (int 15h, function E820h) into the boot information
+# Leaves e820_count at 0 if the BIOS does not support it
+e820:
+  xor %ebx, %ebx       # Continuation value, 0 for the first entry
+  mov $(BOOT_INFO_ADDRESS + BOOT_INFO_E820), %di
+1:
+  movl $1, 20(%di)     # BIOSes that return 20 bytes leave the attributes: mark the entry valid
+  mov $0xe820, %eax
+  mov $BOOT_E820_SIZE, %ecx
+  mov $BOOT_E820_SMAP, %edx
+  int $0x15
+  jc 2f                # Unsupported, or past the last entry
+  cmp $BOOT_E820_SMAP, %eax
+  jne 2f
+  incl BOOT_INFO_ADDRESS + BOOT_INFO_E820_COUNT
+  add $BOOT_E820_SIZE, %di
+  test %ebx, %ebx      # 0 after the last entry
+  jz 2f
+  cmpl $BOOT_E820_MAX, BOOT_INFO_ADDRESS + BOOT_INFO_E820_COUNT
+  jb 1b
+2:
+  ret
+
 .code32
 protected_mode:
   mov $0x10, %ax
@@ -100,23 +242,12 @@ long_mode:
   mov $KERNEL_STACK, %rsp
   mov %rsp, %rbp
 
+  # Still identity mapped until arch_memory_init
+  BOOT_STAMP 2
+
   movabs $kernel, %rax
   jmp *%rax
 
-disk_error:
-  hlt
-  jmp disk_error
-
-# Disk Address Packet (DAP)
-.align 4
-dap:
-  .byte 0x10           # Size of DAP (16 bytes)
-  .byte 0x00           # Reserved (must be 0)
-  .word KERNEL_SECTORS # Number of sectors to read (calculated by linker)
-  .word 0x0000         # Offset: 0 (low 16 bits of 0x10000)
-  .word 0x1000         # Segment: 0x1000 (0x10000 >> 4 = 0x1000)
-  .quad 1              # Starting LBA sector (sector 1, after boot sector)
-
 .align 8
 gdt:
   # null segment (0x00)
@@ -154,6 +285,5 @@ gdt_descriptor:
   .word gdt_descriptor - gdt - 1    # size of GDT - 1
   .quad KERNEL_BASE + gdt           # GDT virtual address
 
-# Pad to 510 bytes (512 - 2 for signature)
-.fill 510 - (. - _start), 1, 0x00
-.word 0xAA55  # Boot sector signature
\ No newline at end of file
+# Loader sectors end on a sector boundary, so the kernel starts at BOOT_SECTORS
+.balign 512, 0
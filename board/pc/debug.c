@@ -1,20 +1,112 @@
 #include "arch/arch.h"
 #include "board/pc/serial.h"
+#include "kernel/log.h"
 #include "lib/printf.h"
 
+#define DEBUG_PORT SERIAL_PORT_0
+
+#define UART_IER            1
+#define UART_LSR            5
+#define UART_IER_THR_EMPTY  0x02
+#define UART_LSR_THR_EMPTY  0x20
+#define UART_FIFO_SIZE      16
+
+static bool debug_async = false;  // THR empty interrupt is wired up
+static bool debug_tx_busy = false;
+
+static void debug_drain_sync(void)
+{
+    char chunk[UART_FIFO_SIZE];
+    size_t n;
+
+    while ((n = log_read(chunk, sizeof(chunk))) > 0) {
+        while (!(inb(DEBUG_PORT + UART_LSR) & UART_LSR_THR_EMPTY));
+
+        for (size_t i = 0; i < n; i++) {
+            outb(DEBUG_PORT, (uint8_t)chunk[i]);
+        }
+    }
+}
+
+static void debug_kick(void)
+{
+    uint64_t state = arch_interrupt_save();
+
+    if (!debug_async) {
+        debug_drain_sync();
+    } else if (!debug_tx_busy) {
+        // The UART raises THR empty as soon as the interrupt is enabled
+        debug_tx_busy = true;
+        outb(DEBUG_PORT + UART_IER, inb(DEBUG_PORT + UART_IER) | UART_IER_THR_EMPTY);
+    }
+
+    arch_interrupt_restore(state);
+}
+
+void x86_debug_serial_interrupt(void)
+{
+    char chunk[UART_FIFO_SIZE];
+    size_t n = log_read(chunk, sizeof(chunk));
+
+    if (n == 0) {
+        outb(DEBUG_PORT + UART_IER, inb(DEBUG_PORT + UART_IER) & ~UART_IER_THR_EMPTY);
+        debug_tx_busy = false;
+        return;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        outb(DEBUG_PORT, (uint8_t)chunk[i]);
+    }
+}
+
+void x86_debug_enable_async(bool enable)
+{
+    uint64_t state = arch_interrupt_save();
+
+    debug_drain_sync();
+    outb(DEBUG_PORT + UART_IER, inb(DEBUG_PORT + UART_IER) & ~UART_IER_THR_EMPTY);
+    debug_tx_busy = false;
+    debug_async = enable;
+
+    arch_interrupt_restore(state);
+}
+
+static int debug_sink(void *context, const char *buf, size_t len)
+{
+    (void)context;
+
+    // A dropped run is counted by the log ring; keep formatting the rest
+    log_write(buf, len);
+    return 0;
+}
+
+void arch_debug_vprintf(const char *format, va_list args)
+{
+    vcbprintf(debug_sink, NULL, format, args);
+    debug_kick();
+}
+
+void arch_debug_write(const char *buf, size_t length)
+{
+    log_write(buf, length);
+    debug_kick();
+}
+
 void arch_debug_printf(const char *format, ...)
 {
     va_list args;
     va_start(args, format);
 
-    char buffer[256];
-    int len = vsnprintf(buffer, sizeof(buffer), format, args);
-    
-    for (int i = 0; i < len && buffer[i]; i++) {
-        while (!(inb(SERIAL_PORT_0 + 5) & 0x40));
-
-        outb(SERIAL_PORT_0, (uint8_t)buffer[i]);
-    }
+    arch_debug_vprintf(format, args);
 
     va_end(args);
-}
\ No newline at end of file
+}
+
+void arch_debug_flush(void)
+{
+    uint64_t state = arch_interrupt_save();
+
+    debug_drain_sync();
+
+    arch_interrupt_restore(state);
+}
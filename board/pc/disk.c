@@ -1,210 +1,1258 @@
 #include "arch/arch.h"
 #include "arch/x86_64/io.h"
+#include "arch/x86_64/memory.h"
+#include "arch/x86_64/pic.h"
+#include "board/pc/disk.h"
+#include "board/pc/pci.h"
+#include "board/pc/virtio.h"
 
 /* x86_64 ATA/IDE Disk
 
-  ATA Registers:
+  ATA Registers (offset from channel I/O base, 0x1F0 primary / 0x170 secondary):
 
-  - 0x1F0: Data port
-  - 0x1F1: Features/Error information  
-  - 0x1F2: Sector count
-  - 0x1F3: LBA low (bits 0-7)
-  - 0x1F4: LBA mid (bits 8-15)
-  - 0x1F5: LBA high (bits 16-23)
-  - 0x1F6: Drive select + LBA bits 24-27
-  - 0x1F7: Command/Status register
+  - +0: Data port
+  - +1: Features/Error information
+  - +2: Sector count
+  - +3: LBA low (bits 0-7)
+  - +4: LBA mid (bits 8-15)
+  - +5: LBA high (bits 16-23)
+  - +6: Drive select + LBA bits 24-27
+  - +7: Command/Status register
+
+  Control block (0x3F6 primary / 0x376 secondary):
+
+  - +0: Alternate status (read) / Device control (write)
+
+  Bus-master IDE registers (offset from PCI BAR4, +8 for the secondary channel):
+
+  - +0: Command (start, direction)
+  - +2: Status (active, error, interrupt)
+  - +4: Physical address of the PRD table
  */
 
-#define ATA_DATA        0x1F0
-#define ATA_ERROR       0x1F1
-#define ATA_FEATURES    0x1F1
-#define ATA_SECTOR_COUNT 0x1F2
-#define ATA_LBA_LOW     0x1F3
-#define ATA_LBA_MID     0x1F4
-#define ATA_LBA_HIGH    0x1F5
-#define ATA_DRIVE_SELECT 0x1F6
-#define ATA_STATUS      0x1F7
-#define ATA_COMMAND     0x1F7
+#define ATA_DATA         0
+#define ATA_ERROR        1
+#define ATA_FEATURES     1
+#define ATA_SECTOR_COUNT 2
+#define ATA_LBA_LOW      3
+#define ATA_LBA_MID      4
+#define ATA_LBA_HIGH     5
+#define ATA_DRIVE_SELECT 6
+#define ATA_STATUS       7
+#define ATA_COMMAND      7
 
+#define ATA_PRIMARY_IO     0x1F0
+#define ATA_PRIMARY_CTRL   0x3F6
+#define ATA_SECONDARY_IO   0x170
+#define ATA_SECONDARY_CTRL 0x376
+
+#define ATA_CMD_READ_SECTORS      0x20  // READ SECTORS (28-bit LBA)
 #define ATA_CMD_READ_SECTORS_EXT  0x24  // READ SECTORS EXT (48-bit LBA)
+#define ATA_CMD_WRITE_SECTORS     0x30  // WRITE SECTORS (28-bit LBA)
 #define ATA_CMD_WRITE_SECTORS_EXT 0x34  // WRITE SECTORS EXT (48-bit LBA)
+#define ATA_CMD_READ_MULTIPLE     0xC4  // READ MULTIPLE (28-bit LBA)
+#define ATA_CMD_READ_MULTIPLE_EXT 0x29  // READ MULTIPLE EXT (48-bit LBA)
+#define ATA_CMD_WRITE_MULTIPLE    0xC5  // WRITE MULTIPLE (28-bit LBA)
+#define ATA_CMD_WRITE_MULTIPLE_EXT 0x39 // WRITE MULTIPLE EXT (48-bit LBA)
+#define ATA_CMD_SET_MULTIPLE      0xC6
+#define ATA_CMD_READ_DMA          0xC8  // READ DMA (28-bit LBA)
+#define ATA_CMD_READ_DMA_EXT      0x25  // READ DMA EXT (48-bit LBA)
+#define ATA_CMD_WRITE_DMA         0xCA  // WRITE DMA (28-bit LBA)
+#define ATA_CMD_WRITE_DMA_EXT     0x35  // WRITE DMA EXT (48-bit LBA)
+#define ATA_CMD_WRITE_DMA_FUA_EXT 0x3D  // WRITE DMA FUA EXT (48-bit LBA)
+#define ATA_CMD_WRITE_MULTIPLE_FUA_EXT 0xCE  // WRITE MULTIPLE FUA EXT (48-bit LBA)
+#define ATA_CMD_FLUSH_CACHE       0xE7
+#define ATA_CMD_FLUSH_CACHE_EXT   0xEA
+#define ATA_CMD_SET_FEATURES      0xEF
+#define ATA_CMD_IDENTIFY          0xEC
+
+#define ATA_FEATURE_TRANSFER_MODE 0x03
+#define ATA_TRANSFER_MWDMA        0x20  // OR'd with the mode number
+#define ATA_TRANSFER_UDMA         0x40
 
 #define ATA_STATUS_BUSY    0x80
 #define ATA_STATUS_READY   0x40
 #define ATA_STATUS_DRQ     0x08  // Data Request
 #define ATA_STATUS_ERROR   0x01
 
+#define ATA_SELECT_LBA     0x40
+#define ATA_SELECT_SLAVE   0x10
+#define ATA_CONTROL_NIEN   0x02  // Mask the drive's interrupt line
+
+// IDENTIFY DEVICE words
+#define ATA_ID_CONFIG          0    // Bit 15 clear for ATA devices
+#define ATA_ID_MODEL           27   // 40 characters, byte-swapped
+#define ATA_ID_MAX_MULTIPLE    47   // Low byte: max sectors per READ/WRITE MULTIPLE
+#define ATA_ID_CAPABILITIES    49
+#define ATA_ID_LBA28_SECTORS   60   // Two words
+#define ATA_ID_VALID_FIELDS    53
+#define ATA_ID_MWDMA_MODES     63
+#define ATA_ID_COMMAND_SETS    83
+#define ATA_ID_COMMAND_EXT     84
+#define ATA_ID_UDMA_MODES      88
+#define ATA_ID_LBA48_SECTORS   100  // Four words
+#define ATA_ID_SECTOR_SIZE     106
+#define ATA_ID_LOGICAL_SIZE    117  // Two words, in 16-bit words
+
+#define ATA_CAP_DMA            (1 << 8)
+#define ATA_CAP_LBA            (1 << 9)
+#define ATA_VALID_UDMA         (1 << 2)
+#define ATA_CMDSET_LBA48       (1 << 10)
+#define ATA_CMDSET_FLUSH       (1 << 12)
+#define ATA_CMDSET_FLUSH_EXT   (1 << 13)
+#define ATA_CMDSET_VALID_MASK  0xC000  // Words 83 and 84 are valid when bits 15:14 are 01
+#define ATA_CMDSET_VALID       0x4000
+#define ATA_CMDEXT_FUA         (1 << 6)
+#define ATA_SIZE_VALID_MASK    0xC000
+#define ATA_SIZE_VALID         0x4000
+#define ATA_SIZE_LOGICAL_LARGE (1 << 12)
+
+#define ATA_SECTOR_SIZE 512
+#define ATA_MAX_SECTORS_LBA28 256    // Sector count 0 means 256
+#define ATA_MAX_SECTORS_LBA48 65536  // Sector count 0 means 65536
+#define ATA_TIMEOUT_NS         1000000000ULL  // Status waits
+#define ATA_COMMAND_TIMEOUT_NS 5000000000ULL  // Whole commands, enforced from the timer tick
+#define ATA_FLUSH_TIMEOUT_NS   30000000000ULL // A cache flush may write out the whole cache
+#define ATA_POLL_LIMIT         10000000       // Bounds polled waits while the timer is stopped
+
+#define BM_COMMAND 0
+#define BM_STATUS  2
+#define BM_PRDT    4
+#define BM_CHANNEL_STRIDE 8
+
+#define BM_COMMAND_START 0x01
+#define BM_COMMAND_READ  0x08  // Device to memory
+
+#define BM_STATUS_ACTIVE    0x01
+#define BM_STATUS_ERROR     0x02
+#define BM_STATUS_INTERRUPT 0x04
+
+#define PCI_IDE_PROGIF_BUS_MASTER 0x80
+#define PCI_IDE_PROGIF_PRIMARY_NATIVE   0x01
+#define PCI_IDE_PROGIF_SECONDARY_NATIVE 0x04
+
+// Physical region descriptor: a region may not cross a 64 KiB boundary
+#define PRD_END_OF_TABLE 0x8000
+#define PRD_MAX_BYTES    0x10000
+#define PRD_ENTRIES      (PAGE_SIZE / sizeof(ata_prd_t))
+
+#define RFLAGS_IF (1 << 9)
+
+#define ATA_DMA_MAX_SECTORS 32768              // 16 MiB of 512-byte sectors per command
+
+typedef struct {
+    uint32_t address;
+    uint16_t byte_count;  // 0 means 64 KiB
+    uint16_t flags;
+} ata_prd_t;
+
 typedef struct {
+    uint16_t io;
+    uint16_t ctrl;
+    uint8_t irq;
+    uint16_t bmide;               // Bus-master register base, 0 without a DMA engine
+    ata_prd_t *prdt;              // One page of descriptors
+
+    // Requests for both drives queue here; the head is on the wire
+    arch_disk_request_t *head;
+    arch_disk_request_t *tail;
+    arch_disk_segment_t single;   // Segment list of a request that only has a buffer
+    const arch_disk_segment_t *segment;      // Transfer cursor of the head request
+    const arch_disk_segment_t *segment_end;
+    uint8_t *buffer;              // Position within the current segment
+    uint64_t segment_left;        // Bytes left in the current segment
+    bool dma_capable;             // Every segment of the head request suits the DMA engine
+    bool fua_native;              // The head request's writes use FUA commands
+    uint8_t phase;                // ATA_PHASE_* of the head request
+    uint64_t lba;
+    uint32_t remaining;           // Sectors of the head request not yet issued
+    uint32_t command_sectors;     // Sectors in the current command
+    uint32_t command_left;        // Sectors of the current command still to move (PIO)
+    bool dma_active;
+    uint64_t deadline;            // arch_time_ns() at which the current command times out
+} ata_channel_t;
+
+// A request flushes the drive cache before and after its data as its flags require
+#define ATA_PHASE_PREFLUSH  0
+#define ATA_PHASE_DATA      1
+#define ATA_PHASE_POSTFLUSH 2
+
+static ata_channel_t ata_channels[] = {
+    { ATA_PRIMARY_IO, ATA_PRIMARY_CTRL, ATA_IRQ_PRIMARY },
+    { ATA_SECONDARY_IO, ATA_SECONDARY_CTRL, ATA_IRQ_SECONDARY },
+};
+
+#define ATA_CHANNEL_COUNT (sizeof(ata_channels) / sizeof(ata_channels[0]))
+
+struct arch_disk_device {
+    ata_channel_t *channel;
+    bool slave;
     bool initialized;
-    uint64_t block_count;    // Total sectors
-    uint32_t block_size;     // Bytes per sector (512)
-} ata_disk_device_t;
+    bool lba48;
+    uint64_t block_count;      // Total sectors
+    uint32_t block_size;       // Bytes per sector
+    uint8_t max_multiple;      // Sectors per READ/WRITE MULTIPLE block, 0 if unsupported
+    uint8_t multiple;          // Sectors per DRQ block as set with SET MULTIPLE MODE, 0 if off
+    uint8_t mwdma_modes;       // Supported multiword DMA modes (bit mask)
+    uint8_t udma_modes;        // Supported Ultra DMA modes (bit mask)
+    bool dma;                  // Transfers use the bus-master engine
+    bool flush;                // FLUSH CACHE is supported
+    bool flush_ext;            // FLUSH CACHE EXT is supported
+    bool fua;                  // FUA write commands are supported
+    char model[41];
+    virtio_blk_t *virtio;      // Set for virtio-blk disks, which use none of the ATA fields
+};
+
+typedef struct {
+    struct arch_disk_device device;
+    const char *name;
+    bool identifying;          // IDENTIFY issued by arch_disk_start, reply not read yet
+    bool detected;
+} x86_ata_drive_t;
+
+static x86_ata_drive_t x86_ata_drives[] = {
+    { .device = { .channel = &ata_channels[0], .slave = false }, .name = "ata0" },
+    { .device = { .channel = &ata_channels[0], .slave = true }, .name = "ata1" },
+    { .device = { .channel = &ata_channels[1], .slave = false }, .name = "ata2" },
+    { .device = { .channel = &ata_channels[1], .slave = true }, .name = "ata3" },
+};
+
+#define X86_ATA_DRIVE_COUNT (sizeof(x86_ata_drives) / sizeof(x86_ata_drives[0]))
+
+static bool ata_drives_detected = false;
 
-static ata_disk_device_t ata_disk = {0};
+// virtio-blk disks follow the ATA drives in the disk index
+static struct arch_disk_device virtio_disks[VIRTIO_BLK_MAX];
+
+static virtio_blk_t *disk_virtio(struct arch_disk_device *disk)
+{
+    if (disk >= virtio_disks && disk < virtio_disks + VIRTIO_BLK_MAX) {
+        return disk->virtio;
+    }
+
+    return NULL;
+}
+
+// Reading the alternate status four times gives the drive the 400ns it needs after a select
+static void ata_delay(const ata_channel_t *channel)
+{
+    for (int i = 0; i < 4; i++) {
+        inb(channel->ctrl);
+    }
+}
 
-static arch_result ata_wait_ready(void)
+static void ata_select(struct arch_disk_device *disk, uint8_t lba_high_bits)
+{
+    outb(disk->channel->io + ATA_DRIVE_SELECT,
+         0xA0 | ATA_SELECT_LBA | (disk->slave ? ATA_SELECT_SLAVE : 0) | (lba_high_bits & 0x0F));
+    ata_delay(disk->channel);
+}
+
+// The tick only advances with interrupts enabled, so polled waits are also bounded by count
+static bool ata_expired(uint64_t deadline, uint32_t *polls)
+{
+    return arch_time_ns() >= deadline || ++*polls >= ATA_POLL_LIMIT;
+}
+
+static arch_result ata_wait_ready(struct arch_disk_device *disk)
 {
     uint8_t status;
-    int timeout = 10000;
-    
+    uint64_t deadline = arch_time_ns() + ATA_TIMEOUT_NS;
+    uint32_t polls = 0;
+
     do {
-        status = inb(ATA_STATUS);
+        status = inb(disk->channel->io + ATA_STATUS);
         if (!(status & ATA_STATUS_BUSY) && (status & ATA_STATUS_READY)) {
             return ARCH_OK;
         }
-        timeout--;
-    } while (timeout > 0);
-    
+    } while (!ata_expired(deadline, &polls));
+
     return ARCH_ERROR;
 }
 
-static arch_result ata_wait_data(void)
+static arch_result ata_wait_data(struct arch_disk_device *disk)
 {
     uint8_t status;
-    int timeout = 10000;
-    
+    uint64_t deadline = arch_time_ns() + ATA_TIMEOUT_NS;
+    uint32_t polls = 0;
+
     do {
-        status = inb(ATA_STATUS);
+        status = inb(disk->channel->io + ATA_STATUS);
+        if (status & ATA_STATUS_ERROR) {
+            return ARCH_ERROR;
+        }
         if (!(status & ATA_STATUS_BUSY) && (status & ATA_STATUS_DRQ)) {
             return ARCH_OK;
         }
-        if (status & ATA_STATUS_ERROR) {
-            return ARCH_ERROR;
+    } while (!ata_expired(deadline, &polls));
+
+    return ARCH_ERROR;
+}
+
+static arch_result ata_wait_idle(struct arch_disk_device *disk)
+{
+    uint8_t status;
+    uint64_t deadline = arch_time_ns() + ATA_TIMEOUT_NS;
+    uint32_t polls = 0;
+
+    do {
+        status = inb(disk->channel->io + ATA_STATUS);
+        if (!(status & ATA_STATUS_BUSY)) {
+            return (status & ATA_STATUS_ERROR) ? ARCH_ERROR : ARCH_OK;
         }
-        timeout--;
-    } while (timeout > 0);
-    
+    } while (!ata_expired(deadline, &polls));
+
     return ARCH_ERROR;
 }
 
+static void ata_parse_identify(struct arch_disk_device *disk, const uint16_t *id)
+{
+    for (int i = 0; i < 20; i++) {
+        disk->model[i * 2] = (char)(id[ATA_ID_MODEL + i] >> 8);
+        disk->model[i * 2 + 1] = (char)(id[ATA_ID_MODEL + i] & 0xFF);
+    }
+    disk->model[40] = 0;
+    for (int i = 39; i >= 0 && disk->model[i] == ' '; i--) {
+        disk->model[i] = 0;
+    }
+
+    disk->lba48 = (id[ATA_ID_COMMAND_SETS] & ATA_CMDSET_LBA48) != 0;
+    if (disk->lba48) {
+        disk->block_count = (uint64_t)id[ATA_ID_LBA48_SECTORS] |
+                            ((uint64_t)id[ATA_ID_LBA48_SECTORS + 1] << 16) |
+                            ((uint64_t)id[ATA_ID_LBA48_SECTORS + 2] << 32) |
+                            ((uint64_t)id[ATA_ID_LBA48_SECTORS + 3] << 48);
+    } else {
+        disk->block_count = (uint64_t)id[ATA_ID_LBA28_SECTORS] |
+                            ((uint64_t)id[ATA_ID_LBA28_SECTORS + 1] << 16);
+    }
+
+    disk->block_size = ATA_SECTOR_SIZE;
+    uint16_t size = id[ATA_ID_SECTOR_SIZE];
+    if ((size & ATA_SIZE_VALID_MASK) == ATA_SIZE_VALID && (size & ATA_SIZE_LOGICAL_LARGE)) {
+        disk->block_size = ((uint32_t)id[ATA_ID_LOGICAL_SIZE] |
+                            ((uint32_t)id[ATA_ID_LOGICAL_SIZE + 1] << 16)) * 2;
+    }
+
+    disk->flush = false;
+    disk->flush_ext = false;
+    disk->fua = false;
+    if ((id[ATA_ID_COMMAND_SETS] & ATA_CMDSET_VALID_MASK) == ATA_CMDSET_VALID) {
+        disk->flush = (id[ATA_ID_COMMAND_SETS] & ATA_CMDSET_FLUSH) != 0;
+        disk->flush_ext = disk->lba48 && (id[ATA_ID_COMMAND_SETS] & ATA_CMDSET_FLUSH_EXT) != 0;
+    }
+    if ((id[ATA_ID_COMMAND_EXT] & ATA_CMDSET_VALID_MASK) == ATA_CMDSET_VALID) {
+        disk->fua = disk->lba48 && (id[ATA_ID_COMMAND_EXT] & ATA_CMDEXT_FUA) != 0;
+    }
+
+    disk->max_multiple = id[ATA_ID_MAX_MULTIPLE] & 0xFF;
+
+    disk->mwdma_modes = 0;
+    disk->udma_modes = 0;
+    if (id[ATA_ID_CAPABILITIES] & ATA_CAP_DMA) {
+        disk->mwdma_modes = id[ATA_ID_MWDMA_MODES] & 0x07;
+        if (id[ATA_ID_VALID_FIELDS] & ATA_VALID_UDMA) {
+            disk->udma_modes = id[ATA_ID_UDMA_MODES] & 0x7F;
+        }
+    }
+}
+
+/* Issue IDENTIFY without waiting for the reply
+ *
+ * @param disk Drive to identify
+ * @return false if no drive answers, true if ata_identify_finish should collect the reply
+ */
+static bool ata_identify(struct arch_disk_device *disk)
+{
+    const ata_channel_t *channel = disk->channel;
+
+    // Polled I/O: keep the drive from raising its interrupt line
+    outb(channel->ctrl, ATA_CONTROL_NIEN);
+    ata_select(disk, 0);
+
+    // A floating bus reads back 0xFF; no controller on this channel
+    if (inb(channel->io + ATA_STATUS) == 0xFF) {
+        return false;
+    }
+
+    outb(channel->io + ATA_SECTOR_COUNT, 0);
+    outb(channel->io + ATA_LBA_LOW, 0);
+    outb(channel->io + ATA_LBA_MID, 0);
+    outb(channel->io + ATA_LBA_HIGH, 0);
+    outb(channel->io + ATA_COMMAND, ATA_CMD_IDENTIFY);
+    ata_delay(channel);
+
+    return inb(channel->io + ATA_STATUS) != 0;
+}
+
+/* Wait for the IDENTIFY reply issued by ata_identify and parse it
+ *
+ * @param disk Drive being identified
+ * @return true if the drive is a usable ATA disk
+ */
+static bool ata_identify_finish(struct arch_disk_device *disk)
+{
+    const ata_channel_t *channel = disk->channel;
+
+    uint64_t deadline = arch_time_ns() + ATA_TIMEOUT_NS;
+    uint32_t polls = 0;
+    while (inb(channel->io + ATA_STATUS) & ATA_STATUS_BUSY) {
+        if (ata_expired(deadline, &polls)) {
+            return false;
+        }
+    }
+
+    // ATAPI and SATA devices abort IDENTIFY and leave a signature in the LBA registers
+    if (inb(channel->io + ATA_LBA_MID) != 0 || inb(channel->io + ATA_LBA_HIGH) != 0) {
+        return false;
+    }
+
+    if (ata_wait_data(disk) != ARCH_OK) {
+        return false;
+    }
+
+    uint16_t id[256];
+    for (int word = 0; word < 256; word++) {
+        id[word] = inw(channel->io + ATA_DATA);
+    }
+
+    if ((id[ATA_ID_CONFIG] & 0x8000) || !(id[ATA_ID_CAPABILITIES] & ATA_CAP_LBA)) {
+        return false;
+    }
+
+    ata_parse_identify(disk, id);
+
+    return disk->block_count > 0;
+}
+
+static bool ata_probe(struct arch_disk_device *disk)
+{
+    return ata_identify(disk) && ata_identify_finish(disk);
+}
+
+static void detect_ata_drives(void)
+{
+    if (ata_drives_detected) return;
+
+    for (int i = 0; i < X86_ATA_DRIVE_COUNT; i++) {
+        struct arch_disk_device *disk = &x86_ata_drives[i].device;
+
+        if (x86_ata_drives[i].identifying) {
+            x86_ata_drives[i].identifying = false;
+            x86_ata_drives[i].detected = ata_identify_finish(disk);
+        } else {
+            x86_ata_drives[i].detected = ata_probe(disk);
+        }
+        if (x86_ata_drives[i].detected) {
+            arch_debug_printf("%s: %s, %lu sectors of %u bytes, %s, multiple %u, MWDMA %x, UDMA %x%s\n",
+                              x86_ata_drives[i].name, disk->model, disk->block_count, disk->block_size,
+                              disk->lba48 ? "LBA48" : "LBA28", disk->max_multiple,
+                              disk->mwdma_modes, disk->udma_modes,
+                              disk->channel->bmide ? ", bus-master" : "");
+        }
+    }
+
+    ata_drives_detected = true;
+}
+
+// Program the task file for a transfer of count sectors starting at lba
+static void ata_setup_transfer(struct arch_disk_device *disk, uint64_t lba, uint32_t count)
+{
+    uint16_t io = disk->channel->io;
+
+    if (disk->lba48) {
+        ata_select(disk, 0);
+        outb(io + ATA_SECTOR_COUNT, (count >> 8) & 0xFF);  // Sector count high
+        outb(io + ATA_LBA_LOW, (lba >> 24) & 0xFF);        // LBA bits 24-31
+        outb(io + ATA_LBA_MID, (lba >> 32) & 0xFF);        // LBA bits 32-39
+        outb(io + ATA_LBA_HIGH, (lba >> 40) & 0xFF);       // LBA bits 40-47
+    } else {
+        ata_select(disk, (lba >> 24) & 0x0F);              // LBA bits 24-27
+    }
+
+    outb(io + ATA_SECTOR_COUNT, count & 0xFF);             // Sector count low
+    outb(io + ATA_LBA_LOW, lba & 0xFF);                    // LBA bits 0-7
+    outb(io + ATA_LBA_MID, (lba >> 8) & 0xFF);             // LBA bits 8-15
+    outb(io + ATA_LBA_HIGH, (lba >> 16) & 0xFF);           // LBA bits 16-23
+}
+
+static bool ata_valid(struct arch_disk_device *disk)
+{
+    for (int i = 0; i < X86_ATA_DRIVE_COUNT; i++) {
+        if (disk == &x86_ata_drives[i].device) {
+            return x86_ata_drives[i].detected;
+        }
+    }
+
+    return false;
+}
+
+void arch_disk_start(void)
+{
+    if (ata_drives_detected) return;
+
+    // One drive per channel: a slave's IDENTIFY has to wait for its master's
+    for (int i = 0; i < X86_ATA_DRIVE_COUNT; i++) {
+        if (!x86_ata_drives[i].device.slave) {
+            x86_ata_drives[i].identifying = ata_identify(&x86_ata_drives[i].device);
+        }
+    }
+}
 
 int arch_disk_get_count(void)
 {
-    return 1;
+    detect_ata_drives();
+
+    int count = 0;
+    for (int i = 0; i < X86_ATA_DRIVE_COUNT; i++) {
+        if (x86_ata_drives[i].detected) {
+            count++;
+        }
+    }
+    return count + virtio_blk_get_count();
 }
 
 arch_result arch_disk_get_info(int index, arch_disk_info_t *info)
 {
-    if (index != 0 || !info) {
-        return ARCH_ERROR;
+    if (!info) return ARCH_ERROR;
+
+    detect_ata_drives();
+
+    int found_count = 0;
+    for (int i = 0; i < X86_ATA_DRIVE_COUNT; i++) {
+        if (x86_ata_drives[i].detected) {
+            if (found_count == index) {
+                struct arch_disk_device *disk = &x86_ata_drives[i].device;
+
+                info->device = disk;
+                info->name = x86_ata_drives[i].name;
+                info->block_size = disk->block_size;
+                info->block_count = disk->block_count;
+                info->read_only = false;
+                info->max_segments = 0;
+                return ARCH_OK;
+            }
+            found_count++;
+        }
     }
-    
-    info->device = (arch_disk_device_t *)&ata_disk;
-    info->name = "ata0";
-    info->block_size = 512;    // Standard sector size
-    info->block_count = 10;    // 5MB for testing (10 * 512 bytes) TODO: detect actual size
-    info->read_only = false;
-    
-    return ARCH_OK;
+
+    virtio_blk_t *blk = virtio_blk_get(index - found_count);
+    if (blk) {
+        struct arch_disk_device *disk = &virtio_disks[index - found_count];
+
+        disk->virtio = blk;
+        info->device = disk;
+        virtio_blk_get_info(blk, info);
+        return ARCH_OK;
+    }
+
+    return ARCH_ERROR;
 }
 
-arch_result arch_disk_init(arch_disk_device_t *device)
+// Switch the drive to multi-sector DRQ blocks; falls back to one sector per DRQ on failure
+static void ata_set_multiple(struct arch_disk_device *disk)
 {
-    ata_disk_device_t *disk = (ata_disk_device_t *)device;
-    
-    if (disk != &ata_disk) {
-        return ARCH_ERROR;
+    uint8_t count = disk->max_multiple;
+
+    disk->multiple = 0;
+    if (count <= 1 || (count & (count - 1)) != 0) {
+        return;
     }
-    
-    disk->initialized = true;
-    disk->block_size = 512;
 
-    // TODO: detect actual size
-    disk->block_count = 10; // 5MB
-    
-    return ARCH_OK;
+    if (ata_wait_ready(disk) != ARCH_OK) {
+        return;
+    }
+
+    ata_select(disk, 0);
+    outb(disk->channel->io + ATA_SECTOR_COUNT, count);
+    outb(disk->channel->io + ATA_COMMAND, ATA_CMD_SET_MULTIPLE);
+
+    if (ata_wait_idle(disk) == ARCH_OK) {
+        disk->multiple = count;
+    }
 }
 
-arch_result arch_disk_read_blocks(arch_disk_device_t *device, void *buf, uint64_t start_block, uint32_t block_count)
+static uint8_t ata_command(struct arch_disk_device *disk, bool write)
 {
-    ata_disk_device_t *disk = (ata_disk_device_t *)device;
-    
-    if (disk != &ata_disk || !disk->initialized || !buf || block_count == 0) {
-        return ARCH_ERROR;
+    if (disk->multiple) {
+        if (write) {
+            return disk->lba48 ? ATA_CMD_WRITE_MULTIPLE_EXT : ATA_CMD_WRITE_MULTIPLE;
+        }
+        return disk->lba48 ? ATA_CMD_READ_MULTIPLE_EXT : ATA_CMD_READ_MULTIPLE;
+    }
+
+    if (write) {
+        return disk->lba48 ? ATA_CMD_WRITE_SECTORS_EXT : ATA_CMD_WRITE_SECTORS;
+    }
+    return disk->lba48 ? ATA_CMD_READ_SECTORS_EXT : ATA_CMD_READ_SECTORS;
+}
+
+// Program the fastest DMA mode both ends support; the drive keeps using PIO on failure
+static void ata_set_dma(struct arch_disk_device *disk)
+{
+    ata_channel_t *channel = disk->channel;
+    uint8_t mode;
+
+    disk->dma = false;
+    if (!channel->bmide) {
+        return;
+    }
+
+    if (disk->udma_modes) {
+        mode = ATA_TRANSFER_UDMA | (31 - __builtin_clz(disk->udma_modes));
+    } else if (disk->mwdma_modes) {
+        mode = ATA_TRANSFER_MWDMA | (31 - __builtin_clz(disk->mwdma_modes));
+    } else {
+        return;
+    }
+
+    if (ata_wait_ready(disk) != ARCH_OK) {
+        return;
+    }
+
+    ata_select(disk, 0);
+    outb(channel->io + ATA_FEATURES, ATA_FEATURE_TRANSFER_MODE);
+    outb(channel->io + ATA_SECTOR_COUNT, mode);
+    outb(channel->io + ATA_COMMAND, ATA_CMD_SET_FEATURES);
+
+    if (ata_wait_idle(disk) == ARCH_OK) {
+        disk->dma = true;
+    }
+}
+
+// The engine needs even, linearly mapped buffers
+static bool ata_dma_usable(struct arch_disk_device *disk, const arch_disk_segment_t *segment,
+                           const arch_disk_segment_t *end)
+{
+    if (!disk->dma) {
+        return false;
+    }
+
+    for (; segment < end; segment++) {
+        uint64_t start = (uint64_t)segment->buffer;
+        uint64_t length = (uint64_t)segment->block_count * disk->block_size;
+
+        if ((start & 1) != 0 || start < KERNEL_BASE || start + length > KERNEL_MAP_BASE) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Move the transfer cursor forward, stepping into the next segment as one runs out
+static void ata_advance(ata_channel_t *channel, uint64_t bytes)
+{
+    uint32_t block_size = channel->head->device->block_size;
+
+    while (bytes > 0) {
+        uint64_t length = bytes < channel->segment_left ? bytes : channel->segment_left;
+
+        channel->buffer += length;
+        channel->segment_left -= length;
+        bytes -= length;
+
+        if (channel->segment_left == 0 && channel->segment + 1 < channel->segment_end) {
+            channel->segment++;
+            channel->buffer = channel->segment->buffer;
+            channel->segment_left = (uint64_t)channel->segment->block_count * block_size;
+        }
+    }
+}
+
+// Describe the next bytes from the transfer cursor on, splitting at 64 KiB boundaries
+static bool ata_build_prdt(ata_channel_t *channel, uint64_t bytes)
+{
+    uint32_t block_size = channel->head->device->block_size;
+    const arch_disk_segment_t *segment = channel->segment;
+    uint64_t address = physical_address(channel->buffer);
+    uint64_t segment_left = channel->segment_left;
+    uint32_t entry = 0;
+
+    while (bytes > 0) {
+        if (entry == PRD_ENTRIES) {
+            return false;
+        }
+
+        if (segment_left == 0) {
+            segment++;
+            address = physical_address(segment->buffer);
+            segment_left = (uint64_t)segment->block_count * block_size;
+        }
+
+        uint64_t length = PRD_MAX_BYTES - (address & (PRD_MAX_BYTES - 1));
+        if (length > bytes) {
+            length = bytes;
+        }
+        if (length > segment_left) {
+            length = segment_left;
+        }
+
+        channel->prdt[entry].address = (uint32_t)address;
+        channel->prdt[entry].byte_count = (uint16_t)length;
+        channel->prdt[entry].flags = 0;
+
+        address += length;
+        segment_left -= length;
+        bytes -= length;
+        entry++;
+    }
+
+    channel->prdt[entry - 1].flags = PRD_END_OF_TABLE;
+
+    return true;
+}
+
+/* Interrupt-driven engine
+ *
+ * Each channel runs the request at the head of its queue one command at a
+ * time, up to the addressing limit per command. The channel interrupt moves
+ * the next PIO DRQ block (one sector, or a block of sectors in multiple mode)
+ * or ends the DMA, then issues the following command or completes the
+ * request. The timer tick fails commands that overrun their deadline. A
+ * request may scatter over several segments; the cursor walks them in order
+ * and DMA commands describe them with one PRD table. */
+
+static void ata_start_command(ata_channel_t *channel);
+static void ata_complete(ata_channel_t *channel, arch_result result);
+
+static void ata_start_flush(ata_channel_t *channel)
+{
+    struct arch_disk_device *disk = channel->head->device;
+
+    channel->dma_active = false;
+    channel->deadline = arch_time_ns() + ATA_FLUSH_TIMEOUT_NS;
+
+    uint8_t status = inb(channel->io + ATA_STATUS);
+    if ((status & ATA_STATUS_BUSY) || !(status & ATA_STATUS_READY)) {
+        ata_complete(channel, ARCH_ERROR);
+        return;
+    }
+
+    ata_select(disk, 0);
+    outb(channel->io + ATA_COMMAND, disk->flush_ext ? ATA_CMD_FLUSH_CACHE_EXT : ATA_CMD_FLUSH_CACHE);
+}
+
+// The data is through: make it durable if FUA was asked for but not available
+static void ata_finish_data(ata_channel_t *channel)
+{
+    arch_disk_request_t *request = channel->head;
+
+    if ((request->flags & ARCH_DISK_FUA) && request->write && !channel->fua_native &&
+        request->device->flush) {
+        channel->phase = ATA_PHASE_POSTFLUSH;
+        ata_start_flush(channel);
+    } else {
+        ata_complete(channel, ARCH_OK);
+    }
+}
+
+static void ata_start_data(ata_channel_t *channel)
+{
+    channel->phase = ATA_PHASE_DATA;
+
+    if (channel->remaining > 0) {
+        ata_start_command(channel);
+    } else {
+        ata_finish_data(channel);
+    }
+}
+
+static void ata_start(ata_channel_t *channel)
+{
+    arch_disk_request_t *request = channel->head;
+
+    if (request) {
+        if (request->segment_count) {
+            channel->segment = request->segments;
+            channel->segment_end = request->segments + request->segment_count;
+        } else {
+            channel->single.buffer = request->buffer;
+            channel->single.block_count = request->block_count;
+            channel->segment = &channel->single;
+            channel->segment_end = &channel->single + 1;
+        }
+        channel->buffer = channel->segment->buffer;
+        channel->segment_left = (uint64_t)channel->segment->block_count * request->device->block_size;
+        channel->dma_capable = ata_dma_usable(request->device, channel->segment, channel->segment_end);
+        channel->fua_native = (request->flags & ARCH_DISK_FUA) && request->write && request->device->fua &&
+                              (channel->dma_capable || request->device->multiple);
+        channel->lba = request->start_block;
+        channel->remaining = request->block_count;
+
+        if ((request->flags & ARCH_DISK_PREFLUSH) && request->device->flush) {
+            channel->phase = ATA_PHASE_PREFLUSH;
+            ata_start_flush(channel);
+        } else {
+            ata_start_data(channel);
+        }
+    }
+}
+
+// Retire the head request and start the next one before reporting back
+static void ata_complete(ata_channel_t *channel, arch_result result)
+{
+    arch_disk_request_t *request = channel->head;
+
+    channel->head = request->next;
+    if (!channel->head) {
+        channel->tail = NULL;
+    }
+    channel->dma_active = false;
+
+    request->next = NULL;
+    request->result = result;
+
+    ata_start(channel);
+
+    if (request->complete) {
+        request->complete(request);
+    }
+}
+
+static void ata_pio_block(ata_channel_t *channel)
+{
+    struct arch_disk_device *disk = channel->head->device;
+    uint32_t drq_sectors = disk->multiple ? disk->multiple : 1;
+    uint32_t sectors = channel->command_left < drq_sectors ? channel->command_left : drq_sectors;
+    uint64_t bytes = (uint64_t)sectors * disk->block_size;
+
+    // A multiple-mode block may straddle segments
+    while (bytes > 0) {
+        uint64_t length = bytes < channel->segment_left ? bytes : channel->segment_left;
+
+        if (channel->head->write) {
+            outsw(channel->io + ATA_DATA, channel->buffer, length / 2);
+        } else {
+            insw(channel->io + ATA_DATA, channel->buffer, length / 2);
+        }
+
+        ata_advance(channel, length);
+        bytes -= length;
+    }
+
+    channel->command_left -= sectors;
+}
+
+static void ata_start_command(ata_channel_t *channel)
+{
+    arch_disk_request_t *request = channel->head;
+    struct arch_disk_device *disk = request->device;
+    uint32_t max_sectors = disk->lba48 ? ATA_MAX_SECTORS_LBA48 : ATA_MAX_SECTORS_LBA28;
+
+    channel->dma_active = channel->dma_capable;
+    if (channel->dma_active && max_sectors > ATA_DMA_MAX_SECTORS) {
+        max_sectors = ATA_DMA_MAX_SECTORS;
+    }
+
+    uint32_t count = channel->remaining < max_sectors ? channel->remaining : max_sectors;
+    channel->command_sectors = count;
+    channel->command_left = count;
+    channel->deadline = arch_time_ns() + ATA_COMMAND_TIMEOUT_NS;
+
+    // The previous command has completed, so a drive that is still busy is stuck
+    uint8_t status = inb(channel->io + ATA_STATUS);
+    if ((status & ATA_STATUS_BUSY) || !(status & ATA_STATUS_READY)) {
+        ata_complete(channel, ARCH_ERROR);
+        return;
+    }
+
+    if (channel->dma_active) {
+        uint16_t bm = channel->bmide;
+        uint8_t direction = request->write ? 0 : BM_COMMAND_READ;
+        uint8_t command;
+
+        if (channel->fua_native) {
+            command = ATA_CMD_WRITE_DMA_FUA_EXT;
+        } else if (request->write) {
+            command = disk->lba48 ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_WRITE_DMA;
+        } else {
+            command = disk->lba48 ? ATA_CMD_READ_DMA_EXT : ATA_CMD_READ_DMA;
+        }
+
+        if (!ata_build_prdt(channel, (uint64_t)count * disk->block_size)) {
+            ata_complete(channel, ARCH_ERROR);
+            return;
+        }
+
+        outb(bm + BM_COMMAND, 0);
+        outl(bm + BM_PRDT, (uint32_t)physical_address(channel->prdt));
+        outb(bm + BM_STATUS, inb(bm + BM_STATUS) | BM_STATUS_INTERRUPT | BM_STATUS_ERROR);
+        outb(bm + BM_COMMAND, direction);
+
+        ata_setup_transfer(disk, channel->lba, count);
+        outb(channel->io + ATA_COMMAND, command);
+        outb(bm + BM_COMMAND, direction | BM_COMMAND_START);
+        return;
+    }
+
+    ata_setup_transfer(disk, channel->lba, count);
+    outb(channel->io + ATA_COMMAND, channel->fua_native ? ATA_CMD_WRITE_MULTIPLE_FUA_EXT :
+                                    ata_command(disk, request->write));
+
+    // The first block of a write goes out without waiting for an interrupt
+    if (request->write) {
+        if (ata_wait_data(disk) != ARCH_OK) {
+            ata_complete(channel, ARCH_ERROR);
+            return;
+        }
+        ata_pio_block(channel);
+    }
+}
+
+static void ata_handle_irq(ata_channel_t *channel)
+{
+    uint8_t bm_status = 0;
+
+    if (channel->bmide) {
+        // Interrupt and error bits are write-one-to-clear
+        bm_status = inb(channel->bmide + BM_STATUS);
+        outb(channel->bmide + BM_STATUS, bm_status | BM_STATUS_INTERRUPT | BM_STATUS_ERROR);
+    }
+
+    uint8_t status = inb(channel->io + ATA_STATUS);  // Reading status deasserts INTRQ
+
+    // Polled commands raise the line as well
+    arch_disk_request_t *request = channel->head;
+    if (!request || (status & ATA_STATUS_BUSY)) {
+        return;
     }
-    
-    uint16_t *buffer = (uint16_t *)buf;
-    
-    for (uint32_t block = 0; block < block_count; block++) {
-        uint64_t lba = start_block + block;
-        
-        if (ata_wait_ready() != ARCH_OK) {
+
+    if (channel->phase != ATA_PHASE_DATA) {
+        if (status & ATA_STATUS_ERROR) {
+            ata_complete(channel, ARCH_ERROR);
+        } else if (channel->phase == ATA_PHASE_PREFLUSH) {
+            ata_start_data(channel);
+        } else {
+            ata_complete(channel, ARCH_OK);
+        }
+        return;
+    }
+
+    if (channel->dma_active) {
+        outb(channel->bmide + BM_COMMAND, 0);
+        if ((bm_status & BM_STATUS_ERROR) || (status & ATA_STATUS_ERROR)) {
+            ata_complete(channel, ARCH_ERROR);
+            return;
+        }
+        ata_advance(channel, (uint64_t)channel->command_sectors * request->device->block_size);
+    } else {
+        if (status & ATA_STATUS_ERROR) {
+            ata_complete(channel, ARCH_ERROR);
+            return;
+        }
+
+        // Reads interrupt once per ready block; writes once per accepted block, including the last
+        if (!request->write || channel->command_left > 0) {
+            if (!(status & ATA_STATUS_DRQ)) {
+                ata_complete(channel, ARCH_ERROR);
+                return;
+            }
+            ata_pio_block(channel);
+            if (request->write || channel->command_left > 0) {
+                return;
+            }
+        }
+    }
+
+    channel->lba += channel->command_sectors;
+    channel->remaining -= channel->command_sectors;
+
+    if (channel->remaining > 0) {
+        ata_start_command(channel);
+    } else {
+        ata_finish_data(channel);
+    }
+}
+
+static void ata_irq14_handler(void) { ata_handle_irq(&ata_channels[0]); }
+static void ata_irq15_handler(void) { ata_handle_irq(&ata_channels[1]); }
+
+static void ata_watchdog(void)
+{
+    uint64_t now = arch_time_ns();
+
+    for (int i = 0; i < ATA_CHANNEL_COUNT; i++) {
+        ata_channel_t *channel = &ata_channels[i];
+
+        if (channel->head && now >= channel->deadline) {
+            if (channel->dma_active) {
+                outb(channel->bmide + BM_COMMAND, 0);
+            }
+            arch_debug_printf("ata: command timeout on channel %d, lba %lu\n", i, channel->lba);
+            ata_complete(channel, ARCH_ERROR);
+        }
+    }
+}
+
+/* Polled transfer for callers running with interrupts disabled: one command
+ * per extent, a status poll per DRQ block. */
+static arch_result ata_transfer(struct arch_disk_device *disk, uint8_t *buffer,
+                                uint64_t lba, uint32_t block_count, bool write)
+{
+    uint16_t io = disk->channel->io;
+    uint32_t max_sectors = disk->lba48 ? ATA_MAX_SECTORS_LBA48 : ATA_MAX_SECTORS_LBA28;
+    uint32_t drq_sectors = disk->multiple ? disk->multiple : 1;
+    uint8_t command = ata_command(disk, write);
+
+    while (block_count > 0) {
+        uint32_t count = block_count < max_sectors ? block_count : max_sectors;
+
+        if (ata_wait_ready(disk) != ARCH_OK) {
             return ARCH_ERROR;
         }
-        
-        outb(ATA_DRIVE_SELECT, 0x40);               // Select master drive, LBA mode
-        outb(ATA_SECTOR_COUNT, (block_count >> 8) & 0xFF);  // Sector count high
-        outb(ATA_LBA_LOW, (lba >> 24) & 0xFF);      // LBA bits 24-31
-        outb(ATA_LBA_MID, (lba >> 32) & 0xFF);      // LBA bits 32-39  
-        outb(ATA_LBA_HIGH, (lba >> 40) & 0xFF);     // LBA bits 40-47
-        outb(ATA_SECTOR_COUNT, block_count & 0xFF); // Sector count low
-        outb(ATA_LBA_LOW, lba & 0xFF);              // LBA bits 0-7
-        outb(ATA_LBA_MID, (lba >> 8) & 0xFF);       // LBA bits 8-15
-        outb(ATA_LBA_HIGH, (lba >> 16) & 0xFF);     // LBA bits 16-23
-        outb(ATA_COMMAND, ATA_CMD_READ_SECTORS_EXT); // Issue read command
-        
-        if (ata_wait_data() != ARCH_OK) {
+
+        ata_setup_transfer(disk, lba, count);
+        outb(io + ATA_COMMAND, command);
+
+        for (uint32_t done = 0; done < count; done += drq_sectors) {
+            uint32_t sectors = count - done < drq_sectors ? count - done : drq_sectors;
+            uint64_t bytes = (uint64_t)sectors * disk->block_size;
+
+            if (ata_wait_data(disk) != ARCH_OK) {
+                return ARCH_ERROR;
+            }
+
+            if (write) {
+                outsw(io + ATA_DATA, buffer, bytes / 2);
+            } else {
+                insw(io + ATA_DATA, buffer, bytes / 2);
+            }
+            buffer += bytes;
+        }
+
+        // Writes complete once the drive has committed the last block
+        if (write && ata_wait_idle(disk) != ARCH_OK) {
             return ARCH_ERROR;
         }
-        
-        for (int word = 0; word < 256; word++) {
-            *buffer = inw(ATA_DATA);
-            buffer++;
+
+        lba += count;
+        block_count -= count;
+    }
+
+    return ARCH_OK;
+}
+
+static arch_result ata_flush(struct arch_disk_device *disk)
+{
+    if (!disk->flush) {
+        return ARCH_OK;
+    }
+
+    if (ata_wait_ready(disk) != ARCH_OK) {
+        return ARCH_ERROR;
+    }
+
+    ata_select(disk, 0);
+    outb(disk->channel->io + ATA_COMMAND, disk->flush_ext ? ATA_CMD_FLUSH_CACHE_EXT : ATA_CMD_FLUSH_CACHE);
+
+    return ata_wait_idle(disk);
+}
+
+void x86_disk_init(void)
+{
+    pci_address_t address;
+
+    if (pci_find_class(PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE, 0, &address)) {
+        uint8_t progif = pci_config_read8(address, PCI_CLASS_REVISION + 1);
+        uint32_t bar4 = pci_config_read32(address, PCI_BAR4);
+
+        if ((progif & PCI_IDE_PROGIF_BUS_MASTER) && (bar4 & 1)) {
+            uint16_t base = bar4 & 0xFFFC;
+
+            pci_config_write16(address, PCI_COMMAND, pci_config_read16(address, PCI_COMMAND) |
+                               PCI_COMMAND_IO | PCI_COMMAND_BUS_MASTER);
+
+            for (int i = 0; i < ATA_CHANNEL_COUNT; i++) {
+                // Native-mode channels move off the legacy ports and IRQs this driver uses
+                uint8_t native = i == 0 ? PCI_IDE_PROGIF_PRIMARY_NATIVE : PCI_IDE_PROGIF_SECONDARY_NATIVE;
+                if (progif & native) {
+                    continue;
+                }
+
+                void *page = arch_memory_allocate_page();
+                if (!page) {
+                    continue;
+                }
+
+                ata_channels[i].prdt = virtual_address(page);
+                ata_channels[i].bmide = base + i * BM_CHANNEL_STRIDE;
+            }
+
+            arch_debug_printf("ata: bus-master IDE at %u:%u.%u, registers at %x\n",
+                              address.bus, address.device, address.function, base);
         }
     }
-    
+
+    arch_timer_add_callback(ata_watchdog);
+    arch_register_interrupt(0x20 + ATA_IRQ_PRIMARY, ata_irq14_handler);
+    arch_register_interrupt(0x20 + ATA_IRQ_SECONDARY, ata_irq15_handler);
+    x86_64_pic_unmask_irq(ATA_IRQ_PRIMARY);
+    x86_64_pic_unmask_irq(ATA_IRQ_SECONDARY);
+}
+
+arch_result arch_disk_init(arch_disk_device_t *device)
+{
+    // virtio-blk queues are live from board init on
+    if (disk_virtio(device)) {
+        device->initialized = true;
+        return ARCH_OK;
+    }
+
+    if (!ata_valid(device)) {
+        return ARCH_ERROR;
+    }
+
+    if (!device->initialized) {
+        ata_set_multiple(device);
+        ata_set_dma(device);
+        device->initialized = true;
+
+        // Completion is signalled through INTRQ from here on
+        outb(device->channel->ctrl, 0);
+    }
+
     return ARCH_OK;
 }
 
-arch_result arch_disk_write_blocks(arch_disk_device_t *device, const void *buf, uint64_t start_block, uint32_t block_count)
+arch_result arch_disk_submit(arch_disk_device_t *device, arch_disk_request_t *request)
 {
-    ata_disk_device_t *disk = (ata_disk_device_t *)device;
-    
-    if (disk != &ata_disk || !disk->initialized || !buf || block_count == 0) {
+    if ((!ata_valid(device) && !disk_virtio(device)) || !device->initialized || !request) {
         return ARCH_ERROR;
     }
-    
-    const uint16_t *buffer = (const uint16_t *)buf;
-    
-    for (uint32_t block = 0; block < block_count; block++) {
-        uint64_t lba = start_block + block;
-        
-        if (ata_wait_ready() != ARCH_OK) {
+
+    // The segments have to add up to the request exactly; only a flush moves no data
+    if (request->block_count == 0) {
+        if (!(request->flags & ARCH_DISK_PREFLUSH)) {
             return ARCH_ERROR;
         }
-        
-        outb(ATA_DRIVE_SELECT, 0x40);               // Select master drive, LBA mode
-        outb(ATA_SECTOR_COUNT, (block_count >> 8) & 0xFF);  // Sector count high
-        outb(ATA_LBA_LOW, (lba >> 24) & 0xFF);      // LBA bits 24-31
-        outb(ATA_LBA_MID, (lba >> 32) & 0xFF);      // LBA bits 32-39
-        outb(ATA_LBA_HIGH, (lba >> 40) & 0xFF);     // LBA bits 40-47
-        outb(ATA_SECTOR_COUNT, block_count & 0xFF); // Sector count low
-        outb(ATA_LBA_LOW, lba & 0xFF);              // LBA bits 0-7
-        outb(ATA_LBA_MID, (lba >> 8) & 0xFF);       // LBA bits 8-15
-        outb(ATA_LBA_HIGH, (lba >> 16) & 0xFF);     // LBA bits 16-23
-        outb(ATA_COMMAND, ATA_CMD_WRITE_SECTORS_EXT); // Issue write command
-        
-        if (ata_wait_data() != ARCH_OK) {
-            return ARCH_ERROR;
+    } else if (request->segment_count) {
+        uint64_t blocks = 0;
+        for (uint32_t i = 0; i < request->segment_count; i++) {
+            if (!request->segments[i].buffer || request->segments[i].block_count == 0) {
+                return ARCH_ERROR;
+            }
+            blocks += request->segments[i].block_count;
         }
-        
-        for (int word = 0; word < 256; word++) {
-            outw(ATA_DATA, *buffer);
-            buffer++;
+        if (blocks != request->block_count) {
+            return ARCH_ERROR;
         }
+    } else if (!request->buffer) {
+        return ARCH_ERROR;
     }
-    
+
+    request->device = device;
+
+    if (disk_virtio(device)) {
+        return virtio_blk_submit(device->virtio, request);
+    }
+
+    request->next = NULL;
+    request->result = ARCH_OK;
+
+    ata_channel_t *channel = device->channel;
+    uint64_t state = arch_interrupt_save();
+
+    if (channel->tail) {
+        channel->tail->next = request;
+        channel->tail = request;
+    } else {
+        channel->head = channel->tail = request;
+        ata_start(channel);
+    }
+
+    arch_interrupt_restore(state);
+
     return ARCH_OK;
 }
 
+static void ata_sync_complete(arch_disk_request_t *request)
+{
+    *(volatile bool *)request->context = true;
+}
+
+static arch_result ata_sync_transfer(struct arch_disk_device *disk, void *buf, uint64_t start_block,
+                                     uint32_t block_count, bool write, uint32_t flags)
+{
+    uint64_t state = arch_interrupt_save();
+
+    // Nothing would complete a queued request; poll the drive directly if the channel is free
+    if (!(state & RFLAGS_IF)) {
+        arch_result result = disk->channel->head ? ARCH_ERROR : ARCH_OK;
+
+        if (result == ARCH_OK && (flags & ARCH_DISK_PREFLUSH)) {
+            result = ata_flush(disk);
+        }
+        if (result == ARCH_OK && block_count > 0) {
+            result = ata_transfer(disk, buf, start_block, block_count, write);
+        }
+        if (result == ARCH_OK && block_count > 0 && write && (flags & ARCH_DISK_FUA)) {
+            result = ata_flush(disk);
+        }
+
+        arch_interrupt_restore(state);
+        return result;
+    }
+
+    volatile bool done = false;
+    arch_disk_request_t request = {
+        .buffer = buf,
+        .start_block = start_block,
+        .block_count = block_count,
+        .write = write,
+        .flags = flags,
+        .complete = ata_sync_complete,
+        .context = (void *)&done,
+    };
+
+    arch_result result = arch_disk_submit(disk, &request);
+
+    while (result == ARCH_OK && !done) {
+        arch_interrupt_wait();
+    }
+
+    arch_interrupt_restore(state);
+
+    return result == ARCH_OK ? request.result : result;
+}
+
+arch_result arch_disk_read_blocks(arch_disk_device_t *device, void *buf, uint64_t start_block, uint32_t block_count)
+{
+    if (disk_virtio(device) && device->initialized && buf && block_count > 0) {
+        return virtio_blk_transfer(device->virtio, buf, start_block, block_count, false, 0);
+    }
+
+    if (!ata_valid(device) || !device->initialized || !buf || block_count == 0) {
+        return ARCH_ERROR;
+    }
+
+    return ata_sync_transfer(device, buf, start_block, block_count, false, 0);
+}
+
+arch_result arch_disk_write_blocks(arch_disk_device_t *device, const void *buf, uint64_t start_block, uint32_t block_count)
+{
+    if (disk_virtio(device) && device->initialized && buf && block_count > 0) {
+        return virtio_blk_transfer(device->virtio, (void *)buf, start_block, block_count, true, 0);
+    }
+
+    if (!ata_valid(device) || !device->initialized || !buf || block_count == 0) {
+        return ARCH_ERROR;
+    }
+
+    // The transfer paths only read from the buffer in the write direction
+    return ata_sync_transfer(device, (void *)buf, start_block, block_count, true, 0);
+}
+
 arch_result arch_disk_sync(arch_disk_device_t *device)
 {
-    ata_disk_device_t *disk = (ata_disk_device_t *)device;
-    
-    if (disk != &ata_disk || !disk->initialized) {
+    if (disk_virtio(device) && device->initialized) {
+        return virtio_blk_transfer(device->virtio, NULL, 0, 0, true, ARCH_DISK_PREFLUSH);
+    }
+
+    if (!ata_valid(device) || !device->initialized) {
         return ARCH_ERROR;
     }
-    
-    // TODO: flush command
-    return ata_wait_ready();
-}
\ No newline at end of file
+
+    // Queued behind the channel's requests, so their writes are covered too
+    return ata_sync_transfer(device, NULL, 0, 0, true, ARCH_DISK_PREFLUSH);
+}
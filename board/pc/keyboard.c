@@ -139,6 +139,7 @@ typedef struct {
 typedef struct {
     keyboard_state_t state;
     event_queue_t event_queue;
+    bool resetting;                 // RESET sent by arch_keyboard_start; its self-test result is not read yet
     bool initialized;
 } ps2_keyboard_t;
 
@@ -292,13 +293,14 @@ void ps2_keyboard_interrupt(void) {
     keyboard_driver_interrupt_notify((arch_keyboard_device_t *)&ps2_keyboard_device);
 }
 
-static arch_result ps2_keyboard_initialize(void) {
+/* Set up the controller and send the keyboard RESET
+ *
+ * The keyboard answers with ACK and then, once its self-test is done, 0xAA.
+ * That takes the longest of the PS/2 setup and is left running here.
+ */
+static arch_result ps2_keyboard_start(void) {
     ps2_keyboard_t *kbd = &ps2_keyboard_device;
     
-    if (kbd->initialized) {
-        return ARCH_OK;
-    }
-    
     kbd->state.shift_pressed = false;
     kbd->state.ctrl_pressed = false;
     kbd->state.alt_pressed = false;
@@ -335,6 +337,23 @@ static arch_result ps2_keyboard_initialize(void) {
     ps2_send_command(PS2_CMD_ENABLE_PORT1);
     
     ps2_send_data(KB_CMD_RESET);
+    kbd->resetting = true;
+
+    return ARCH_OK;
+}
+
+static arch_result ps2_keyboard_initialize(void) {
+    ps2_keyboard_t *kbd = &ps2_keyboard_device;
+    
+    if (kbd->initialized) {
+        return ARCH_OK;
+    }
+
+    if (!kbd->resetting && ps2_keyboard_start() != ARCH_OK) {
+        return ARCH_ERROR;
+    }
+    kbd->resetting = false;
+    
     uint8_t response = ps2_read_data(); // Should be ACK
     if (response == KB_RESP_ACK) {
         // Wait for self-test result
@@ -373,6 +392,12 @@ arch_result arch_keyboard_get_info(int index, arch_keyboard_info_t *info) {
     return ARCH_OK;
 }
 
+void arch_keyboard_start(void) {
+    if (!ps2_keyboard_device.initialized && !ps2_keyboard_device.resetting) {
+        ps2_keyboard_start();
+    }
+}
+
 arch_result arch_keyboard_init(arch_keyboard_device_t *device) {
     if (device != (arch_keyboard_device_t *)&ps2_keyboard_device) {
         return ARCH_ERROR;
@@ -0,0 +1,119 @@
+#include "arch/x86_64/io.h"
+#include "board/pc/pci.h"
+
+/* x86_64 PCI configuration space (mechanism #1)
+
+  - 0xCF8: Address (enable bit 31, bus 23-16, device 15-11, function 10-8, register 7-2)
+  - 0xCFC: Data
+ */
+
+#define PCI_CONFIG_ADDRESS 0xCF8
+#define PCI_CONFIG_DATA    0xCFC
+#define PCI_CONFIG_ENABLE  0x80000000
+
+#define PCI_MAX_BUS      256
+#define PCI_MAX_DEVICE   32
+#define PCI_MAX_FUNCTION 8
+
+#define PCI_HEADER_MULTIFUNCTION 0x80
+
+static uint32_t pci_config_address(pci_address_t address, uint8_t offset)
+{
+    return PCI_CONFIG_ENABLE | ((uint32_t)address.bus << 16) | ((uint32_t)address.device << 11) |
+           ((uint32_t)address.function << 8) | (offset & 0xFC);
+}
+
+bool pci_present(void)
+{
+    static int present = -1;
+
+    if (present < 0) {
+        uint32_t saved = inl(PCI_CONFIG_ADDRESS);
+        outl(PCI_CONFIG_ADDRESS, PCI_CONFIG_ENABLE);
+        present = inl(PCI_CONFIG_ADDRESS) == PCI_CONFIG_ENABLE;
+        outl(PCI_CONFIG_ADDRESS, saved);
+    }
+
+    return present;
+}
+
+uint32_t pci_config_read32(pci_address_t address, uint8_t offset)
+{
+    outl(PCI_CONFIG_ADDRESS, pci_config_address(address, offset));
+    return inl(PCI_CONFIG_DATA);
+}
+
+uint16_t pci_config_read16(pci_address_t address, uint8_t offset)
+{
+    return (pci_config_read32(address, offset) >> ((offset & 2) * 8)) & 0xFFFF;
+}
+
+uint8_t pci_config_read8(pci_address_t address, uint8_t offset)
+{
+    return (pci_config_read32(address, offset) >> ((offset & 3) * 8)) & 0xFF;
+}
+
+void pci_config_write16(pci_address_t address, uint8_t offset, uint16_t value)
+{
+    uint32_t shift = (offset & 2) * 8;
+    uint32_t dword = pci_config_read32(address, offset);
+
+    dword = (dword & ~(0xFFFFu << shift)) | ((uint32_t)value << shift);
+    outl(PCI_CONFIG_ADDRESS, pci_config_address(address, offset));
+    outl(PCI_CONFIG_DATA, dword);
+}
+
+// Walk every present function, returning the index'th one that match accepts
+static bool pci_find(bool (*match)(pci_address_t, uint16_t, uint16_t), uint16_t a, uint16_t b,
+                     int index, pci_address_t *address)
+{
+    if (!address || !pci_present()) {
+        return false;
+    }
+
+    for (int bus = 0; bus < PCI_MAX_BUS; bus++) {
+        for (int device = 0; device < PCI_MAX_DEVICE; device++) {
+            for (int function = 0; function < PCI_MAX_FUNCTION; function++) {
+                pci_address_t candidate = { bus, device, function };
+
+                if (pci_config_read16(candidate, PCI_VENDOR_ID) == 0xFFFF) {
+                    if (function == 0) break;
+                    continue;
+                }
+
+                if (match(candidate, a, b) && index-- == 0) {
+                    *address = candidate;
+                    return true;
+                }
+
+                if (function == 0 && !(pci_config_read8(candidate, PCI_HEADER_TYPE) & PCI_HEADER_MULTIFUNCTION)) {
+                    break;
+                }
+            }
+        }
+    }
+
+    return false;
+}
+
+static bool pci_match_class(pci_address_t address, uint16_t class_code, uint16_t subclass)
+{
+    uint32_t class_revision = pci_config_read32(address, PCI_CLASS_REVISION);
+
+    return (class_revision >> 24) == class_code && ((class_revision >> 16) & 0xFF) == subclass;
+}
+
+static bool pci_match_id(pci_address_t address, uint16_t vendor, uint16_t device)
+{
+    return pci_config_read16(address, PCI_VENDOR_ID) == vendor && pci_config_read16(address, PCI_DEVICE_ID) == device;
+}
+
+bool pci_find_class(uint8_t class_code, uint8_t subclass, int index, pci_address_t *address)
+{
+    return pci_find(pci_match_class, class_code, subclass, index, address);
+}
+
+bool pci_find_device(uint16_t vendor, uint16_t device, int index, pci_address_t *address)
+{
+    return pci_find(pci_match_id, vendor, device, index, address);
+}
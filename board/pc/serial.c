@@ -1,9 +1,53 @@
 #include "arch/arch.h"
+#include "arch/x86_64/pic.h"
 #include "board/pc/serial.h"
 
+/* x86_64 16550 UART
+
+  UART Registers (offset from base port):
+
+  - +0: Data (DLAB=0) / Divisor low byte (DLAB=1)
+  - +1: Interrupt enable (DLAB=0) / Divisor high byte (DLAB=1)
+  - +2: Interrupt identification (read) / FIFO control (write)
+  - +3: Line control
+  - +4: Modem control
+  - +5: Line status
+  - +6: Modem status
+  - +7: Scratch
+ */
+
+#define UART_DATA       0
+#define UART_IER        1
+#define UART_IIR        2
+#define UART_FCR        2
+#define UART_LCR        3
+#define UART_MCR        4
+#define UART_LSR        5
+#define UART_MSR        6
+#define UART_SCRATCH    7
+
+#define UART_LSR_DATA_READY 0x01
+#define UART_LSR_THR_EMPTY  0x20
+#define UART_LSR_TX_EMPTY   0x40
+
+#define UART_IIR_NO_INT      0x01
+#define UART_IIR_ID_MASK     0x0E
+#define UART_IIR_THR_EMPTY   0x02
+#define UART_IIR_RX_DATA     0x04
+#define UART_IIR_LINE_STATUS 0x06
+#define UART_IIR_RX_TIMEOUT  0x0C
+
+#define UART_FIFO_SIZE        16
+#define UART_LOOPBACK_TIMEOUT 100000
+
 struct arch_serial_device {
     serial_port port;
+    uint8_t irq;
+    uint32_t baud;
     bool initialized;
+    uint8_t buffer[SERIAL_BUFFER_SIZE];  // Receive ring, filled from the IRQ handler
+    volatile uint32_t head;
+    volatile uint32_t tail;
 };
 
 typedef struct {
@@ -13,47 +57,172 @@ typedef struct {
 } x86_serial_port_t;
 
 static x86_serial_port_t x86_serial_ports[] = {
-    { .device = {SERIAL_PORT_0, false}, .name = "serial0", .detected = false }
-    // TODO: add more ports
+    { .device = {SERIAL_PORT_0, SERIAL_IRQ_COM1_COM3, SERIAL_DEFAULT_BAUD}, .name = "serial0", .detected = false },
+    { .device = {SERIAL_PORT_1, SERIAL_IRQ_COM2_COM4, SERIAL_DEFAULT_BAUD}, .name = "serial1", .detected = false },
+    { .device = {SERIAL_PORT_2, SERIAL_IRQ_COM1_COM3, SERIAL_DEFAULT_BAUD}, .name = "serial2", .detected = false },
+    { .device = {SERIAL_PORT_3, SERIAL_IRQ_COM2_COM4, SERIAL_DEFAULT_BAUD}, .name = "serial3", .detected = false }
 };
 
 #define X86_SERIAL_PORT_COUNT (sizeof(x86_serial_ports) / sizeof(x86_serial_ports[0]))
 
 static bool serial_ports_detected = false;
-static uint8_t buffer[SERIAL_BUFFER_SIZE];
-static uint8_t buffer_index = 0;
+
+static void serial_set_divisor(serial_port port, uint16_t divisor)
+{
+    uint8_t lcr = inb(port + UART_LCR);
+
+    outb(port + UART_LCR, lcr | 0x80);               // Set DLAB
+    outb(port + UART_DATA, divisor & 0xFF);          // Divisor low byte
+    outb(port + UART_IER, (divisor >> 8) & 0xFF);    // Divisor high byte
+    outb(port + UART_LCR, lcr & ~0x80);              // Clear DLAB
+}
+
+/* Program the UART and send a byte through loopback without waiting for it
+ *
+ * @param dev Port to probe
+ * @return false if no UART answers, true if serial_probe_finish should check the byte
+ */
+static bool serial_probe_start(struct arch_serial_device *dev)
+{
+    serial_port port = dev->port;
+
+    // A missing UART floats the bus; the scratch register will not hold a value
+    outb(port + UART_SCRATCH, 0x5A);
+    if (inb(port + UART_SCRATCH) != 0x5A) {
+        return false;
+    }
+
+    outb(port + UART_IER, 0x00);   // Disable interrupts
+    outb(port + UART_LCR, 0x03);   // 8 bits, one stop bit, no parity
+    serial_set_divisor(port, SERIAL_BASE_BAUD / dev->baud);
+    outb(port + UART_FCR, 0xC7);   // Enable and clear 14 byte FIFO
+    outb(port + UART_MCR, 0x1E);   // Set in loopback mode for testing
+
+    outb(port + UART_DATA, 0xAE);  // Send test byte
+
+    return true;
+}
+
+/* Wait for the loopback byte sent by serial_probe_start and leave loopback mode
+ *
+ * @param dev Port being probed
+ * @return true if the byte came back intact
+ */
+static bool serial_probe_finish(struct arch_serial_device *dev)
+{
+    serial_port port = dev->port;
+
+    int timeout = UART_LOOPBACK_TIMEOUT;
+    while (!(inb(port + UART_LSR) & UART_LSR_DATA_READY)) {
+        if (--timeout == 0) {
+            return false;
+        }
+    }
+
+    if (inb(port + UART_DATA) != 0xAE) {
+        return false;
+    }
+
+    outb(port + UART_MCR, 0x0F);   // Disable loopback mode, enable OUT2 (IRQ gate)
+
+    return true;
+}
+
+static void serial_receive(struct arch_serial_device *dev)
+{
+    while (inb(dev->port + UART_LSR) & UART_LSR_DATA_READY) {
+        uint8_t c = inb(dev->port + UART_DATA);
+        uint32_t next = (dev->head + 1) % SERIAL_BUFFER_SIZE;
+
+        // Drop input when the reader falls behind
+        if (dev->initialized && next != dev->tail) {
+            dev->buffer[dev->head] = c;
+            dev->head = next;
+        }
+    }
+}
+
+static void serial_handle_irq(uint8_t irq)
+{
+    for (int i = 0; i < X86_SERIAL_PORT_COUNT; i++) {
+        struct arch_serial_device *dev = &x86_serial_ports[i].device;
+
+        if (!x86_serial_ports[i].detected || dev->irq != irq) {
+            continue;
+        }
+
+        // Ports sharing an IRQ line are told apart by their pending bit
+        uint8_t iir;
+        while (!((iir = inb(dev->port + UART_IIR)) & UART_IIR_NO_INT)) {
+            switch (iir & UART_IIR_ID_MASK) {
+            case UART_IIR_THR_EMPTY:
+                if (dev->port == SERIAL_PORT_0) {
+                    x86_debug_serial_interrupt();
+                } else {
+                    outb(dev->port + UART_IER, inb(dev->port + UART_IER) & ~0x02);
+                }
+                break;
+            case UART_IIR_RX_DATA:
+            case UART_IIR_RX_TIMEOUT:
+                serial_receive(dev);
+                break;
+            case UART_IIR_LINE_STATUS:
+                inb(dev->port + UART_LSR);
+                break;
+            default:
+                inb(dev->port + UART_MSR);
+                break;
+            }
+        }
+    }
+}
+
+static void serial_irq3_handler(void) { serial_handle_irq(SERIAL_IRQ_COM2_COM4); }
+static void serial_irq4_handler(void) { serial_handle_irq(SERIAL_IRQ_COM1_COM3); }
 
 static void detect_serial_ports(void)
 {
     if (serial_ports_detected) return;
-    
-    outb(SERIAL_PORT_0 + 1, 0x00); // Disable interrupts
 
-    outb(SERIAL_PORT_0 + 3, 0x80); // Set DLAB
-    outb(SERIAL_PORT_0 + 0, 0x03); // Set divisor low byte (115200 / 3 = 38400 baud)
-    outb(SERIAL_PORT_0 + 1, 0x00); // Set divisor high byte
+    // Every port's loopback byte is in flight before the first one is waited for
+    for (int i = 0; i < X86_SERIAL_PORT_COUNT; i++) {
+        x86_serial_ports[i].detected = serial_probe_start(&x86_serial_ports[i].device);
+    }
 
-    outb(SERIAL_PORT_0 + 3, 0x03); // 8 bits, one stop bit, no parity
-    outb(SERIAL_PORT_0 + 2, 0xC7); // Enable and clear 14 byte FIFO
-    outb(SERIAL_PORT_0 + 4, 0x1E); // Set in loopback mode for testing
+    for (int i = 0; i < X86_SERIAL_PORT_COUNT; i++) {
+        if (x86_serial_ports[i].detected) {
+            x86_serial_ports[i].detected = serial_probe_finish(&x86_serial_ports[i].device);
+        }
+    }
+
+    serial_ports_detected = true;
+}
 
-    outb(SERIAL_PORT_0 + 0, 0xAE); // Send test byte
+void x86_serial_init(void)
+{
+    // COM1 carries debug output; keep it synchronous while the port is reprogrammed
+    x86_debug_enable_async(false);
 
-    while (!(inb(SERIAL_PORT_0+5) & 0x01));
-    assert(inb(SERIAL_PORT_0) == 0xAE);
+    detect_serial_ports();
 
-    outb(SERIAL_PORT_0 + 4, 0x0F); // Disable loopback mode
-    outb(SERIAL_PORT_0 + 1, 0x01); // Enable interrupts
-    
-    x86_serial_ports[0].detected = true;
-    
-    serial_ports_detected = true;
+    arch_register_interrupt(0x20 + SERIAL_IRQ_COM2_COM4, serial_irq3_handler);
+    arch_register_interrupt(0x20 + SERIAL_IRQ_COM1_COM3, serial_irq4_handler);
+
+    for (int i = 0; i < X86_SERIAL_PORT_COUNT; i++) {
+        if (x86_serial_ports[i].detected) {
+            x86_64_pic_unmask_irq(x86_serial_ports[i].device.irq);
+        }
+    }
+
+    if (x86_serial_ports[0].detected) {
+        x86_debug_enable_async(true);
+    }
 }
 
 int arch_serial_get_count(void)
 {
     detect_serial_ports();
-    
+
     int count = 0;
     for (int i = 0; i < X86_SERIAL_PORT_COUNT; i++) {
         if (x86_serial_ports[i].detected) {
@@ -66,9 +235,9 @@ int arch_serial_get_count(void)
 arch_result arch_serial_get_info(int index, arch_serial_info_t *info)
 {
     if (!info) return ARCH_ERROR;
-    
+
     detect_serial_ports();
-    
+
     int found_count = 0;
     for (int i = 0; i < X86_SERIAL_PORT_COUNT; i++) {
         if (x86_serial_ports[i].detected) {
@@ -80,48 +249,95 @@ arch_result arch_serial_get_info(int index, arch_serial_info_t *info)
             found_count++;
         }
     }
-    
+
     return ARCH_ERROR;
 }
 
 arch_result arch_serial_init(arch_serial_device_t *device)
 {
     if (!device) return ARCH_ERROR;
-    
+
+    if (device->initialized) {
+        return ARCH_OK;
+    }
+
+    device->head = 0;
+    device->tail = 0;
     device->initialized = true;
+
+    outb(device->port + UART_IER, inb(device->port + UART_IER) | 0x01);   // Enable receive data interrupt
+
+    return ARCH_OK;
+}
+
+arch_result arch_serial_set_baud(arch_serial_device_t *device, uint32_t baud)
+{
+    if (!device || baud == 0 || baud > SERIAL_BASE_BAUD) {
+        return ARCH_INVALID;
+    }
+
+    // Only exact divisors of the UART clock are representable
+    if (SERIAL_BASE_BAUD % baud != 0) {
+        return ARCH_UNSUPPORTED;
+    }
+
+    // Let the transmitter drain so no byte is sent at a mixed rate
+    while (!(inb(device->port + UART_LSR) & UART_LSR_TX_EMPTY));
+
+    serial_set_divisor(device->port, SERIAL_BASE_BAUD / baud);
+    device->baud = baud;
+
     return ARCH_OK;
 }
 
+uint32_t arch_serial_get_baud(arch_serial_device_t *device)
+{
+    if (!device) return 0;
+
+    return device->baud;
+}
+
 int arch_serial_write(arch_serial_device_t *device, const void *buf, size_t len)
 {
     if (!device || !device->initialized) return -1;
-    
+
     const char *str = (const char *)buf;
-    
-    for (size_t i = 0; i < len; i++) {
-        // wait for transmit buffer to be empty
-        while (!(inb(device->port+5) & 0x40));
+    size_t i = 0;
+
+    while (i < len) {
+        // wait for the transmit FIFO to be empty, then refill it in one burst
+        while (!(inb(device->port + UART_LSR) & UART_LSR_THR_EMPTY));
 
-        outb(device->port, str[i]);
+        for (int burst = 0; burst < UART_FIFO_SIZE && i < len; burst++) {
+            outb(device->port, str[i++]);
+        }
     }
-    
+
     return (int)len;
 }
 
 int arch_serial_read(arch_serial_device_t *device, void *buf, size_t len)
 {
+    if (!device || !device->initialized || !buf) return -1;
+
+    uint8_t *out = (uint8_t *)buf;
+    size_t n = 0;
+
     // wait for buffer content
-    while(!buffer_index)
-        arch_halt();
+    while (device->head == device->tail)
+        __asm__ volatile("hlt");
 
-    return buffer[--buffer_index];
+    while (n < len && device->tail != device->head) {
+        out[n++] = device->buffer[device->tail];
+        device->tail = (device->tail + 1) % SERIAL_BUFFER_SIZE;
+    }
+
+    return (int)n;
 }
 
 bool arch_serial_data_available(arch_serial_device_t *device)
 {
     if (!device || !device->initialized) return false;
 
-    // TODO: Check if data is available in the receive buffer
-    
-    return false;
-}
\ No newline at end of file
+    return device->head != device->tail;
+}
@@ -0,0 +1,649 @@
+#include "arch/arch.h"
+#include "arch/x86_64/io.h"
+#include "arch/x86_64/memory.h"
+#include "arch/x86_64/pic.h"
+#include "board/pc/pci.h"
+#include "board/pc/virtio.h"
+
+/* x86_64 virtio-blk (legacy PCI interface)
+
+  Registers (offset from the I/O space BAR0):
+
+  - +0x00: Device features
+  - +0x04: Driver features
+  - +0x08: Queue address (page frame number)
+  - +0x0C: Queue size
+  - +0x0E: Queue select
+  - +0x10: Queue notify
+  - +0x12: Device status
+  - +0x13: ISR status (reading acknowledges the interrupt)
+  - +0x14: Device configuration (without MSI-X)
+
+  Modern-only functions keep their registers in memory BARs above the 2 MiB
+  the kernel maps and are not driven; QEMU's default transitional function
+  answers on the legacy interface.
+ */
+
+#define VIRTIO_PCI_VENDOR     0x1AF4
+#define VIRTIO_PCI_DEVICE_BLK 0x1001  // Transitional block device
+
+#define VIRTIO_HOST_FEATURES  0x00
+#define VIRTIO_GUEST_FEATURES 0x04
+#define VIRTIO_QUEUE_PFN      0x08
+#define VIRTIO_QUEUE_SIZE     0x0C
+#define VIRTIO_QUEUE_SELECT   0x0E
+#define VIRTIO_QUEUE_NOTIFY   0x10
+#define VIRTIO_STATUS         0x12
+#define VIRTIO_ISR            0x13
+#define VIRTIO_CONFIG         0x14
+
+#define VIRTIO_STATUS_ACKNOWLEDGE 0x01
+#define VIRTIO_STATUS_DRIVER      0x02
+#define VIRTIO_STATUS_DRIVER_OK   0x04
+#define VIRTIO_STATUS_FAILED      0x80
+
+#define VIRTIO_ISR_QUEUE 0x01
+
+#define VIRTIO_BLK_CAPACITY (VIRTIO_CONFIG + 0)   // 64-bit, in 512-byte sectors
+#define VIRTIO_BLK_SEG_MAX  (VIRTIO_CONFIG + 12)  // Most data descriptors per request
+
+#define VIRTIO_BLK_F_SEG_MAX (1 << 2)
+#define VIRTIO_BLK_F_RO      (1 << 5)
+#define VIRTIO_BLK_F_FLUSH   (1 << 9)   // The device has a write cache and takes FLUSH requests
+
+#define VIRTIO_BLK_T_IN    0
+#define VIRTIO_BLK_T_OUT   1
+#define VIRTIO_BLK_T_FLUSH 4
+
+#define VIRTIO_BLK_S_OK 0
+
+#define VRING_DESC_F_NEXT          1
+#define VRING_DESC_F_WRITE         2  // The device writes the buffer
+#define VRING_AVAIL_F_NO_INTERRUPT 1
+#define VRING_USED_F_NO_NOTIFY     1
+
+#define VIRTIO_SECTOR_SIZE   512
+#define VIRTIO_QUEUE_MAX     256  // Largest ring the static ring memory holds
+#define VIRTIO_RING_PAGES    3    // Descriptors and available ring, then the used ring on its own page
+#define VIRTIO_BLK_SEGMENTS  14   // Data descriptors per request
+#define VIRTIO_BLK_SLOT_DESCS (VIRTIO_BLK_SEGMENTS + 2)  // Plus header and status
+#define VIRTIO_BLK_SLOTS     16   // Requests on the device at once
+#define VIRTIO_BLK_SEGMENT_BLOCKS 0x7FFFFF  // Keeps a descriptor length within 32 bits
+#define VIRTIO_IRQ_NONE      0xFF
+
+#define RFLAGS_IF (1 << 9)
+
+typedef struct {
+    uint64_t address;
+    uint32_t length;
+    uint16_t flags;
+    uint16_t next;
+} vring_desc_t;
+
+typedef struct {
+    uint16_t flags;
+    uint16_t index;
+    uint16_t ring[];
+} vring_avail_t;
+
+typedef struct {
+    uint32_t id;      // Head descriptor of the finished chain
+    uint32_t length;
+} vring_used_elem_t;
+
+typedef struct {
+    uint16_t flags;
+    uint16_t index;
+    vring_used_elem_t ring[];
+} vring_used_t;
+
+typedef struct {
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t sector;
+} virtio_blk_header_t;
+
+// A request flushes the device cache before and after its data as its flags require
+#define VIRTIO_PHASE_PREFLUSH  0
+#define VIRTIO_PHASE_DATA      1
+#define VIRTIO_PHASE_POSTFLUSH 2
+
+// Slot i owns descriptors [i * VIRTIO_BLK_SLOT_DESCS, (i + 1) * VIRTIO_BLK_SLOT_DESCS)
+typedef struct {
+    virtio_blk_header_t header;
+    uint8_t status;                 // Written by the device
+    uint8_t phase;
+    arch_disk_request_t *request;   // NULL while the slot is free
+
+    // Data not yet handed to the device; a request split into several commands resumes here
+    uint32_t segment;
+    uint64_t offset;                // Bytes into the segment, a whole number of sectors
+    uint32_t sectors_done;
+} virtio_blk_slot_t;
+
+struct virtio_blk {
+    pci_address_t address;
+    uint16_t io;
+    uint8_t irq;                    // VIRTIO_IRQ_NONE when completions are polled
+    uint32_t features;              // Negotiated VIRTIO_BLK_F_*
+    uint64_t capacity;              // 512-byte sectors
+    uint32_t seg_max;               // 0 without a device limit
+    uint16_t queue_size;
+    uint16_t slot_count;
+    uint16_t busy;                  // Slots on the device
+    uint16_t last_used;             // Used ring entries consumed so far
+    volatile vring_desc_t *desc;
+    volatile vring_avail_t *avail;
+    volatile vring_used_t *used;
+    virtio_blk_slot_t slots[VIRTIO_BLK_SLOTS];
+
+    // Requests waiting for a slot, in submission order
+    arch_disk_request_t *head;
+    arch_disk_request_t *tail;
+};
+
+static struct virtio_blk virtio_blks[VIRTIO_BLK_MAX];
+static uint8_t virtio_rings[VIRTIO_BLK_MAX][VIRTIO_RING_PAGES * PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+static const char *virtio_blk_names[VIRTIO_BLK_MAX] = { "vda", "vdb" };
+static int virtio_blk_count = 0;
+
+// x86 keeps stores in order; only the compiler has to be kept from reordering ring accesses
+static inline void virtio_barrier(void)
+{
+    __asm__ volatile("" : : : "memory");
+}
+
+static void virtio_blk_chain(virtio_blk_t *blk, uint16_t *index, uint64_t address, uint32_t length, uint16_t flags)
+{
+    volatile vring_desc_t *desc = &blk->desc[*index];
+
+    desc->address = address;
+    desc->length = length;
+    desc->flags = flags | VRING_DESC_F_NEXT;
+    desc->next = *index + 1;
+    (*index)++;
+}
+
+/* Find how much of a buffer is physically contiguous from its start
+ *
+ * The linear map is contiguous throughout; buffers in the file mapping
+ * window are looked up page by page.
+ *
+ * @return: Contiguous bytes, at most length, or 0 if the start is not mapped
+ */
+static uint64_t virtio_blk_run(const uint8_t *buffer, uint64_t length, uint64_t *address)
+{
+    if ((uint64_t)buffer < KERNEL_MAP_BASE) {
+        *address = physical_address(buffer);
+        return length;
+    }
+
+    if (arch_memory_translate((uint64_t)buffer, address) != ARCH_OK) {
+        return 0;
+    }
+
+    uint64_t run = PAGE_SIZE - ((uint64_t)buffer & (PAGE_SIZE - 1));
+    uint64_t next;
+
+    while (run < length && arch_memory_translate((uint64_t)buffer + run, &next) == ARCH_OK && next == *address + run) {
+        run += PAGE_SIZE;
+    }
+
+    return run < length ? run : length;
+}
+
+// Data descriptors the device takes per command
+static uint32_t virtio_blk_limit(const virtio_blk_t *blk)
+{
+    return blk->seg_max && blk->seg_max < VIRTIO_BLK_SEGMENTS ? blk->seg_max : VIRTIO_BLK_SEGMENTS;
+}
+
+static const uint8_t *virtio_blk_segment(const arch_disk_request_t *request, uint32_t index, uint64_t *length)
+{
+    if (!request->segment_count) {
+        *length = (uint64_t)request->block_count * VIRTIO_SECTOR_SIZE;
+        return request->buffer;
+    }
+
+    *length = (uint64_t)request->segments[index].block_count * VIRTIO_SECTOR_SIZE;
+    return request->segments[index].buffer;
+}
+
+/* Check that the device can reach every byte of the request
+ *
+ * Every page has to be mapped. With a single data descriptor per command
+ * a command can only make progress if each segment is contiguous.
+ */
+static bool virtio_blk_mapped(const virtio_blk_t *blk, const arch_disk_request_t *request)
+{
+    uint32_t count = request->segment_count ? request->segment_count : 1;
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint64_t length, address;
+        const uint8_t *buffer = virtio_blk_segment(request, i, &length);
+
+        for (uint64_t offset = 0, run; offset < length; offset += run) {
+            run = virtio_blk_run(buffer + offset, length - offset, &address);
+            if (run == 0 || (run < length && virtio_blk_limit(blk) == 1)) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+/* Describe the slot's remaining data, one descriptor per physically contiguous run
+ *
+ * Buffers in the file mapping window can take a descriptor per page, so a
+ * request may not fit the slot's descriptors; the command then stops at the
+ * last whole sector and the rest goes out with the next one.
+ *
+ * @return: Sectors the descriptors cover
+ */
+static uint32_t virtio_blk_chain_data(virtio_blk_t *blk, virtio_blk_slot_t *slot, uint16_t *index, uint16_t flags)
+{
+    const arch_disk_request_t *request = slot->request;
+    uint32_t count = request->segment_count ? request->segment_count : 1;
+    uint32_t limit = virtio_blk_limit(blk);
+    uint16_t first = *index;
+    uint64_t bytes = 0;
+
+    while (slot->segment < count && *index - first < limit) {
+        uint64_t length, address;
+        const uint8_t *buffer = virtio_blk_segment(request, slot->segment, &length);
+        uint64_t run = virtio_blk_run(buffer + slot->offset, length - slot->offset, &address);
+
+        virtio_blk_chain(blk, index, address, (uint32_t)run, flags);
+        bytes += run;
+        slot->offset += run;
+
+        if (slot->offset == length) {
+            slot->segment++;
+            slot->offset = 0;
+        }
+    }
+
+    // Segments hold whole sectors, so only a cut into the current one leaves a partial sector
+    uint64_t partial = bytes % VIRTIO_SECTOR_SIZE;
+
+    bytes -= partial;
+    slot->offset -= partial;
+    while (partial > 0) {
+        volatile vring_desc_t *desc = &blk->desc[*index - 1];
+
+        if (desc->length > partial) {
+            desc->length -= partial;
+            break;
+        }
+        partial -= desc->length;
+        (*index)--;
+    }
+
+    return bytes / VIRTIO_SECTOR_SIZE;
+}
+
+// Build the slot's chain for its current phase and make it available to the device
+static void virtio_blk_issue(virtio_blk_t *blk, int index)
+{
+    virtio_blk_slot_t *slot = &blk->slots[index];
+    arch_disk_request_t *request = slot->request;
+    uint16_t head = index * VIRTIO_BLK_SLOT_DESCS;
+    uint16_t next = head;
+    bool data = slot->phase == VIRTIO_PHASE_DATA;
+    uint16_t data_flags = request->write ? 0 : VRING_DESC_F_WRITE;
+
+    slot->header.type = !data ? VIRTIO_BLK_T_FLUSH : request->write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+    slot->header.reserved = 0;
+    slot->header.sector = data ? request->start_block + slot->sectors_done : 0;
+    slot->status = 0xFF;
+
+    virtio_blk_chain(blk, &next, physical_address(&slot->header), sizeof(slot->header), 0);
+
+    if (data) {
+        slot->sectors_done += virtio_blk_chain_data(blk, slot, &next, data_flags);
+    }
+
+    virtio_blk_chain(blk, &next, physical_address(&slot->status), 1, VRING_DESC_F_WRITE);
+    blk->desc[next - 1].flags &= ~VRING_DESC_F_NEXT;
+
+    blk->avail->ring[blk->avail->index % blk->queue_size] = head;
+    virtio_barrier();
+    blk->avail->index++;
+}
+
+static void virtio_blk_notify(virtio_blk_t *blk)
+{
+    virtio_barrier();
+    if (!(blk->used->flags & VRING_USED_F_NO_NOTIFY)) {
+        outw(blk->io + VIRTIO_QUEUE_NOTIFY, 0);
+    }
+}
+
+static int virtio_blk_free_slot(virtio_blk_t *blk)
+{
+    for (int i = 0; i < blk->slot_count; i++) {
+        if (!blk->slots[i].request) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+// Move waiting requests into free slots
+static void virtio_blk_start(virtio_blk_t *blk)
+{
+    bool issued = false;
+
+    while (blk->head) {
+        arch_disk_request_t *request = blk->head;
+
+        // A flush only covers writes the device has completed, so the ring drains first
+        if ((request->flags & ARCH_DISK_PREFLUSH) && blk->busy) {
+            break;
+        }
+
+        int index = virtio_blk_free_slot(blk);
+        if (index < 0) {
+            break;
+        }
+
+        blk->head = request->next;
+        if (!blk->head) {
+            blk->tail = NULL;
+        }
+        request->next = NULL;
+
+        // Without a write cache there is nothing to flush
+        bool flush = (request->flags & ARCH_DISK_PREFLUSH) && (blk->features & VIRTIO_BLK_F_FLUSH);
+        if (!flush && request->block_count == 0) {
+            if (request->complete) {
+                request->complete(request);
+            }
+            continue;
+        }
+
+        blk->slots[index].request = request;
+        blk->slots[index].phase = flush ? VIRTIO_PHASE_PREFLUSH : VIRTIO_PHASE_DATA;
+        blk->slots[index].segment = 0;
+        blk->slots[index].offset = 0;
+        blk->slots[index].sectors_done = 0;
+        blk->busy++;
+        virtio_blk_issue(blk, index);
+        issued = true;
+    }
+
+    if (issued) {
+        virtio_blk_notify(blk);
+    }
+}
+
+static void virtio_blk_finish(virtio_blk_t *blk, int index)
+{
+    virtio_blk_slot_t *slot = &blk->slots[index];
+    arch_disk_request_t *request = slot->request;
+    arch_result result = slot->status == VIRTIO_BLK_S_OK ? ARCH_OK : ARCH_ERROR;
+
+    if (result == ARCH_OK) {
+        uint8_t phase = slot->phase;
+        bool more = false;
+
+        if (phase == VIRTIO_PHASE_PREFLUSH && request->block_count > 0) {
+            slot->phase = VIRTIO_PHASE_DATA;
+        } else if (phase == VIRTIO_PHASE_DATA && slot->sectors_done < request->block_count) {
+            more = true;                // The rest of the data did not fit the last command's descriptors
+        } else if (phase == VIRTIO_PHASE_DATA && request->write && (request->flags & ARCH_DISK_FUA) &&
+                   (blk->features & VIRTIO_BLK_F_FLUSH)) {
+            slot->phase = VIRTIO_PHASE_POSTFLUSH;
+        }
+
+        if (more || slot->phase != phase) {
+            virtio_blk_issue(blk, index);
+            virtio_blk_notify(blk);
+            return;
+        }
+    } else {
+        arch_debug_printf("%s: request failed with status %u, sector %lu\n",
+                          virtio_blk_names[blk - virtio_blks], slot->status, slot->header.sector);
+    }
+
+    // Free the slot first; the callback may submit the next request
+    slot->request = NULL;
+    blk->busy--;
+    request->result = result;
+    if (request->complete) {
+        request->complete(request);
+    }
+}
+
+// Complete what the device has finished; runs with interrupts disabled
+static void virtio_blk_poll(virtio_blk_t *blk)
+{
+    while (blk->last_used != blk->used->index) {
+        virtio_barrier();
+        uint32_t id = blk->used->ring[blk->last_used % blk->queue_size].id;
+        blk->last_used++;
+
+        int index = id / VIRTIO_BLK_SLOT_DESCS;
+        if (id % VIRTIO_BLK_SLOT_DESCS == 0 && index < blk->slot_count && blk->slots[index].request) {
+            virtio_blk_finish(blk, index);
+        }
+    }
+
+    virtio_blk_start(blk);
+}
+
+static void virtio_blk_irq_handler(void)
+{
+    for (int i = 0; i < virtio_blk_count; i++) {
+        // Reading the ISR status drops the line; devices may share it
+        if (virtio_blks[i].irq != VIRTIO_IRQ_NONE && (inb(virtio_blks[i].io + VIRTIO_ISR) & VIRTIO_ISR_QUEUE)) {
+            virtio_blk_poll(&virtio_blks[i]);
+        }
+    }
+}
+
+static void virtio_blk_timer(void)
+{
+    for (int i = 0; i < virtio_blk_count; i++) {
+        if (virtio_blks[i].irq == VIRTIO_IRQ_NONE) {
+            virtio_blk_poll(&virtio_blks[i]);
+        }
+    }
+}
+
+// PCI interrupt lines with an entry stub in arch/x86_64/interrupt.s
+static bool virtio_irq_usable(uint8_t irq)
+{
+    return irq == 5 || irq == 9 || irq == 10 || irq == 11;
+}
+
+static bool virtio_blk_probe(virtio_blk_t *blk, pci_address_t address, uint8_t *ring)
+{
+    uint32_t bar0 = pci_config_read32(address, PCI_BAR0);
+
+    if (!(bar0 & 1)) {
+        return false;
+    }
+
+    uint16_t io = bar0 & 0xFFFC;
+    pci_config_write16(address, PCI_COMMAND, pci_config_read16(address, PCI_COMMAND) |
+                       PCI_COMMAND_IO | PCI_COMMAND_BUS_MASTER);
+
+    outb(io + VIRTIO_STATUS, 0);  // Reset
+    outb(io + VIRTIO_STATUS, VIRTIO_STATUS_ACKNOWLEDGE);
+    outb(io + VIRTIO_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+
+    uint32_t features = inl(io + VIRTIO_HOST_FEATURES) & (VIRTIO_BLK_F_SEG_MAX | VIRTIO_BLK_F_RO | VIRTIO_BLK_F_FLUSH);
+    outl(io + VIRTIO_GUEST_FEATURES, features);
+
+    // Legacy devices fix the ring size, so one larger than the static memory cannot be used
+    outw(io + VIRTIO_QUEUE_SELECT, 0);
+    uint16_t size = inw(io + VIRTIO_QUEUE_SIZE);
+    if (size < VIRTIO_BLK_SLOT_DESCS || size > VIRTIO_QUEUE_MAX || (size & (size - 1)) != 0) {
+        outb(io + VIRTIO_STATUS, VIRTIO_STATUS_FAILED);
+        return false;
+    }
+
+    uint64_t used_offset = size * sizeof(vring_desc_t) + sizeof(vring_avail_t) + (size + 1) * sizeof(uint16_t);
+    used_offset = (used_offset + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+
+    arch_memory_zero(ring, VIRTIO_RING_PAGES * PAGE_SIZE);
+    arch_memory_zero_struct(blk);
+    blk->address = address;
+    blk->io = io;
+    blk->features = features;
+    blk->queue_size = size;
+    blk->slot_count = size / VIRTIO_BLK_SLOT_DESCS < VIRTIO_BLK_SLOTS ? size / VIRTIO_BLK_SLOT_DESCS : VIRTIO_BLK_SLOTS;
+    blk->desc = (volatile vring_desc_t *)ring;
+    blk->avail = (volatile vring_avail_t *)(ring + size * sizeof(vring_desc_t));
+    blk->used = (volatile vring_used_t *)(ring + used_offset);
+    blk->capacity = inl(io + VIRTIO_BLK_CAPACITY) | ((uint64_t)inl(io + VIRTIO_BLK_CAPACITY + 4) << 32);
+    blk->seg_max = (features & VIRTIO_BLK_F_SEG_MAX) ? inl(io + VIRTIO_BLK_SEG_MAX) : 0;
+
+    uint8_t irq = pci_config_read8(address, PCI_INTERRUPT_LINE);
+    blk->irq = virtio_irq_usable(irq) ? irq : VIRTIO_IRQ_NONE;
+    if (blk->irq == VIRTIO_IRQ_NONE) {
+        blk->avail->flags = VRING_AVAIL_F_NO_INTERRUPT;
+    }
+
+    outl(io + VIRTIO_QUEUE_PFN, physical_address(ring) / PAGE_SIZE);
+    outb(io + VIRTIO_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_DRIVER_OK);
+
+    return true;
+}
+
+void x86_virtio_init(void)
+{
+    pci_address_t address;
+    bool polled = false;
+
+    for (int i = 0; virtio_blk_count < VIRTIO_BLK_MAX &&
+                    pci_find_device(VIRTIO_PCI_VENDOR, VIRTIO_PCI_DEVICE_BLK, i, &address); i++) {
+        virtio_blk_t *blk = &virtio_blks[virtio_blk_count];
+
+        if (!virtio_blk_probe(blk, address, virtio_rings[virtio_blk_count])) {
+            continue;
+        }
+
+        arch_debug_printf("%s: virtio-blk at %u:%u.%u, %lu sectors, queue %u, %u in flight, %s%s\n",
+                          virtio_blk_names[virtio_blk_count], address.bus, address.device, address.function,
+                          blk->capacity, blk->queue_size, blk->slot_count,
+                          blk->irq == VIRTIO_IRQ_NONE ? "polled" : "interrupt",
+                          (blk->features & VIRTIO_BLK_F_FLUSH) ? ", write cache" : "");
+
+        if (blk->irq == VIRTIO_IRQ_NONE) {
+            polled = true;
+        } else {
+            arch_register_interrupt(0x20 + blk->irq, virtio_blk_irq_handler);
+            x86_64_pic_unmask_irq(blk->irq);
+        }
+
+        virtio_blk_count++;
+    }
+
+    if (polled) {
+        arch_timer_add_callback(virtio_blk_timer);
+    }
+}
+
+int virtio_blk_get_count(void)
+{
+    return virtio_blk_count;
+}
+
+virtio_blk_t *virtio_blk_get(int index)
+{
+    return index >= 0 && index < virtio_blk_count ? &virtio_blks[index] : NULL;
+}
+
+void virtio_blk_get_info(virtio_blk_t *blk, arch_disk_info_t *info)
+{
+    info->name = virtio_blk_names[blk - virtio_blks];
+    info->block_size = VIRTIO_SECTOR_SIZE;
+    info->block_count = blk->capacity;
+    info->read_only = (blk->features & VIRTIO_BLK_F_RO) != 0;
+    info->max_segments = virtio_blk_limit(blk);
+}
+
+arch_result virtio_blk_submit(virtio_blk_t *blk, arch_disk_request_t *request)
+{
+    uint32_t segments = request->segment_count ? request->segment_count : 1;
+
+    if (request->block_count > 0) {
+        if (request->write && (blk->features & VIRTIO_BLK_F_RO)) {
+            return ARCH_ERROR;
+        }
+        if (request->start_block >= blk->capacity || request->block_count > blk->capacity - request->start_block) {
+            return ARCH_ERROR;
+        }
+        if (segments > VIRTIO_BLK_SEGMENTS || (blk->seg_max && segments > blk->seg_max)) {
+            return ARCH_ERROR;
+        }
+        for (uint32_t i = 0; i < request->segment_count; i++) {
+            if (request->segments[i].block_count > VIRTIO_BLK_SEGMENT_BLOCKS) {
+                return ARCH_ERROR;
+            }
+        }
+        if (!request->segment_count && request->block_count > VIRTIO_BLK_SEGMENT_BLOCKS) {
+            return ARCH_ERROR;
+        }
+        if (!virtio_blk_mapped(blk, request)) {
+            return ARCH_ERROR;
+        }
+    }
+
+    request->next = NULL;
+    request->result = ARCH_OK;
+
+    uint64_t state = arch_interrupt_save();
+
+    if (blk->tail) {
+        blk->tail->next = request;
+    } else {
+        blk->head = request;
+    }
+    blk->tail = request;
+    virtio_blk_start(blk);
+
+    arch_interrupt_restore(state);
+
+    return ARCH_OK;
+}
+
+static void virtio_blk_sync_complete(arch_disk_request_t *request)
+{
+    *(volatile bool *)request->context = true;
+}
+
+arch_result virtio_blk_transfer(virtio_blk_t *blk, void *buf, uint64_t start_block, uint32_t block_count,
+                                bool write, uint32_t flags)
+{
+    volatile bool done = false;
+    arch_disk_request_t request = {
+        .buffer = buf,
+        .start_block = start_block,
+        .block_count = block_count,
+        .write = write,
+        .flags = flags,
+        .complete = virtio_blk_sync_complete,
+        .context = (void *)&done,
+    };
+
+    uint64_t state = arch_interrupt_save();
+    arch_result result = virtio_blk_submit(blk, &request);
+
+    // With interrupts disabled nothing else would reap the ring
+    while (result == ARCH_OK && !done) {
+        if (state & RFLAGS_IF) {
+            arch_interrupt_wait();
+        } else {
+            virtio_blk_poll(blk);
+        }
+    }
+
+    arch_interrupt_restore(state);
+
+    return result == ARCH_OK ? request.result : result;
+}
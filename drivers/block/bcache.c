@@ -0,0 +1,537 @@
+#include "drivers/bcache.h"
+#include "arch/arch.h"
+
+/* Every cached block is on a hash chain keyed by (device, block) and on one
+ * LRU list, most recently used first. Eviction takes the least recently used
+ * block that is clean and idle. Bios run asynchronously from an entry's own
+ * bio, so the flusher can write back from the timer interrupt; everything
+ * else holds interrupts off while it touches the lists and only lets them
+ * in while halting for I/O. */
+
+#define BCACHE_HASH_BUCKETS (1 << BCACHE_HASH_BITS)
+
+typedef enum {
+    BCACHE_IO_NONE = 0,
+    BCACHE_IO_READ,
+    BCACHE_IO_WRITE
+} bcache_io_t;
+
+typedef struct bcache_entry {
+    device_t *dev;                     // NULL while unused
+    uint64_t block;
+    uint8_t *data;
+    bool valid;                        // data holds the block
+    bool dirty;                        // data is newer than the device
+    volatile bcache_io_t io;           // Bio in flight on data
+    uint32_t pins;                     // Callers still copying to or from data
+    bool readahead;                    // Read ahead and not asked for yet
+    bool mapped;                       // data is the device's own storage
+    uint64_t dirty_ns;                 // When the block went dirty
+    bio_t bio;
+    struct bcache_entry *hash_next;
+    struct bcache_entry *lru_prev;     // Towards the most recently used
+    struct bcache_entry *lru_next;
+} bcache_entry_t;
+
+typedef struct {
+    device_t *dev;
+    uint64_t next_block;               // Where a sequential read would start
+    uint64_t ahead_end;                // Blocks below this have been read ahead
+    uint32_t window;                   // Blocks to keep ahead, 0 while access is random
+} bcache_stream_t;
+
+static uint8_t bcache_data[BCACHE_BLOCKS][BCACHE_BLOCK_SIZE] __attribute__((aligned(16)));
+static bcache_entry_t bcache_entries[BCACHE_BLOCKS];
+static bcache_entry_t *bcache_hash[BCACHE_HASH_BUCKETS];
+static bcache_entry_t *bcache_lru_head = NULL;
+static bcache_entry_t *bcache_lru_tail = NULL;
+static bcache_stats_t bcache_stats;
+static bcache_stream_t bcache_streams[BCACHE_STREAMS];
+static unsigned int bcache_stream_victim = 0;
+static uint64_t bcache_next_flush = 0;
+static bool bcache_ready = false;
+static bool bcache_readahead_enabled = true;
+
+static unsigned int bcache_bucket(const device_t *dev, uint64_t block)
+{
+    uint64_t key = block ^ ((uint64_t)dev >> 4);
+    return (key * 0x9E3779B97F4A7C15ULL) >> (64 - BCACHE_HASH_BITS);
+}
+
+static bcache_entry_t *bcache_lookup(const device_t *dev, uint64_t block)
+{
+    bcache_entry_t *entry = bcache_hash[bcache_bucket(dev, block)];
+
+    while (entry && (entry->dev != dev || entry->block != block)) {
+        entry = entry->hash_next;
+    }
+
+    return entry;
+}
+
+static void bcache_unhash(bcache_entry_t *entry)
+{
+    if (!entry->dev) {
+        return;
+    }
+
+    bcache_entry_t **link = &bcache_hash[bcache_bucket(entry->dev, entry->block)];
+    while (*link != entry) {
+        link = &(*link)->hash_next;
+    }
+    *link = entry->hash_next;
+
+    entry->hash_next = NULL;
+    entry->dev = NULL;
+    entry->valid = false;
+    entry->dirty = false;
+    entry->readahead = false;
+
+    if (entry->mapped) {
+        entry->mapped = false;
+        entry->data = bcache_data[entry - bcache_entries];
+    }
+}
+
+static void bcache_touch(bcache_entry_t *entry)
+{
+    if (entry == bcache_lru_head) {
+        return;
+    }
+
+    // Unlink; the entry is not the head, so it has a predecessor
+    entry->lru_prev->lru_next = entry->lru_next;
+    if (entry->lru_next) {
+        entry->lru_next->lru_prev = entry->lru_prev;
+    } else {
+        bcache_lru_tail = entry->lru_prev;
+    }
+
+    entry->lru_prev = NULL;
+    entry->lru_next = bcache_lru_head;
+    bcache_lru_head->lru_prev = entry;
+    bcache_lru_head = entry;
+}
+
+// Runs in interrupt context
+static void bcache_end_io(bio_t *bio)
+{
+    bcache_entry_t *entry = bio->private;
+
+    if (entry->io == BCACHE_IO_READ) {
+        entry->valid = bio->status == 0;
+    } else if (bio->status == 0) {
+        entry->dirty = false;
+        bcache_stats.writebacks++;
+    } else {
+        entry->dirty_ns = arch_time_ns();
+        bcache_stats.write_errors++;
+    }
+
+    entry->io = BCACHE_IO_NONE;
+}
+
+static bool bcache_start_io(bcache_entry_t *entry, bcache_io_t io)
+{
+    entry->bio.op = io == BCACHE_IO_WRITE ? BIO_WRITE : BIO_READ;
+    entry->bio.flags = 0;
+    entry->bio.start_block = entry->block;
+    entry->bio.block_count = 1;
+    entry->bio.buffer = entry->data;
+    entry->bio.end_io = bcache_end_io;
+    entry->bio.private = entry;
+    entry->io = io;
+
+    if (submit_bio(entry->dev, &entry->bio) != 0) {
+        entry->io = BCACHE_IO_NONE;
+        return false;
+    }
+
+    return true;
+}
+
+static void bcache_wait(bcache_entry_t *entry)
+{
+    while (entry->io != BCACHE_IO_NONE) {
+        arch_interrupt_wait();
+    }
+}
+
+/* Find or claim the entry for a block and pin it; a claimed entry is not
+ * valid yet. Without wait, give up instead of writing back to make room. */
+static bcache_entry_t *bcache_get(device_t *dev, uint64_t block, bool wait)
+{
+    bcache_entry_t *entry = bcache_lookup(dev, block);
+    if (entry) {
+        bcache_touch(entry);
+        entry->pins++;
+        return entry;
+    }
+
+    for (;;) {
+        bcache_entry_t *dirty = NULL;
+
+        for (entry = bcache_lru_tail; entry; entry = entry->lru_prev) {
+            if (entry->io != BCACHE_IO_NONE || entry->pins) {
+                continue;
+            }
+            if (!entry->dirty) {
+                break;
+            }
+            if (!dirty) {
+                dirty = entry;
+            }
+        }
+
+        if (entry) {
+            break;
+        }
+
+        if (!wait) {
+            return NULL;
+        }
+
+        // Everything idle is dirty: write the oldest one back and look again
+        if (dirty && !bcache_start_io(dirty, BCACHE_IO_WRITE)) {
+            return NULL;
+        }
+        arch_interrupt_wait();
+    }
+
+    if (entry->dev) {
+        bcache_stats.evictions++;
+    }
+    bcache_unhash(entry);
+
+    unsigned int bucket = bcache_bucket(dev, block);
+    entry->dev = dev;
+    entry->block = block;
+    entry->hash_next = bcache_hash[bucket];
+    bcache_hash[bucket] = entry;
+
+    // Memory-backed blocks are valid in place and writes land in the device directly
+    void *storage = dev->block_ops.map_block ? dev->block_ops.map_block(dev, block) : NULL;
+    if (storage) {
+        entry->data = storage;
+        entry->mapped = true;
+        entry->valid = true;
+        bcache_stats.mapped++;
+    }
+
+    bcache_touch(entry);
+    entry->pins++;
+
+    return entry;
+}
+
+static bcache_stream_t *bcache_stream(device_t *dev)
+{
+    for (int i = 0; i < BCACHE_STREAMS; i++) {
+        if (bcache_streams[i].dev == dev) {
+            return &bcache_streams[i];
+        }
+    }
+
+    bcache_stream_t *stream = &bcache_streams[bcache_stream_victim];
+    bcache_stream_victim = (bcache_stream_victim + 1) % BCACHE_STREAMS;
+
+    stream->dev = dev;
+    stream->next_block = (uint64_t)-1;
+    stream->ahead_end = 0;
+    stream->window = 0;
+
+    return stream;
+}
+
+// Follow the device's read stream and keep its window of blocks in flight
+static void bcache_read_ahead(device_t *dev, uint64_t start_block, uint32_t block_count)
+{
+    bcache_stream_t *stream = bcache_stream(dev);
+    uint64_t end = start_block + block_count;
+
+    if (start_block == stream->next_block) {
+        if (stream->window == 0) {
+            stream->window = BCACHE_READAHEAD_MIN;
+        } else if (stream->window < BCACHE_READAHEAD_MAX) {
+            stream->window *= 2;
+        }
+    } else {
+        stream->window = 0;
+        stream->ahead_end = 0;
+    }
+    stream->next_block = end;
+
+    // Nothing to gain ahead of a device whose blocks are mapped on demand
+    if (stream->window == 0 || !bcache_readahead_enabled || dev->block_ops.map_block) {
+        return;
+    }
+
+    uint64_t block = stream->ahead_end > end ? stream->ahead_end : end;
+    uint64_t limit = end + stream->window;
+    uint64_t block_total = dev->block_ops.get_block_count(dev);
+    if (limit > block_total) {
+        limit = block_total;
+    }
+
+    for (; block < limit; block++) {
+        bcache_entry_t *entry = bcache_get(dev, block, false);
+        if (!entry) {
+            break;
+        }
+
+        if (!entry->valid && entry->io == BCACHE_IO_NONE) {
+            if (!bcache_start_io(entry, BCACHE_IO_READ)) {
+                entry->pins--;
+                break;
+            }
+            entry->readahead = true;
+            bcache_stats.readahead++;
+        }
+
+        entry->pins--;
+    }
+
+    stream->ahead_end = block;
+}
+
+static bool bcache_usable(device_t *dev, uint32_t block_count)
+{
+    return bcache_ready && block_count <= BCACHE_BYPASS_BLOCKS &&
+           dev->block_ops.get_block_size(dev) <= BCACHE_BLOCK_SIZE;
+}
+
+static int bcache_direct(device_t *dev, bio_op_t op, void *buf, uint64_t start_block, uint32_t block_count)
+{
+    bio_t bio = {
+        .op = op,
+        .start_block = start_block,
+        .block_count = block_count,
+        .buffer = buf,
+    };
+
+    return submit_bio_wait(dev, &bio) == 0 ? (int)block_count : -1;
+}
+
+int bcache_read(device_t *dev, void *buf, uint64_t start_block, uint32_t block_count)
+{
+    uint32_t block_size = dev->block_ops.get_block_size(dev);
+    uint8_t *out = buf;
+
+    if (!bcache_usable(dev, block_count)) {
+        if (bcache_direct(dev, BIO_READ, buf, start_block, block_count) < 0) {
+            return -1;
+        }
+
+        // Dirty cached blocks are newer than what the device returned
+        uint64_t state = arch_interrupt_save();
+        for (uint32_t i = 0; bcache_ready && i < block_count; i++) {
+            bcache_entry_t *entry = bcache_lookup(dev, start_block + i);
+            if (entry && entry->dirty) {
+                arch_memory_copy(out + (uint64_t)i * block_size, entry->data, block_size);
+            }
+        }
+        arch_interrupt_restore(state);
+
+        return (int)block_count;
+    }
+
+    bcache_entry_t *entries[BCACHE_BYPASS_BLOCKS];
+    int result = (int)block_count;
+
+    uint64_t state = arch_interrupt_save();
+
+    // Start every miss before waiting for any, so the elevator can merge them
+    for (uint32_t i = 0; i < block_count; i++) {
+        bcache_entry_t *entry = bcache_get(dev, start_block + i, true);
+        entries[i] = entry;
+
+        if (!entry) {
+            continue;
+        }
+
+        if (entry->valid || entry->io == BCACHE_IO_READ) {
+            bcache_stats.hits++;
+            if (entry->readahead) {
+                entry->readahead = false;
+                bcache_stats.readahead_hits++;
+            }
+        } else {
+            bcache_stats.misses++;
+            if (!bcache_start_io(entry, BCACHE_IO_READ)) {
+                entry->pins--;
+                entries[i] = NULL;
+            }
+        }
+    }
+
+    bcache_read_ahead(dev, start_block, block_count);
+
+    for (uint32_t i = 0; i < block_count; i++) {
+        bcache_entry_t *entry = entries[i];
+
+        while (entry && entry->io == BCACHE_IO_READ) {
+            arch_interrupt_wait();
+        }
+
+        if (!entry) {
+            result = -1;
+            continue;
+        }
+
+        if (entry->valid) {
+            arch_memory_copy(out + (uint64_t)i * block_size, entry->data, block_size);
+        } else {
+            result = -1;
+        }
+        entry->pins--;
+    }
+
+    arch_interrupt_restore(state);
+
+    return result;
+}
+
+int bcache_write(device_t *dev, const void *buf, uint64_t start_block, uint32_t block_count)
+{
+    uint32_t block_size = dev->block_ops.get_block_size(dev);
+    const uint8_t *in = buf;
+
+    uint64_t state = arch_interrupt_save();
+
+    if (!bcache_usable(dev, block_count)) {
+        // Drop cached copies first so no older writeback lands after this write
+        for (uint32_t i = 0; bcache_ready && i < block_count; i++) {
+            bcache_entry_t *entry = bcache_lookup(dev, start_block + i);
+            if (entry) {
+                bcache_wait(entry);
+                bcache_unhash(entry);
+            }
+        }
+
+        // The device only reads from the buffer in the write direction
+        int result = bcache_direct(dev, BIO_WRITE, (void *)buf, start_block, block_count);
+        arch_interrupt_restore(state);
+        return result;
+    }
+
+    uint64_t now = arch_time_ns();
+
+    for (uint32_t i = 0; i < block_count; i++) {
+        bcache_entry_t *entry = bcache_get(dev, start_block + i, true);
+        if (!entry) {
+            arch_interrupt_restore(state);
+            return -1;
+        }
+
+        // The device may still be reading the old contents
+        bcache_wait(entry);
+
+        arch_memory_copy(entry->data, in + (uint64_t)i * block_size, block_size);
+        entry->valid = true;
+        if (!entry->dirty && !entry->mapped) {
+            entry->dirty = true;
+            entry->dirty_ns = now;
+        }
+        entry->pins--;
+    }
+
+    arch_interrupt_restore(state);
+
+    return (int)block_count;
+}
+
+arch_result bcache_sync(device_t *dev)
+{
+    if (!bcache_ready) {
+        return ARCH_OK;
+    }
+
+    arch_result result = ARCH_OK;
+    uint64_t state = arch_interrupt_save();
+
+    // Queue all writebacks at once so they go out merged and in block order
+    for (int i = 0; i < BCACHE_BLOCKS; i++) {
+        bcache_entry_t *entry = &bcache_entries[i];
+        if (entry->dev == dev && entry->dirty && entry->io == BCACHE_IO_NONE) {
+            bcache_start_io(entry, BCACHE_IO_WRITE);
+        }
+    }
+
+    for (int i = 0; i < BCACHE_BLOCKS; i++) {
+        bcache_entry_t *entry = &bcache_entries[i];
+        if (entry->dev == dev) {
+            bcache_wait(entry);
+            if (entry->dirty) {
+                result = ARCH_ERROR;
+            }
+        }
+    }
+
+    arch_interrupt_restore(state);
+
+    return result;
+}
+
+// Timer callback: write back blocks that have been dirty for too long
+static void bcache_flush(void)
+{
+    uint64_t now = arch_time_ns();
+
+    if (now < bcache_next_flush) {
+        return;
+    }
+    bcache_next_flush = now + BCACHE_FLUSH_PERIOD_NS;
+
+    for (int i = 0; i < BCACHE_BLOCKS; i++) {
+        bcache_entry_t *entry = &bcache_entries[i];
+        if (entry->dirty && entry->io == BCACHE_IO_NONE && now - entry->dirty_ns >= BCACHE_WRITEBACK_NS) {
+            bcache_start_io(entry, BCACHE_IO_WRITE);
+        }
+    }
+}
+
+arch_result bcache_init(void)
+{
+    if (bcache_ready) {
+        return ARCH_OK;
+    }
+
+    for (int i = 0; i < BCACHE_HASH_BUCKETS; i++) {
+        bcache_hash[i] = NULL;
+    }
+
+    for (int i = 0; i < BCACHE_STREAMS; i++) {
+        bcache_streams[i].dev = NULL;
+    }
+
+    for (int i = 0; i < BCACHE_BLOCKS; i++) {
+        bcache_entry_t *entry = &bcache_entries[i];
+
+        arch_memory_zero_struct(entry);
+        entry->data = bcache_data[i];
+        entry->lru_prev = i > 0 ? &bcache_entries[i - 1] : NULL;
+        entry->lru_next = i < BCACHE_BLOCKS - 1 ? &bcache_entries[i + 1] : NULL;
+    }
+
+    bcache_lru_head = &bcache_entries[0];
+    bcache_lru_tail = &bcache_entries[BCACHE_BLOCKS - 1];
+    arch_memory_zero_struct(&bcache_stats);
+
+    if (arch_timer_add_callback(bcache_flush) != ARCH_OK) {
+        return ARCH_ERROR;
+    }
+
+    bcache_ready = true;
+
+    return ARCH_OK;
+}
+
+void bcache_set_readahead(bool enabled)
+{
+    bcache_readahead_enabled = enabled;
+}
+
+const bcache_stats_t *bcache_get_stats(void)
+{
+    return &bcache_stats;
+}
@@ -1,5 +1,9 @@
 #include "kernel/device.h"
 #include "arch/arch.h"
+#include "drivers/disk.h"
+#include "drivers/elevator.h"
+#include "drivers/bcache.h"
+#include "kernel/trace.h"
 #include "lib/string.h"
 
 static arch_result disk_open(device_t *dev);
@@ -9,12 +13,29 @@ static int disk_write_blocks(device_t *dev, const void *buf, uint64_t start_bloc
 static arch_result disk_sync(device_t *dev);
 static uint32_t disk_get_block_size(device_t *dev);
 static uint64_t disk_get_block_count(device_t *dev);
+static int disk_submit_bio(device_t *dev, bio_t *bio);
+static const block_queue_stats_t *disk_get_stats(device_t *dev);
+
+#define DISK_QUEUE_DEPTH   2    // Requests handed to the controller at once; the rest wait here
+#define DISK_MAX_SEGMENTS  16   // Bios merged into one request, further limited by the device
+#define DISK_MAX_MERGE     256  // Blocks covered by one merged request
+
+typedef struct {
+    arch_disk_request_t request;       // First member: the completion gets back to the slot
+    device_t *dev;
+    bio_t *bio;                        // Merged bios in block order; NULL while the slot is free
+    arch_disk_segment_t segments[DISK_MAX_SEGMENTS];
+} disk_slot_t;
 
 typedef struct {
     arch_disk_device_t *arch_device;  // Opaque arch-specific device handle
     uint32_t block_size;               // Block size in bytes
     uint64_t block_count;              // Total number of blocks
     bool read_only;                    // Device is read-only
+    uint32_t max_segments;             // Bios merged into one request
+    elevator_queue_t queue;            // Bios not yet handed to the controller
+    disk_slot_t slots[DISK_QUEUE_DEPTH];
+    block_queue_stats_t stats;
 } disk_driver_data_t;
 
 static device_t *disk_devices = NULL;
@@ -35,63 +56,228 @@ static arch_result disk_open(device_t *dev)
 
 static arch_result disk_close(device_t *dev)
 {
-    disk_driver_data_t *data = (disk_driver_data_t *)dev->driver_data;
-    
-    arch_disk_sync(data->arch_device);
+    disk_sync(dev);
     
     return ARCH_OK;
 }
 
-static int disk_read_blocks(device_t *dev, void *buf, uint64_t start_block, uint32_t block_count)
+static void disk_dispatch(device_t *dev);
+
+static void disk_account(block_queue_stats_t *stats, bio_t *bio)
 {
-    disk_driver_data_t *data = (disk_driver_data_t *)dev->driver_data;
-    
-    if (!buf || block_count == 0) {
-        return -1;
+    uint64_t latency_us = (arch_time_ns() - bio->submit_ns) / 1000;
+    int bucket = 0;
+
+    while (bucket < BLOCK_LATENCY_BUCKETS - 1 && latency_us >= (1UL << bucket)) {
+        bucket++;
     }
-    
-    if (start_block >= data->block_count || 
-        start_block + block_count > data->block_count) {
-        return -1;
+
+    stats->latency_histogram[bucket]++;
+    stats->completed++;
+    stats->depth--;
+    if (bio->status != 0) {
+        stats->errors++;
     }
-    
-    arch_result result = arch_disk_read_blocks(data->arch_device, buf, start_block, block_count);
-    if (result != ARCH_OK) {
-        return -1;
+}
+
+// Runs in interrupt context, or from arch_disk_submit when the request fails to start
+static void disk_request_complete(arch_disk_request_t *request)
+{
+    disk_slot_t *slot = (disk_slot_t *)request;
+    device_t *dev = slot->dev;
+    disk_driver_data_t *data = (disk_driver_data_t *)dev->driver_data;
+    bio_t *bio = slot->bio;
+
+    slot->bio = NULL;
+
+    while (bio) {
+        bio_t *next = bio->next;  // end_io may reuse the bio
+
+        bio->next = NULL;
+        bio->status = request->result == ARCH_OK ? 0 : -1;
+
+        trace_event(bio->op == BIO_WRITE ? TRACE_DISK_WRITE_DONE : TRACE_DISK_READ_DONE,
+                    bio->start_block, (uint64_t)request->result);
+        disk_account(&data->stats, bio);
+
+        if (bio->end_io) {
+            bio->end_io(bio);
+        }
+
+        bio = next;
     }
-    
-    return block_count;
+
+    disk_dispatch(dev);
 }
 
-static int disk_write_blocks(device_t *dev, const void *buf, uint64_t start_block, uint32_t block_count)
+// Hand pending bios to free controller slots; called with interrupts disabled
+static void disk_dispatch(device_t *dev)
 {
     disk_driver_data_t *data = (disk_driver_data_t *)dev->driver_data;
-    
+
+    for (int i = 0; i < DISK_QUEUE_DEPTH && elevator_pending(&data->queue); i++) {
+        disk_slot_t *slot = &data->slots[i];
+        if (slot->bio) {
+            continue;
+        }
+
+        bio_t *bio = elevator_dispatch(&data->queue, data->max_segments, DISK_MAX_MERGE);
+        uint32_t segments = 0;
+        uint32_t blocks = 0;
+        uint32_t flags = bio->op == BIO_FLUSH ? ARCH_DISK_PREFLUSH : 0;
+
+        // One bio asking for a flush or FUA makes the whole merged request do so
+        for (bio_t *current = bio; current; current = current->next) {
+            if (current->flags & BIO_PREFLUSH) {
+                flags |= ARCH_DISK_PREFLUSH;
+            }
+            if (current->flags & BIO_FUA) {
+                flags |= ARCH_DISK_FUA;
+            }
+            if (current->block_count == 0) {
+                continue;
+            }
+            slot->segments[segments].buffer = current->buffer;
+            slot->segments[segments].block_count = current->block_count;
+            blocks += current->block_count;
+            segments++;
+        }
+
+        if (flags & ARCH_DISK_PREFLUSH) {
+            data->stats.flushes++;
+        }
+
+        slot->dev = dev;
+        slot->bio = bio;
+        slot->request.buffer = NULL;
+        slot->request.segments = slot->segments;
+        slot->request.segment_count = segments;
+        slot->request.start_block = bio->start_block;
+        slot->request.block_count = blocks;
+        slot->request.write = bio->op != BIO_READ;
+        slot->request.flags = flags;
+        slot->request.complete = disk_request_complete;
+        slot->request.context = slot;
+
+        trace_event(bio->op == BIO_WRITE ? TRACE_DISK_WRITE : TRACE_DISK_READ,
+                    bio->start_block, blocks);
+
+        if (arch_disk_submit(data->arch_device, &slot->request) != ARCH_OK) {
+            slot->request.result = ARCH_ERROR;
+            disk_request_complete(&slot->request);
+            return;
+        }
+    }
+}
+
+static bool disk_valid_request(disk_driver_data_t *data, const void *buf, uint64_t start_block,
+                               uint32_t block_count, bool write)
+{
     if (!buf || block_count == 0) {
-        return -1;
+        return false;
     }
-    
-    if (data->read_only) {
+
+    if (write && data->read_only) {
+        return false;
+    }
+
+    return start_block < data->block_count && start_block + block_count <= data->block_count;
+}
+
+static int disk_submit_bio(device_t *dev, bio_t *bio)
+{
+    disk_driver_data_t *data = (disk_driver_data_t *)dev->driver_data;
+
+    if (bio->op == BIO_FLUSH) {
+        if (bio->block_count != 0) {
+            return -1;
+        }
+    } else if (!disk_valid_request(data, bio->buffer, bio->start_block, bio->block_count, bio->op == BIO_WRITE)) {
         return -1;
     }
-    
-    if (start_block >= data->block_count || 
-        start_block + block_count > data->block_count) {
+
+    bio->status = 0;
+    bio->submit_ns = arch_time_ns();
+
+    uint64_t state = arch_interrupt_save();
+
+    elevator_add(&data->queue, bio);
+
+    block_queue_stats_t *stats = &data->stats;
+    stats->submitted++;
+    stats->depth++;
+    if (stats->depth > stats->max_depth) {
+        stats->max_depth = stats->depth;
+    }
+    stats->depth_histogram[stats->depth < BLOCK_DEPTH_BUCKETS ? stats->depth - 1 : BLOCK_DEPTH_BUCKETS - 1]++;
+
+    disk_dispatch(dev);
+
+    arch_interrupt_restore(state);
+
+    return 0;
+}
+
+arch_result disk_set_scheduler(device_t *dev, const char *name)
+{
+    if (!dev || dev->open != disk_open) {
+        return ARCH_INVALID;
+    }
+
+    const elevator_type_t *type = elevator_find(name);
+    if (!type) {
+        return ARCH_UNSUPPORTED;
+    }
+
+    disk_driver_data_t *data = (disk_driver_data_t *)dev->driver_data;
+
+    // Both lists are kept for every policy, so queued bios carry over
+    uint64_t state = arch_interrupt_save();
+    data->queue.type = type;
+    arch_interrupt_restore(state);
+
+    return ARCH_OK;
+}
+
+static const block_queue_stats_t *disk_get_stats(device_t *dev)
+{
+    disk_driver_data_t *data = (disk_driver_data_t *)dev->driver_data;
+    return &data->stats;
+}
+
+static int disk_read_blocks(device_t *dev, void *buf, uint64_t start_block, uint32_t block_count)
+{
+    disk_driver_data_t *data = (disk_driver_data_t *)dev->driver_data;
+
+    if (!disk_valid_request(data, buf, start_block, block_count, false)) {
         return -1;
     }
-    
-    arch_result result = arch_disk_write_blocks(data->arch_device, buf, start_block, block_count);
-    if (result != ARCH_OK) {
+
+    return bcache_read(dev, buf, start_block, block_count);
+}
+
+static int disk_write_blocks(device_t *dev, const void *buf, uint64_t start_block, uint32_t block_count)
+{
+    disk_driver_data_t *data = (disk_driver_data_t *)dev->driver_data;
+
+    // Cached writes only reach the device later, so refuse bad ones here
+    if (!disk_valid_request(data, buf, start_block, block_count, true)) {
         return -1;
     }
-    
-    return block_count;
+
+    return bcache_write(dev, buf, start_block, block_count);
 }
 
 static arch_result disk_sync(device_t *dev)
 {
-    disk_driver_data_t *data = (disk_driver_data_t *)dev->driver_data;
-    return arch_disk_sync(data->arch_device);
+    arch_result result = bcache_sync(dev);
+    if (result != ARCH_OK) {
+        return result;
+    }
+
+    // Queued like any other bio, so the flush also covers writes still in the queue
+    bio_t flush = { .op = BIO_FLUSH };
+    return submit_bio_wait(dev, &flush) == 0 ? ARCH_OK : ARCH_ERROR;
 }
 
 static uint32_t disk_get_block_size(device_t *dev)
@@ -106,6 +292,11 @@ static uint64_t disk_get_block_count(device_t *dev)
     return data->block_count;
 }
 
+void disk_driver_start(void)
+{
+    arch_disk_start();
+}
+
 arch_result disk_driver_init(void)
 {
     disk_device_count = arch_disk_get_count();
@@ -113,6 +304,11 @@ arch_result disk_driver_init(void)
     if (disk_device_count == 0) {
         return ARCH_OK;
     }
+
+    arch_result cache_result = bcache_init();
+    if (cache_result != ARCH_OK) {
+        return cache_result;
+    }
     
     // TODO: allocate storage for devices and data dynamically
     #define MAX_DISK_DEVICES 8
@@ -148,13 +344,17 @@ arch_result disk_driver_init(void)
         device->block_ops.sync = disk_sync;
         device->block_ops.get_block_size = disk_get_block_size;
         device->block_ops.get_block_count = disk_get_block_count;
+        device->block_ops.submit_bio = disk_submit_bio;
+        device->block_ops.get_stats = disk_get_stats;
         device->driver_data = data;
-        device->next = NULL;
         
         data->arch_device = info.device;
         data->block_size = info.block_size;
         data->block_count = info.block_count;
         data->read_only = info.read_only;
+        data->max_segments = info.max_segments && info.max_segments < DISK_MAX_SEGMENTS ? info.max_segments
+                                                                                        : DISK_MAX_SEGMENTS;
+        elevator_init(&data->queue, &elevator_deadline, &data->stats);
         
         result = device_register(device);
         if (result != ARCH_OK) {
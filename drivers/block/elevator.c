@@ -0,0 +1,265 @@
+#include "drivers/elevator.h"
+#include "lib/string.h"
+
+/* Every queued bio sits on two lists: the FIFO keeps arrival order for noop
+ * and for deadline expiry, the sorted list keeps block order for the sweeps
+ * and for finding merge partners. Queues stay short, so linear walks are
+ * cheaper than anything cleverer. */
+
+static void elevator_remove(elevator_queue_t *queue, bio_t *bio)
+{
+    bio_t *previous = NULL;
+
+    for (bio_t *current = queue->fifo; current; previous = current, current = current->next) {
+        if (current == bio) {
+            if (previous) {
+                previous->next = bio->next;
+            } else {
+                queue->fifo = bio->next;
+            }
+            if (queue->fifo_tail == bio) {
+                queue->fifo_tail = previous;
+            }
+            break;
+        }
+    }
+
+    for (bio_t **link = &queue->sorted; *link; link = &(*link)->sort_next) {
+        if (*link == bio) {
+            *link = bio->sort_next;
+            break;
+        }
+    }
+
+    bio->next = NULL;
+    bio->sort_next = NULL;
+}
+
+// C-LOOK: the first bio at or above the head position, wrapping to the lowest
+static bio_t *elevator_sweep(elevator_queue_t *queue)
+{
+    for (bio_t *bio = queue->sorted; bio; bio = bio->sort_next) {
+        if (bio->start_block >= queue->position) {
+            return bio;
+        }
+    }
+
+    return queue->sorted;
+}
+
+static bio_t *noop_select(elevator_queue_t *queue)
+{
+    return queue->fifo;
+}
+
+static bio_t *deadline_select(elevator_queue_t *queue)
+{
+    uint64_t now = arch_time_ns();
+    bool read_seen = false;
+    bool write_seen = false;
+
+    // The first bio of each direction in the FIFO is the oldest one
+    for (bio_t *bio = queue->fifo; bio && !(read_seen && write_seen); bio = bio->next) {
+        bool write = bio->op == BIO_WRITE;
+        if (write ? write_seen : read_seen) {
+            continue;
+        }
+
+        uint64_t expire = write ? ELEVATOR_WRITE_EXPIRE_NS : ELEVATOR_READ_EXPIRE_NS;
+        if (now - bio->submit_ns >= expire) {
+            return bio;
+        }
+
+        read_seen |= !write;
+        write_seen |= write;
+    }
+
+    return elevator_sweep(queue);
+}
+
+static bio_t *look_select(elevator_queue_t *queue)
+{
+    return elevator_sweep(queue);
+}
+
+const elevator_type_t elevator_noop = { "noop", false, noop_select };
+const elevator_type_t elevator_deadline = { "deadline", true, deadline_select };
+const elevator_type_t elevator_look = { "look", true, look_select };
+
+static const elevator_type_t *elevator_types[] = {
+    &elevator_noop,
+    &elevator_deadline,
+    &elevator_look,
+};
+
+const elevator_type_t *elevator_find(const char *name)
+{
+    for (int i = 0; i < sizeof(elevator_types) / sizeof(elevator_types[0]); i++) {
+        if (strcmp(elevator_types[i]->name, name) == 0) {
+            return elevator_types[i];
+        }
+    }
+
+    return NULL;
+}
+
+void elevator_init(elevator_queue_t *queue, const elevator_type_t *type, block_queue_stats_t *stats)
+{
+    queue->type = type;
+    queue->fifo = NULL;
+    queue->fifo_tail = NULL;
+    queue->sorted = NULL;
+    queue->held = NULL;
+    queue->held_tail = NULL;
+    queue->position = 0;
+    queue->stats = stats;
+}
+
+static void elevator_insert(elevator_queue_t *queue, bio_t *bio)
+{
+    bio->next = NULL;
+    if (queue->fifo_tail) {
+        queue->fifo_tail->next = bio;
+    } else {
+        queue->fifo = bio;
+    }
+    queue->fifo_tail = bio;
+
+    // Equal start blocks stay in arrival order
+    bio_t **link = &queue->sorted;
+    while (*link && (*link)->start_block <= bio->start_block) {
+        link = &(*link)->sort_next;
+    }
+    bio->sort_next = *link;
+    *link = bio;
+}
+
+void elevator_add(elevator_queue_t *queue, bio_t *bio)
+{
+    if (!queue->held && !(bio->flags & BIO_BARRIER)) {
+        elevator_insert(queue, bio);
+        return;
+    }
+
+    bio->next = NULL;
+    bio->sort_next = NULL;
+    if (queue->held_tail) {
+        queue->held_tail->next = bio;
+    } else {
+        queue->held = bio;
+    }
+    queue->held_tail = bio;
+}
+
+bool elevator_pending(const elevator_queue_t *queue)
+{
+    return queue->fifo || queue->held;
+}
+
+// Everything before the barrier has gone out: send it alone and admit what follows
+static bio_t *elevator_release(elevator_queue_t *queue)
+{
+    bio_t *barrier = queue->held;
+
+    queue->held = barrier->next;
+    barrier->next = NULL;
+
+    while (queue->held && !(queue->held->flags & BIO_BARRIER)) {
+        bio_t *bio = queue->held;
+        queue->held = bio->next;
+        elevator_insert(queue, bio);
+    }
+    if (!queue->held) {
+        queue->held_tail = NULL;
+    }
+
+    queue->stats->barriers++;
+
+    return barrier;
+}
+
+static bio_t *elevator_find_at(elevator_queue_t *queue, bio_op_t op, uint64_t start_block)
+{
+    for (bio_t *bio = queue->sorted; bio && bio->start_block <= start_block; bio = bio->sort_next) {
+        if (bio->start_block == start_block && bio->op == op) {
+            return bio;
+        }
+    }
+
+    return NULL;
+}
+
+static bio_t *elevator_find_ending_at(elevator_queue_t *queue, bio_op_t op, uint64_t end_block)
+{
+    for (bio_t *bio = queue->sorted; bio && bio->start_block < end_block; bio = bio->sort_next) {
+        if (bio->start_block + bio->block_count == end_block && bio->op == op) {
+            return bio;
+        }
+    }
+
+    return NULL;
+}
+
+bio_t *elevator_dispatch(elevator_queue_t *queue, uint32_t max_bios, uint32_t max_blocks)
+{
+    bio_t *first = queue->fifo ? queue->type->select(queue) : NULL;
+    bool barrier = false;
+
+    if (first) {
+        elevator_remove(queue, first);
+    } else if (queue->held) {
+        first = elevator_release(queue);
+        barrier = true;
+    } else {
+        return NULL;
+    }
+
+    bio_t *last = first;
+    uint64_t blocks = first->block_count;
+    uint32_t bios = 1;
+
+    // Flushes have no blocks, so contiguous ones coalesce into one
+    if (queue->type->merge && !barrier) {
+        bio_t *bio;
+
+        while (bios < max_bios &&
+               (bio = elevator_find_at(queue, first->op, last->start_block + last->block_count)) &&
+               blocks + bio->block_count <= max_blocks) {
+            elevator_remove(queue, bio);
+            last->next = bio;
+            last = bio;
+            blocks += bio->block_count;
+            bios++;
+            queue->stats->back_merges++;
+        }
+
+        while (bios < max_bios &&
+               (bio = elevator_find_ending_at(queue, first->op, first->start_block)) &&
+               blocks + bio->block_count <= max_blocks) {
+            elevator_remove(queue, bio);
+            bio->next = first;
+            first = bio;
+            blocks += bio->block_count;
+            bios++;
+            queue->stats->front_merges++;
+        }
+    }
+
+    block_queue_stats_t *stats = queue->stats;
+    stats->dispatched++;
+
+    if (first->op == BIO_FLUSH) {
+        return first;
+    }
+
+    if (first->start_block < queue->position) {
+        stats->backward_seeks++;
+        stats->seek_blocks += queue->position - first->start_block;
+    } else {
+        stats->seek_blocks += first->start_block - queue->position;
+    }
+
+    queue->position = first->start_block + blocks;
+
+    return first;
+}
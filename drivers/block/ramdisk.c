@@ -0,0 +1,256 @@
+#include "drivers/ramdisk.h"
+#include "arch/arch.h"
+#include "arch/x86_64/memory.h"
+#include "drivers/bcache.h"
+#include "lib/string.h"
+
+/* RAM disk
+ *
+ * Bios are copied to or from memory and complete before submit_bio returns,
+ * so the block layer and cache can be measured without a controller in the
+ * way. Blocks never straddle a page, which lets the cache map them in place.
+ */
+
+#define RAMDISK_BLOCKS_PER_PAGE (PAGE_SIZE / RAMDISK_BLOCK_SIZE)
+
+typedef struct {
+    uint8_t *image;                    // Contiguous storage, or NULL for the page vector
+    uint8_t *pages[RAMDISK_MAX_PAGES];
+    uint64_t block_count;
+    block_queue_stats_t stats;
+} ramdisk_data_t;
+
+static device_t ramdisk_devices[RAMDISK_MAX_DEVICES];
+static ramdisk_data_t ramdisk_data[RAMDISK_MAX_DEVICES];
+static int ramdisk_count = 0;
+
+static uint8_t *ramdisk_block(ramdisk_data_t *data, uint64_t block)
+{
+    if (data->image) {
+        return data->image + block * RAMDISK_BLOCK_SIZE;
+    }
+
+    return data->pages[block / RAMDISK_BLOCKS_PER_PAGE] + (block % RAMDISK_BLOCKS_PER_PAGE) * RAMDISK_BLOCK_SIZE;
+}
+
+static arch_result ramdisk_open(device_t *dev)
+{
+    return ARCH_OK;
+}
+
+static arch_result ramdisk_close(device_t *dev)
+{
+    return bcache_sync(dev);
+}
+
+static bool ramdisk_valid(ramdisk_data_t *data, const void *buf, uint64_t start_block, uint32_t block_count)
+{
+    return buf && block_count > 0 && start_block < data->block_count &&
+           start_block + block_count <= data->block_count;
+}
+
+static int ramdisk_read_blocks(device_t *dev, void *buf, uint64_t start_block, uint32_t block_count)
+{
+    if (!ramdisk_valid(dev->driver_data, buf, start_block, block_count)) {
+        return -1;
+    }
+
+    return bcache_read(dev, buf, start_block, block_count);
+}
+
+static int ramdisk_write_blocks(device_t *dev, const void *buf, uint64_t start_block, uint32_t block_count)
+{
+    if (!ramdisk_valid(dev->driver_data, buf, start_block, block_count)) {
+        return -1;
+    }
+
+    return bcache_write(dev, buf, start_block, block_count);
+}
+
+// Memory is as durable as it gets once the cache has written back
+static arch_result ramdisk_sync(device_t *dev)
+{
+    return bcache_sync(dev);
+}
+
+static uint32_t ramdisk_get_block_size(device_t *dev)
+{
+    return RAMDISK_BLOCK_SIZE;
+}
+
+static uint64_t ramdisk_get_block_count(device_t *dev)
+{
+    ramdisk_data_t *data = (ramdisk_data_t *)dev->driver_data;
+    return data->block_count;
+}
+
+static void *ramdisk_map_block(device_t *dev, uint64_t block)
+{
+    ramdisk_data_t *data = (ramdisk_data_t *)dev->driver_data;
+
+    return block < data->block_count ? ramdisk_block(data, block) : NULL;
+}
+
+static int ramdisk_submit_bio(device_t *dev, bio_t *bio)
+{
+    ramdisk_data_t *data = (ramdisk_data_t *)dev->driver_data;
+
+    if (bio->op == BIO_FLUSH) {
+        if (bio->block_count != 0) {
+            return -1;
+        }
+    } else if (!ramdisk_valid(data, bio->buffer, bio->start_block, bio->block_count)) {
+        return -1;
+    }
+
+    bio->status = 0;
+    bio->submit_ns = arch_time_ns();
+
+    uint64_t state = arch_interrupt_save();
+    block_queue_stats_t *stats = &data->stats;
+
+    stats->submitted++;
+    stats->dispatched++;
+    stats->max_depth = 1;
+    stats->depth_histogram[0]++;
+    if (bio->op == BIO_FLUSH || (bio->flags & BIO_PREFLUSH)) {
+        stats->flushes++;
+    }
+    if (bio->flags & BIO_BARRIER) {
+        stats->barriers++;
+    }
+
+    // Copy a page's worth of blocks at a time; the vector is only contiguous within a page
+    uint8_t *buffer = bio->buffer;
+    uint64_t block = bio->start_block;
+    uint32_t left = bio->op == BIO_FLUSH ? 0 : bio->block_count;
+
+    while (left > 0) {
+        uint32_t run = RAMDISK_BLOCKS_PER_PAGE - block % RAMDISK_BLOCKS_PER_PAGE;
+        if (data->image || run > left) {
+            run = left;
+        }
+
+        uint64_t bytes = (uint64_t)run * RAMDISK_BLOCK_SIZE;
+        if (bio->op == BIO_WRITE) {
+            arch_memory_copy(ramdisk_block(data, block), buffer, bytes);
+        } else {
+            arch_memory_copy(buffer, ramdisk_block(data, block), bytes);
+        }
+
+        buffer += bytes;
+        block += run;
+        left -= run;
+    }
+
+    uint64_t latency_us = (arch_time_ns() - bio->submit_ns) / 1000;
+    int bucket = 0;
+    while (bucket < BLOCK_LATENCY_BUCKETS - 1 && latency_us >= (1UL << bucket)) {
+        bucket++;
+    }
+    stats->latency_histogram[bucket]++;
+    stats->completed++;
+
+    if (bio->end_io) {
+        bio->end_io(bio);
+    }
+
+    arch_interrupt_restore(state);
+
+    return 0;
+}
+
+static const block_queue_stats_t *ramdisk_get_stats(device_t *dev)
+{
+    ramdisk_data_t *data = (ramdisk_data_t *)dev->driver_data;
+    return &data->stats;
+}
+
+// Return the first count pages of the disk to the page allocator
+static void ramdisk_free_pages(ramdisk_data_t *data, uint32_t count)
+{
+    while (count-- > 0) {
+        arch_memory_deallocate_page((void *)physical_address(data->pages[count]));
+        data->pages[count] = NULL;
+    }
+}
+
+static device_t *ramdisk_register(ramdisk_data_t *data)
+{
+    device_t *device = &ramdisk_devices[ramdisk_count];
+
+    strncpy(device->name, "ram0", sizeof(device->name));
+    device->name[3] += ramdisk_count;
+    device->class = DEVICE_CLASS_BLOCK;
+    device->state = DEVICE_STATE_UNINITIALIZED;
+    device->open = ramdisk_open;
+    device->close = ramdisk_close;
+    device->block_ops.read_blocks = ramdisk_read_blocks;
+    device->block_ops.write_blocks = ramdisk_write_blocks;
+    device->block_ops.sync = ramdisk_sync;
+    device->block_ops.get_block_size = ramdisk_get_block_size;
+    device->block_ops.get_block_count = ramdisk_get_block_count;
+    device->block_ops.submit_bio = ramdisk_submit_bio;
+    device->block_ops.get_stats = ramdisk_get_stats;
+    device->block_ops.map_block = ramdisk_map_block;
+    device->driver_data = data;
+
+    if (bcache_init() != ARCH_OK || device_register(device) != ARCH_OK) {
+        return NULL;
+    }
+
+    ramdisk_count++;
+
+    return device;
+}
+
+device_t *ramdisk_create(uint32_t pages)
+{
+    if (ramdisk_count >= RAMDISK_MAX_DEVICES || pages == 0 || pages > RAMDISK_MAX_PAGES) {
+        return NULL;
+    }
+
+    ramdisk_data_t *data = &ramdisk_data[ramdisk_count];
+    arch_memory_zero_struct(data);
+
+    for (uint32_t i = 0; i < pages; i++) {
+        void *page = arch_memory_allocate_page();
+
+        if (!page) {
+            ramdisk_free_pages(data, i);
+            return NULL;
+        }
+
+        data->pages[i] = virtual_address(page);
+        arch_memory_zero(data->pages[i], PAGE_SIZE);
+    }
+
+    data->block_count = (uint64_t)pages * RAMDISK_BLOCKS_PER_PAGE;
+
+    device_t *device = ramdisk_register(data);
+    if (!device) {
+        ramdisk_free_pages(data, pages);
+    }
+
+    return device;
+}
+
+device_t *ramdisk_create_image(void *image, uint64_t size)
+{
+    if (ramdisk_count >= RAMDISK_MAX_DEVICES || !image || size < RAMDISK_BLOCK_SIZE) {
+        return NULL;
+    }
+
+    ramdisk_data_t *data = &ramdisk_data[ramdisk_count];
+    arch_memory_zero_struct(data);
+
+    data->image = image;
+    data->block_count = size / RAMDISK_BLOCK_SIZE;
+
+    return ramdisk_register(data);
+}
+
+arch_result ramdisk_driver_init(void)
+{
+    return ramdisk_create(RAMDISK_DEFAULT_PAGES) ? ARCH_OK : ARCH_ERROR;
+}
@@ -114,7 +114,6 @@ arch_result audio_driver_init(void)
         device->char_ops.write = audio_write;
         device->char_ops.flush = NULL;  // No flushing needed
         device->driver_data = data;
-        device->next = NULL;
         
         data->arch_device = info.device;
         data->is_playing = false;
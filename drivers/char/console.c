@@ -166,7 +166,6 @@ arch_result console_driver_init(void)
     console_device.char_ops.write = console_write;
     console_device.char_ops.flush = console_flush;
     console_device.driver_data = &console_data;
-    console_device.next = NULL;
     
     console_data.display_device = NULL;
     console_data.width = 0;
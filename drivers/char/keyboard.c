@@ -2,6 +2,7 @@
 #include "arch/arch.h"
 #include "lib/string.h"
 #include "lib/unicode.h"
+#include "kernel/trace.h"
 
 static arch_result keyboard_open(device_t *dev);
 static arch_result keyboard_close(device_t *dev);
@@ -120,6 +121,8 @@ static void keyboard_interrupt_callback(arch_keyboard_device_t *arch_device)
     arch_keyboard_event_t event;
     while (arch_keyboard_has_event(arch_device)) {
         if (arch_keyboard_read_event(arch_device, &event) == ARCH_OK) {
+            trace_event(TRACE_KEYBOARD, event.unicode, event.key | ((uint64_t)event.pressed << 16));
+
             if (event.pressed && event.unicode != 0 && unicode_is_printable(event.unicode)) {
                 char utf8_buf[4];
                 int utf8_len = unicode_to_utf8(event.unicode, utf8_buf);
@@ -137,6 +140,11 @@ static int keyboard_write(device_t *dev, const void *buf, size_t len)
     return -1;
 }
 
+void keyboard_driver_start(void)
+{
+    arch_keyboard_start();
+}
+
 arch_result keyboard_driver_init(void)
 {
     keyboard_device_count = arch_keyboard_get_count();
@@ -178,7 +186,6 @@ arch_result keyboard_driver_init(void)
         device->char_ops.write = keyboard_write;
         device->char_ops.flush = NULL;  // No flushing needed
         device->driver_data = data;
-        device->next = NULL;
         
         data->arch_device = info.device;
         data->input_buffer.head = 0;
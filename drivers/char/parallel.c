@@ -78,7 +78,6 @@ arch_result parallel_driver_init(void)
         device->char_ops.write = parallel_write;
         device->char_ops.flush = NULL;
         device->driver_data = data;
-        device->next = NULL;
         
         data->arch_device = info.device;
         
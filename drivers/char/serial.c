@@ -92,7 +92,6 @@ arch_result serial_driver_init(void)
         device->char_ops.write = serial_write;
         device->char_ops.flush = serial_flush;
         device->driver_data = data;
-        device->next = NULL;
         
         data->arch_device = info.device;
         
@@ -139,7 +139,6 @@ arch_result display_driver_init(void)
         device->display_ops.clear_screen = display_clear_screen;
         device->display_ops.scroll_up = display_scroll_up;
         device->driver_data = data;
-        device->next = NULL;
         
         data->arch_device = info.device;
         data->width = info.width;
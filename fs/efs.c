@@ -0,0 +1,754 @@
+#include "fs/efs.h"
+#include "arch/x86_64/memory.h"
+#include "fs/pagecache.h"
+#include "lib/string.h"
+
+/* Extent file system
+ *
+ * Inodes and name lookups are cached in small static pools shared by every
+ * mount. Each pool is hashed for lookup and recycles its least recently
+ * used entry that nothing holds. Lookups that find nothing are cached too,
+ * so a path that is probed again does not rescan its directory.
+ *
+ * File contents live in the page cache only: pages are filled with bios
+ * straight from the device, around the block cache, which is left to the
+ * superblock, inodes and directories.
+ */
+
+#define EFS_DIRENT_BATCH 8           // Directory entries read per request while scanning
+
+struct efs {
+    device_t *dev;                   // NULL while the mount is free
+    uint32_t block_size;
+    uint32_t device_blocks;          // Device blocks per file system block
+    uint64_t block_count;
+    uint32_t inode_count;
+    uint32_t inode_table;
+    uint32_t root;
+    journal_t *journal;              // NULL for a read-only image
+    uint8_t buffer[EFS_BLOCK_MAX];   // Superblock, inode and partial block reads
+};
+
+struct efs_inode {
+    efs_t *fs;                       // NULL while the slot is free
+    uint32_t number;
+    uint32_t refs;
+    uint64_t used;                   // Clock at the last lookup, for eviction
+    efs_disk_inode_t disk;
+    pagecache_mapping_t cache;       // File contents
+    struct efs_inode *hash_next;
+};
+
+typedef struct efs_dentry {
+    efs_t *fs;                       // NULL while the slot is free
+    uint32_t parent;
+    uint32_t inode;                  // 0 if the name does not exist
+    uint64_t used;
+    uint8_t name_length;
+    char name[EFS_NAME_MAX];
+    struct efs_dentry *hash_next;
+} efs_dentry_t;
+
+static efs_t efs_mounts[EFS_MOUNTS];
+static efs_inode_t efs_inodes[EFS_INODE_CACHE];
+static efs_inode_t *efs_inode_hash[EFS_INODE_HASH];
+static efs_dentry_t efs_dentries[EFS_DENTRY_CACHE];
+static efs_dentry_t *efs_dentry_hash[EFS_DENTRY_HASH];
+static efs_stats_t efs_stats;
+static uint64_t efs_clock = 0;
+
+static uint32_t efs_inode_bucket(efs_t *fs, uint32_t number)
+{
+    return ((uint32_t)(fs - efs_mounts) * 7 + number) % EFS_INODE_HASH;
+}
+
+// FNV-1a over the parent inode and the name
+static uint32_t efs_dentry_bucket(efs_t *fs, uint32_t parent, const char *name, uint32_t length)
+{
+    uint32_t hash = 2166136261u ^ (uint32_t)(fs - efs_mounts);
+
+    hash = (hash ^ parent) * 16777619u;
+    for (uint32_t i = 0; i < length; i++) {
+        hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+    }
+
+    return hash % EFS_DENTRY_HASH;
+}
+
+// Read whole file system blocks as one request to the device, with changes still in the journal
+static int efs_read_blocks(efs_t *fs, void *buf, uint64_t block, uint32_t count)
+{
+    efs_stats.requests++;
+    efs_stats.blocks += count;
+
+    int result = fs->dev->block_ops.read_blocks(fs->dev, buf, block * fs->device_blocks,
+                                                count * fs->device_blocks);
+    if (result < 0) {
+        return -1;
+    }
+
+    if (fs->journal) {
+        journal_read(fs->journal, buf, block, count);
+    }
+
+    return 0;
+}
+
+/* Find the block holding a block of a file
+ *
+ * @param run: Set to the blocks left in the extent from there
+ * @return: The block, or 0 past the last extent
+ */
+static uint64_t efs_map(const efs_inode_t *inode, uint64_t file_block, uint32_t *run)
+{
+    for (uint32_t i = 0; i < inode->disk.extent_count; i++) {
+        const efs_extent_t *extent = &inode->disk.extents[i];
+
+        if (file_block < extent->count) {
+            *run = extent->count - file_block;
+            return extent->start + file_block;
+        }
+        file_block -= extent->count;
+    }
+
+    return 0;
+}
+
+// Fill a page cache page of a file, one request per contiguous run of blocks
+static arch_result efs_fill_page(pagecache_mapping_t *mapping, uint64_t index, void *page)
+{
+    efs_inode_t *inode = (efs_inode_t *)mapping->owner;
+    efs_t *fs = inode->fs;
+    uint64_t offset = index * PAGE_SIZE;
+    uint32_t bytes = inode->disk.size - offset < PAGE_SIZE ? inode->disk.size - offset : PAGE_SIZE;
+    uint32_t blocks = (bytes + fs->block_size - 1) / fs->block_size;
+    uint64_t file_block = offset / fs->block_size;
+
+    for (uint32_t done = 0; done < blocks;) {
+        uint32_t run = 0;
+        uint64_t block = efs_map(inode, file_block + done, &run);
+        if (block == 0) {
+            return ARCH_ERROR;
+        }
+        if (run > blocks - done) {
+            run = blocks - done;
+        }
+
+        bio_t bio = {
+            .op = BIO_READ,
+            .start_block = block * fs->device_blocks,
+            .block_count = run * fs->device_blocks,
+            .buffer = (uint8_t *)page + done * fs->block_size,
+        };
+
+        efs_stats.requests++;
+        efs_stats.blocks += run;
+        if (submit_bio_wait(fs->dev, &bio) != 0) {
+            return ARCH_ERROR;
+        }
+        done += run;
+    }
+
+    arch_memory_zero((uint8_t *)page + bytes, PAGE_SIZE - bytes);
+
+    return ARCH_OK;
+}
+
+static bool efs_inode_valid(efs_t *fs, const efs_disk_inode_t *disk)
+{
+    if (disk->type != EFS_TYPE_FILE && disk->type != EFS_TYPE_DIR) {
+        return false;
+    }
+    if (disk->extent_count > EFS_EXTENTS) {
+        return false;
+    }
+    if (disk->type == EFS_TYPE_DIR && disk->size % EFS_DIRENT_SIZE != 0) {
+        return false;
+    }
+
+    uint64_t blocks = 0;
+    for (uint32_t i = 0; i < disk->extent_count; i++) {
+        const efs_extent_t *extent = &disk->extents[i];
+
+        if (extent->start == 0 || extent->count == 0 ||
+            (uint64_t)extent->start + extent->count > fs->block_count) {
+            return false;
+        }
+        blocks += extent->count;
+    }
+
+    return disk->size <= blocks * fs->block_size;
+}
+
+static void efs_inode_unhash(efs_inode_t *inode)
+{
+    efs_inode_t **link = &efs_inode_hash[efs_inode_bucket(inode->fs, inode->number)];
+
+    while (*link && *link != inode) {
+        link = &(*link)->hash_next;
+    }
+    if (*link) {
+        *link = inode->hash_next;
+    }
+
+    inode->fs = NULL;
+    inode->hash_next = NULL;
+}
+
+/* Find an inode in the cache or read it from the inode table
+ *
+ * @return: The inode with a reference held, or NULL
+ */
+static efs_inode_t *efs_iget(efs_t *fs, uint32_t number)
+{
+    if (number == 0 || number >= fs->inode_count) {
+        return NULL;
+    }
+
+    uint32_t bucket = efs_inode_bucket(fs, number);
+
+    for (efs_inode_t *inode = efs_inode_hash[bucket]; inode; inode = inode->hash_next) {
+        if (inode->fs == fs && inode->number == number) {
+            efs_stats.inode_hits++;
+            inode->refs++;
+            inode->used = ++efs_clock;
+            return inode;
+        }
+    }
+
+    // A free slot, or else the least recently used one that is not held
+    efs_inode_t *victim = NULL;
+    for (int i = 0; i < EFS_INODE_CACHE; i++) {
+        efs_inode_t *inode = &efs_inodes[i];
+
+        if (!inode->fs) {
+            victim = inode;
+            break;
+        }
+        if (inode->refs == 0 && (!victim || inode->used < victim->used)) {
+            victim = inode;
+        }
+    }
+
+    if (!victim) {
+        return NULL;
+    }
+
+    uint64_t offset = (uint64_t)number * EFS_INODE_SIZE;
+    if (efs_read_blocks(fs, fs->buffer, fs->inode_table + offset / fs->block_size, 1) < 0) {
+        return NULL;
+    }
+
+    efs_disk_inode_t disk;
+    arch_memory_copy(&disk, fs->buffer + offset % fs->block_size, sizeof(disk));
+    if (!efs_inode_valid(fs, &disk)) {
+        return NULL;
+    }
+
+    efs_stats.inode_misses++;
+
+    // Nothing holds the victim, so none of its pages are mapped
+    if (victim->fs) {
+        pagecache_truncate(&victim->cache);
+        efs_inode_unhash(victim);
+    }
+
+    pagecache_mapping_init(&victim->cache, efs_fill_page, victim);
+    victim->fs = fs;
+    victim->number = number;
+    victim->refs = 1;
+    victim->used = ++efs_clock;
+    victim->disk = disk;
+    victim->hash_next = efs_inode_hash[bucket];
+    efs_inode_hash[bucket] = victim;
+
+    return victim;
+}
+
+static void efs_dentry_unhash(efs_dentry_t *dentry)
+{
+    efs_dentry_t **link = &efs_dentry_hash[efs_dentry_bucket(dentry->fs, dentry->parent, dentry->name,
+                                                             dentry->name_length)];
+
+    while (*link && *link != dentry) {
+        link = &(*link)->hash_next;
+    }
+    if (*link) {
+        *link = dentry->hash_next;
+    }
+
+    dentry->fs = NULL;
+    dentry->hash_next = NULL;
+}
+
+static void efs_dentry_forget(efs_t *fs, uint32_t parent, const char *name, uint32_t length)
+{
+    efs_dentry_t *dentry = efs_dentry_hash[efs_dentry_bucket(fs, parent, name, length)];
+
+    for (; dentry; dentry = dentry->hash_next) {
+        if (dentry->fs == fs && dentry->parent == parent && dentry->name_length == length &&
+            memcmp(dentry->name, name, length) == 0) {
+            efs_dentry_unhash(dentry);
+            return;
+        }
+    }
+}
+
+static void efs_dentry_add(efs_t *fs, uint32_t parent, const char *name, uint32_t length, uint32_t inode)
+{
+    efs_dentry_t *victim = NULL;
+
+    for (int i = 0; i < EFS_DENTRY_CACHE; i++) {
+        efs_dentry_t *dentry = &efs_dentries[i];
+
+        if (!dentry->fs) {
+            victim = dentry;
+            break;
+        }
+        if (!victim || dentry->used < victim->used) {
+            victim = dentry;
+        }
+    }
+
+    if (victim->fs) {
+        efs_dentry_unhash(victim);
+    }
+
+    uint32_t bucket = efs_dentry_bucket(fs, parent, name, length);
+
+    victim->fs = fs;
+    victim->parent = parent;
+    victim->inode = inode;
+    victim->used = ++efs_clock;
+    victim->name_length = length;
+    arch_memory_copy(victim->name, name, length);
+    victim->hash_next = efs_dentry_hash[bucket];
+    efs_dentry_hash[bucket] = victim;
+}
+
+/* Scan a directory for a name
+ *
+ * @param slot: Set to the entry's index when found
+ * @return: The inode number, 0 if the name does not exist, -1 on error
+ */
+static int64_t efs_scan(efs_inode_t *dir, const char *name, uint32_t length, uint64_t *slot)
+{
+    efs_disk_dirent_t entries[EFS_DIRENT_BATCH];
+    uint64_t count = dir->disk.size / EFS_DIRENT_SIZE;
+
+    for (uint64_t index = 0; index < count; index += EFS_DIRENT_BATCH) {
+        int bytes = efs_read(dir, entries, index * EFS_DIRENT_SIZE, sizeof(entries));
+        if (bytes <= 0) {
+            return -1;
+        }
+
+        for (int i = 0; i < bytes / EFS_DIRENT_SIZE; i++) {
+            if (entries[i].inode != 0 && entries[i].name_length == length &&
+                memcmp(entries[i].name, name, length) == 0) {
+                *slot = index + i;
+                return entries[i].inode;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/* Resolve one name in a directory
+ *
+ * @return: The inode number, 0 if the name does not exist, -1 on error
+ */
+static int64_t efs_lookup(efs_inode_t *dir, const char *name, uint32_t length)
+{
+    efs_t *fs = dir->fs;
+    uint32_t bucket = efs_dentry_bucket(fs, dir->number, name, length);
+
+    for (efs_dentry_t *dentry = efs_dentry_hash[bucket]; dentry; dentry = dentry->hash_next) {
+        if (dentry->fs == fs && dentry->parent == dir->number && dentry->name_length == length &&
+            memcmp(dentry->name, name, length) == 0) {
+            efs_stats.dentry_hits++;
+            dentry->used = ++efs_clock;
+            return dentry->inode;
+        }
+    }
+
+    efs_stats.dentry_misses++;
+
+    uint64_t slot;
+    int64_t found = efs_scan(dir, name, length, &slot);
+    if (found >= 0) {
+        efs_dentry_add(fs, dir->number, name, length, found);
+    }
+
+    return found;
+}
+
+efs_t *efs_mount(device_t *dev)
+{
+    if (!dev || dev->class != DEVICE_CLASS_BLOCK || !dev->block_ops.read_blocks) {
+        return NULL;
+    }
+
+    efs_t *fs = NULL;
+    for (int i = 0; i < EFS_MOUNTS; i++) {
+        if (!efs_mounts[i].dev) {
+            fs = &efs_mounts[i];
+            break;
+        }
+    }
+
+    uint32_t device_block_size = dev->block_ops.get_block_size(dev);
+    uint64_t device_block_count = dev->block_ops.get_block_count(dev);
+
+    if (!fs || device_block_size < sizeof(efs_super_t) || device_block_size > EFS_BLOCK_MAX) {
+        return NULL;
+    }
+
+    if (dev->block_ops.read_blocks(dev, fs->buffer, 0, 1) < 0) {
+        return NULL;
+    }
+
+    efs_super_t super;
+    arch_memory_copy(&super, fs->buffer, sizeof(super));
+
+    if (super.magic != EFS_MAGIC || super.block_size < 512 || super.block_size > EFS_BLOCK_MAX ||
+        (super.block_size & (super.block_size - 1)) != 0 || super.block_size % device_block_size != 0) {
+        return NULL;
+    }
+
+    uint32_t device_blocks = super.block_size / device_block_size;
+    uint64_t table_blocks = ((uint64_t)super.inode_count * EFS_INODE_SIZE + super.block_size - 1) /
+                            super.block_size;
+
+    if (super.block_count == 0 || super.block_count > device_block_count / device_blocks ||
+        super.inode_table == 0 || super.inode_table + table_blocks > super.block_count) {
+        return NULL;
+    }
+
+    fs->dev = dev;
+    fs->block_size = super.block_size;
+    fs->device_blocks = device_blocks;
+    fs->block_count = super.block_count;
+    fs->inode_count = super.inode_count;
+    fs->inode_table = super.inode_table;
+    fs->root = super.root;
+    fs->journal = NULL;
+
+    // The journal replays whatever a crash left in it before anything is read
+    if (super.journal_blocks > 0) {
+        if (super.journal_start <= super.inode_table ||
+            (uint64_t)super.journal_start + super.journal_blocks > super.block_count) {
+            fs->dev = NULL;
+            return NULL;
+        }
+
+        fs->journal = journal_open(dev, fs->block_size, super.journal_start, super.journal_blocks);
+        if (!fs->journal) {
+            fs->dev = NULL;
+            return NULL;
+        }
+    }
+
+    efs_inode_t *root = efs_iget(fs, fs->root);
+    if (!root || root->disk.type != EFS_TYPE_DIR) {
+        if (root) {
+            efs_close(root);
+        }
+        efs_unmount(fs);
+        return NULL;
+    }
+
+    efs_close(root);
+
+    return fs;
+}
+
+arch_result efs_unmount(efs_t *fs)
+{
+    if (!fs || !fs->dev) {
+        return ARCH_INVALID;
+    }
+
+    for (int i = 0; i < EFS_INODE_CACHE; i++) {
+        if (efs_inodes[i].fs == fs && efs_inodes[i].refs > 0) {
+            return ARCH_ERROR;
+        }
+    }
+
+    for (int i = 0; i < EFS_INODE_CACHE; i++) {
+        if (efs_inodes[i].fs == fs) {
+            pagecache_truncate(&efs_inodes[i].cache);
+            efs_inode_unhash(&efs_inodes[i]);
+        }
+    }
+
+    for (int i = 0; i < EFS_DENTRY_CACHE; i++) {
+        if (efs_dentries[i].fs == fs) {
+            efs_dentry_unhash(&efs_dentries[i]);
+        }
+    }
+
+    arch_result result = ARCH_OK;
+    if (fs->journal) {
+        result = journal_close(fs->journal);
+        fs->journal = NULL;
+    }
+
+    fs->dev = NULL;
+
+    return result;
+}
+
+efs_inode_t *efs_open(efs_t *fs, const char *path)
+{
+    if (!fs || !fs->dev || !path) {
+        return NULL;
+    }
+
+    efs_inode_t *inode = efs_iget(fs, fs->root);
+
+    while (inode) {
+        while (*path == '/') {
+            path++;
+        }
+        if (*path == '\0') {
+            return inode;
+        }
+
+        uint32_t length = 0;
+        while (path[length] != '\0' && path[length] != '/') {
+            length++;
+        }
+
+        int64_t number = -1;
+        if (inode->disk.type == EFS_TYPE_DIR && length <= EFS_NAME_MAX) {
+            number = efs_lookup(inode, path, length);
+        }
+
+        efs_close(inode);
+        inode = number > 0 ? efs_iget(fs, number) : NULL;
+        path += length;
+    }
+
+    return NULL;
+}
+
+void efs_close(efs_inode_t *inode)
+{
+    if (inode && inode->refs > 0) {
+        inode->refs--;
+    }
+}
+
+void efs_stat(const efs_inode_t *inode, efs_stat_t *stat)
+{
+    stat->type = inode->disk.type;
+    stat->size = inode->disk.size;
+    stat->extent_count = inode->disk.extent_count;
+}
+
+int efs_read(efs_inode_t *inode, void *buf, uint64_t offset, uint32_t length)
+{
+    if (!inode || !inode->fs || !buf) {
+        return -1;
+    }
+
+    efs_t *fs = inode->fs;
+    uint64_t size = inode->disk.size;
+
+    if (offset >= size) {
+        return 0;
+    }
+    if (length > size - offset) {
+        length = size - offset;
+    }
+    if (length > 0x7FFFFFFF) {
+        length = 0x7FFFFFFF;
+    }
+
+    if (inode->disk.type == EFS_TYPE_FILE) {
+        return pagecache_read(&inode->cache, buf, offset, length, size);
+    }
+
+    uint8_t *out = buf;
+    uint32_t done = 0;
+
+    while (done < length) {
+        uint64_t position = offset + done;
+        uint64_t file_block = position / fs->block_size;
+        uint32_t within = position % fs->block_size;
+
+        uint32_t run = 0;
+        uint64_t block = efs_map(inode, file_block, &run);
+        if (block == 0) {
+            return -1;
+        }
+
+        uint32_t left = length - done;
+
+        if (within == 0 && left >= fs->block_size) {
+            uint32_t count = left / fs->block_size;
+            if (count > run) {
+                count = run;
+            }
+
+            if (efs_read_blocks(fs, out + done, block, count) < 0) {
+                return -1;
+            }
+            done += count * fs->block_size;
+        } else {
+            uint32_t bytes = fs->block_size - within;
+            if (bytes > left) {
+                bytes = left;
+            }
+
+            if (efs_read_blocks(fs, fs->buffer, block, 1) < 0) {
+                return -1;
+            }
+            arch_memory_copy(out + done, fs->buffer + within, bytes);
+            done += bytes;
+        }
+    }
+
+    return done;
+}
+
+int efs_readdir(efs_inode_t *dir, uint32_t index, efs_dirent_t *entry)
+{
+    if (!dir || !entry || dir->disk.type != EFS_TYPE_DIR) {
+        return -1;
+    }
+
+    efs_disk_dirent_t disk;
+    int bytes = efs_read(dir, &disk, (uint64_t)index * EFS_DIRENT_SIZE, sizeof(disk));
+
+    if (bytes == 0) {
+        return 0;
+    }
+    if (bytes != sizeof(disk) || disk.name_length > EFS_NAME_MAX) {
+        return -1;
+    }
+
+    entry->inode = disk.inode;
+    entry->type = disk.type;
+    arch_memory_copy(entry->name, disk.name, disk.name_length);
+    entry->name[disk.name_length] = '\0';
+
+    return 1;
+}
+
+const void *efs_mmap(efs_inode_t *inode)
+{
+    if (!inode || !inode->fs || inode->disk.type != EFS_TYPE_FILE || inode->disk.size == 0 ||
+        inode->disk.size > (uint64_t)PAGECACHE_PAGES * PAGE_SIZE) {
+        return NULL;
+    }
+
+    const void *address = pagecache_map(&inode->cache, 0, (inode->disk.size + PAGE_SIZE - 1) / PAGE_SIZE);
+
+    // The mapping holds the inode, so its pages stay put until efs_munmap
+    if (address) {
+        inode->refs++;
+    }
+
+    return address;
+}
+
+void efs_munmap(efs_inode_t *inode, const void *address)
+{
+    if (inode && pagecache_unmap(address) == ARCH_OK) {
+        efs_close(inode);
+    }
+}
+
+// A name an entry can be given: not empty, "." or "..", and without a '/'
+static bool efs_name_valid(const char *name, uint32_t *length)
+{
+    *length = strnlen(name, EFS_NAME_MAX + 1);
+
+    if (*length == 0 || *length > EFS_NAME_MAX || memchr(name, '/', *length) ||
+        strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+        return false;
+    }
+
+    return true;
+}
+
+arch_result efs_rename(efs_t *fs, const char *dir, const char *from, const char *to)
+{
+    uint32_t from_length, to_length;
+
+    if (!fs || !fs->dev || !dir || !from || !to) {
+        return ARCH_INVALID;
+    }
+    if (!fs->journal) {
+        return ARCH_UNSUPPORTED;
+    }
+    if (!efs_name_valid(from, &from_length) || !efs_name_valid(to, &to_length)) {
+        return ARCH_INVALID;
+    }
+
+    efs_inode_t *parent = efs_open(fs, dir);
+    if (!parent || parent->disk.type != EFS_TYPE_DIR) {
+        efs_close(parent);
+        return ARCH_INVALID;
+    }
+
+    uint64_t slot;
+    int64_t number = efs_scan(parent, from, from_length, &slot);
+    uint64_t unused;
+
+    if (number <= 0 || efs_scan(parent, to, to_length, &unused) != 0) {
+        efs_close(parent);
+        return ARCH_ERROR;
+    }
+
+    uint64_t offset = slot * EFS_DIRENT_SIZE;
+    uint32_t run;
+    uint64_t block = efs_map(parent, offset / fs->block_size, &run);
+    arch_result result = journal_start(fs->journal, 1);
+
+    if (result == ARCH_OK) {
+        uint8_t *data = block ? journal_get_block(fs->journal, block) : NULL;
+
+        if (data) {
+            efs_disk_dirent_t *entry = (efs_disk_dirent_t *)(data + offset % fs->block_size);
+
+            arch_memory_zero(entry->name, sizeof(entry->name));
+            arch_memory_copy(entry->name, to, to_length);
+            entry->name_length = to_length;
+        } else {
+            result = ARCH_ERROR;
+        }
+
+        arch_result stopped = journal_stop(fs->journal);
+        if (result == ARCH_OK) {
+            result = stopped;
+        }
+    }
+
+    efs_dentry_forget(fs, parent->number, from, from_length);
+    efs_dentry_forget(fs, parent->number, to, to_length);
+    efs_close(parent);
+
+    return result;
+}
+
+arch_result efs_sync(efs_t *fs)
+{
+    if (!fs || !fs->dev) {
+        return ARCH_INVALID;
+    }
+
+    return fs->journal ? journal_sync(fs->journal) : ARCH_OK;
+}
+
+journal_t *efs_get_journal(efs_t *fs)
+{
+    return fs ? fs->journal : NULL;
+}
+
+const efs_stats_t *efs_get_stats(void)
+{
+    return &efs_stats;
+}
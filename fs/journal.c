@@ -0,0 +1,617 @@
+#include "fs/journal.h"
+#include "arch/x86_64/memory.h"
+#include "lib/string.h"
+
+/* Block journal
+ *
+ * Every block an operation changes is copied into a buffer of the running
+ * transaction, and later changes to it are absorbed there. A commit hands
+ * the descriptor and the copies to the device at once and orders the
+ * commit block behind them. Once it completes the copies are logged: they
+ * stay in memory, overriding reads of their home blocks, until the next
+ * journal call checkpoints them into the device's block cache.
+ *
+ * The superblock is only rewritten when the log wraps, after every
+ * checkpointed block has been synced. Recovery replays transactions from
+ * the head for as long as their sequence numbers follow on and their
+ * checksums match, so stale ones left further along the log are ignored.
+ */
+
+typedef enum {
+    JOURNAL_BUFFER_FREE = 0,
+    JOURNAL_BUFFER_RUNNING,          // Part of the running transaction
+    JOURNAL_BUFFER_COMMITTING,       // Being written to the log
+    JOURNAL_BUFFER_LOGGED            // Durable in the log, not checkpointed yet
+} journal_buffer_state_t;
+
+typedef struct {
+    journal_buffer_state_t state;
+    uint64_t block;                  // Home block
+    uint64_t sequence;               // Transaction the copy belongs to
+    uint8_t *data;
+} journal_buffer_t;
+
+struct journal {
+    device_t *dev;                   // NULL while the journal is free
+    uint32_t block_size;
+    uint32_t device_blocks;          // Device blocks per journal block
+    uint64_t start;
+    uint32_t length;
+    uint32_t tail;                   // Where the next transaction goes in the log
+    uint64_t sequence;               // Of the running transaction
+    uint32_t handles;                // Operations between journal_start and journal_stop
+    uint32_t reserved;               // Blocks those operations may still add
+    uint32_t running;                // Blocks in the running transaction
+    uint64_t running_ns;             // When the running transaction got its first block
+    volatile uint32_t commit_pending; // Bios of the committing transaction in flight
+    volatile bool failed;            // A log write failed; the journal takes no more changes
+    journal_buffer_t buffers[JOURNAL_BUFFERS];
+    uint8_t *descriptor;             // Descriptor of the committing transaction
+    uint8_t *commit;                 // Its commit block, also used for the superblock
+    bio_t bios[JOURNAL_TRANSACTION_MAX + 2];
+    journal_stats_t stats;
+};
+
+static journal_t journals[JOURNAL_MAX];
+static bool journal_timer_ready = false;
+
+// FNV-1a, continued from hash
+static uint32_t journal_checksum(uint32_t hash, const uint8_t *data, uint32_t size)
+{
+    for (uint32_t i = 0; i < size; i++) {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+
+    return hash;
+}
+
+static void journal_log_bio(journal_t *journal, bio_t *bio, bio_op_t op, uint32_t flags, void *buf, uint32_t position)
+{
+    arch_memory_zero_struct(bio);
+    bio->op = op;
+    bio->flags = flags;
+    bio->start_block = (journal->start + position) * journal->device_blocks;
+    bio->block_count = journal->device_blocks;
+    bio->buffer = buf;
+    bio->private = journal;
+}
+
+// Read or write one block of the log, bypassing the block cache
+static arch_result journal_log_io(journal_t *journal, bio_op_t op, uint32_t flags, void *buf, uint32_t position)
+{
+    bio_t bio;
+
+    journal_log_bio(journal, &bio, op, flags, buf, position);
+
+    return submit_bio_wait(journal->dev, &bio) == 0 ? ARCH_OK : ARCH_ERROR;
+}
+
+// The copy of a block that reads should see: the one from the latest transaction
+static journal_buffer_t *journal_find(journal_t *journal, uint64_t block)
+{
+    journal_buffer_t *newest = NULL;
+
+    for (int i = 0; i < JOURNAL_BUFFERS; i++) {
+        journal_buffer_t *buffer = &journal->buffers[i];
+
+        if (buffer->state != JOURNAL_BUFFER_FREE && buffer->block == block &&
+            (!newest || buffer->sequence > newest->sequence)) {
+            newest = buffer;
+        }
+    }
+
+    return newest;
+}
+
+static void journal_end_io(bio_t *bio)
+{
+    journal_t *journal = (journal_t *)bio->private;
+
+    if (bio->status != 0 && !journal->failed) {
+        journal->failed = true;
+        journal->stats.errors++;
+    }
+
+    if (--journal->commit_pending > 0 || journal->failed) {
+        return;
+    }
+
+    for (int i = 0; i < JOURNAL_BUFFERS; i++) {
+        if (journal->buffers[i].state == JOURNAL_BUFFER_COMMITTING) {
+            journal->buffers[i].state = JOURNAL_BUFFER_LOGGED;
+        }
+    }
+}
+
+static bool journal_fits(journal_t *journal)
+{
+    return journal->tail + journal->running + 2 <= journal->length;
+}
+
+/* Write the running transaction to the log without waiting
+ *
+ * Call with interrupts disabled, no operation open, no commit in flight
+ * and room in the log.
+ */
+static void journal_submit(journal_t *journal)
+{
+    journal_descriptor_t *descriptor = (journal_descriptor_t *)journal->descriptor;
+    journal_buffer_t *copies[JOURNAL_TRANSACTION_MAX];
+    uint32_t count = 0;
+
+    for (int i = 0; i < JOURNAL_BUFFERS; i++) {
+        journal_buffer_t *buffer = &journal->buffers[i];
+        if (buffer->state == JOURNAL_BUFFER_RUNNING) {
+            copies[count++] = buffer;
+        }
+    }
+
+    arch_memory_zero(journal->descriptor, journal->block_size);
+    descriptor->magic = JOURNAL_DESC_MAGIC;
+    descriptor->count = count;
+    descriptor->sequence = journal->sequence;
+    for (uint32_t i = 0; i < count; i++) {
+        descriptor->blocks[i] = copies[i]->block;
+    }
+
+    uint32_t checksum = journal_checksum(2166136261u, journal->descriptor, journal->block_size);
+    for (uint32_t i = 0; i < count; i++) {
+        checksum = journal_checksum(checksum, copies[i]->data, journal->block_size);
+    }
+
+    journal_commit_t *commit = (journal_commit_t *)journal->commit;
+    arch_memory_zero(journal->commit, journal->block_size);
+    commit->magic = JOURNAL_COMMIT_MAGIC;
+    commit->count = count;
+    commit->sequence = journal->sequence;
+    commit->checksum = checksum;
+
+    // The blocks go out together and may land in any order; the commit waits for all of them
+    uint32_t position = journal->tail;
+    journal_log_bio(journal, &journal->bios[0], BIO_WRITE, 0, journal->descriptor, position);
+    for (uint32_t i = 0; i < count; i++) {
+        copies[i]->state = JOURNAL_BUFFER_COMMITTING;
+        journal_log_bio(journal, &journal->bios[i + 1], BIO_WRITE, 0, copies[i]->data, position + 1 + i);
+    }
+    journal_log_bio(journal, &journal->bios[count + 1], BIO_WRITE, BIO_BARRIER | BIO_PREFLUSH | BIO_FUA,
+                    journal->commit, position + 1 + count);
+
+    journal->commit_pending = count + 2;
+    journal->tail += count + 2;
+    journal->sequence++;
+    journal->running = 0;
+    journal->stats.transactions++;
+    journal->stats.blocks += count;
+
+    for (uint32_t i = 0; i < count + 2; i++) {
+        journal->bios[i].end_io = journal_end_io;
+        if (submit_bio(journal->dev, &journal->bios[i]) != 0) {
+            // Rejected bios never complete, so account for them here
+            journal->bios[i].status = -1;
+            journal_end_io(&journal->bios[i]);
+        }
+    }
+}
+
+static void journal_wait(journal_t *journal)
+{
+    while (journal->commit_pending > 0) {
+        arch_interrupt_wait();
+    }
+}
+
+/* Write logged copies to their home blocks, oldest transaction first
+ *
+ * The block cache takes them, so this only copies unless it has to make
+ * room. Call with interrupts disabled and not from interrupt context.
+ */
+static arch_result journal_checkpoint(journal_t *journal)
+{
+    for (;;) {
+        journal_buffer_t *oldest = NULL;
+
+        for (int i = 0; i < JOURNAL_BUFFERS; i++) {
+            journal_buffer_t *buffer = &journal->buffers[i];
+            if (buffer->state == JOURNAL_BUFFER_LOGGED && (!oldest || buffer->sequence < oldest->sequence)) {
+                oldest = buffer;
+            }
+        }
+
+        if (!oldest) {
+            return ARCH_OK;
+        }
+
+        if (journal->dev->block_ops.write_blocks(journal->dev, oldest->data, oldest->block * journal->device_blocks,
+                                                 journal->device_blocks) < 0) {
+            journal->stats.errors++;
+            return ARCH_ERROR;
+        }
+
+        oldest->state = JOURNAL_BUFFER_FREE;
+        journal->stats.checkpoints++;
+    }
+}
+
+// Empty the log: everything it holds must be durable at home before the head moves back
+static arch_result journal_wrap(journal_t *journal)
+{
+    journal_wait(journal);
+
+    if (journal->failed || journal_checkpoint(journal) != ARCH_OK ||
+        journal->dev->block_ops.sync(journal->dev) != ARCH_OK) {
+        return ARCH_ERROR;
+    }
+
+    journal_super_t *super = (journal_super_t *)journal->commit;
+    arch_memory_zero(journal->commit, journal->block_size);
+    super->magic = JOURNAL_MAGIC;
+    super->block_size = journal->block_size;
+    super->length = journal->length;
+    super->head = 1;
+    super->sequence = journal->sequence;
+
+    if (journal_log_io(journal, BIO_WRITE, BIO_FUA, journal->commit, 0) != ARCH_OK) {
+        journal->stats.errors++;
+        return ARCH_ERROR;
+    }
+
+    journal->tail = 1;
+    journal->stats.wraps++;
+
+    return ARCH_OK;
+}
+
+// Commit the running transaction from outside interrupt context, wrapping the log if needed
+static arch_result journal_commit(journal_t *journal)
+{
+    journal_wait(journal);
+
+    if (journal->failed) {
+        return ARCH_ERROR;
+    }
+    if (journal->running == 0) {
+        return ARCH_OK;
+    }
+    if (!journal_fits(journal) && journal_wrap(journal) != ARCH_OK) {
+        return ARCH_ERROR;
+    }
+
+    journal_submit(journal);
+
+    return ARCH_OK;
+}
+
+// Timer callback: commit transactions that have waited long enough
+static void journal_timer(void)
+{
+    uint64_t now = arch_time_ns();
+
+    for (int i = 0; i < JOURNAL_MAX; i++) {
+        journal_t *journal = &journals[i];
+
+        // Wrapping needs a sync, which cannot wait here
+        if (journal->dev && journal->running > 0 && journal->handles == 0 && journal->commit_pending == 0 &&
+            !journal->failed && now - journal->running_ns >= JOURNAL_COMMIT_NS && journal_fits(journal)) {
+            journal_submit(journal);
+        }
+    }
+}
+
+static void journal_release(journal_t *journal)
+{
+    for (int i = 0; i < JOURNAL_BUFFERS; i++) {
+        if (journal->buffers[i].data) {
+            arch_memory_deallocate_page((void *)physical_address(journal->buffers[i].data));
+        }
+    }
+    if (journal->descriptor) {
+        arch_memory_deallocate_page((void *)physical_address(journal->descriptor));
+    }
+    if (journal->commit) {
+        arch_memory_deallocate_page((void *)physical_address(journal->commit));
+    }
+
+    arch_memory_zero_struct(journal);
+}
+
+static uint8_t *journal_page(void)
+{
+    void *page = arch_memory_allocate_page();
+    return page ? virtual_address(page) : NULL;
+}
+
+/* Replay committed transactions from the head of the log
+ *
+ * @return: ARCH_OK with journal->sequence set past the last one replayed
+ */
+static arch_result journal_recover(journal_t *journal, uint32_t head)
+{
+    journal_descriptor_t *descriptor = (journal_descriptor_t *)journal->descriptor;
+    journal_commit_t *commit = (journal_commit_t *)journal->commit;
+    uint32_t position = head;
+
+    while (position + 2 <= journal->length) {
+        if (journal_log_io(journal, BIO_READ, 0, journal->descriptor, position) != ARCH_OK) {
+            return ARCH_ERROR;
+        }
+
+        uint32_t count = descriptor->count;
+        if (descriptor->magic != JOURNAL_DESC_MAGIC || descriptor->sequence != journal->sequence ||
+            count == 0 || count > JOURNAL_TRANSACTION_MAX || position + count + 2 > journal->length) {
+            break;
+        }
+
+        uint32_t checksum = journal_checksum(2166136261u, journal->descriptor, journal->block_size);
+        for (uint32_t i = 0; i < count; i++) {
+            if (journal_log_io(journal, BIO_READ, 0, journal->buffers[i].data, position + 1 + i) != ARCH_OK) {
+                return ARCH_ERROR;
+            }
+            checksum = journal_checksum(checksum, journal->buffers[i].data, journal->block_size);
+        }
+
+        if (journal_log_io(journal, BIO_READ, 0, journal->commit, position + 1 + count) != ARCH_OK) {
+            return ARCH_ERROR;
+        }
+
+        // A crash before the commit block landed leaves the transaction out
+        if (commit->magic != JOURNAL_COMMIT_MAGIC || commit->sequence != journal->sequence ||
+            commit->count != count || commit->checksum != checksum) {
+            break;
+        }
+
+        for (uint32_t i = 0; i < count; i++) {
+            if (journal->dev->block_ops.write_blocks(journal->dev, journal->buffers[i].data,
+                                                     descriptor->blocks[i] * journal->device_blocks,
+                                                     journal->device_blocks) < 0) {
+                return ARCH_ERROR;
+            }
+        }
+
+        position += count + 2;
+        journal->sequence++;
+        journal->stats.replayed++;
+    }
+
+    if (journal->stats.replayed == 0 && head == 1) {
+        return ARCH_OK;
+    }
+
+    // New transactions start over at block 1, so the replayed ones must be home first
+    return journal_wrap(journal);
+}
+
+journal_t *journal_open(device_t *dev, uint32_t block_size, uint64_t start, uint32_t length)
+{
+    if (!dev || dev->class != DEVICE_CLASS_BLOCK || !dev->block_ops.submit_bio) {
+        return NULL;
+    }
+
+    uint32_t device_block_size = dev->block_ops.get_block_size(dev);
+    if (block_size == 0 || block_size > JOURNAL_BLOCK_MAX || block_size % device_block_size != 0 ||
+        length < JOURNAL_TRANSACTION_MAX + 3 ||
+        (start + length) * (block_size / device_block_size) > dev->block_ops.get_block_count(dev)) {
+        return NULL;
+    }
+
+    journal_t *journal = NULL;
+    for (int i = 0; i < JOURNAL_MAX; i++) {
+        if (!journals[i].dev) {
+            journal = &journals[i];
+            break;
+        }
+    }
+
+    if (!journal || (!journal_timer_ready && arch_timer_add_callback(journal_timer) != ARCH_OK)) {
+        return NULL;
+    }
+    journal_timer_ready = true;
+
+    arch_memory_zero_struct(journal);
+    journal->dev = dev;
+    journal->block_size = block_size;
+    journal->device_blocks = block_size / device_block_size;
+    journal->start = start;
+    journal->length = length;
+
+    journal->descriptor = journal_page();
+    journal->commit = journal_page();
+    for (int i = 0; i < JOURNAL_BUFFERS; i++) {
+        journal->buffers[i].data = journal_page();
+        if (!journal->buffers[i].data) {
+            break;
+        }
+    }
+
+    if (!journal->descriptor || !journal->commit || !journal->buffers[JOURNAL_BUFFERS - 1].data ||
+        journal_log_io(journal, BIO_READ, 0, journal->commit, 0) != ARCH_OK) {
+        journal_release(journal);
+        return NULL;
+    }
+
+    journal_super_t *super = (journal_super_t *)journal->commit;
+    if (super->magic != JOURNAL_MAGIC || super->block_size != block_size || super->length != length ||
+        super->head == 0 || super->head >= length) {
+        journal_release(journal);
+        return NULL;
+    }
+
+    journal->sequence = super->sequence;
+
+    uint64_t state = arch_interrupt_save();
+    arch_result result = journal_recover(journal, super->head);
+    arch_interrupt_restore(state);
+
+    if (result != ARCH_OK) {
+        journal_release(journal);
+        return NULL;
+    }
+
+    journal->tail = 1;
+
+    return journal;
+}
+
+arch_result journal_close(journal_t *journal)
+{
+    if (!journal || !journal->dev || journal->handles > 0) {
+        return ARCH_INVALID;
+    }
+
+    arch_result result = journal_sync(journal);
+
+    uint64_t state = arch_interrupt_save();
+    journal_wait(journal);
+    journal_release(journal);
+    arch_interrupt_restore(state);
+
+    return result;
+}
+
+arch_result journal_start(journal_t *journal, uint32_t blocks)
+{
+    if (blocks > JOURNAL_TRANSACTION_MAX) {
+        return ARCH_INVALID;
+    }
+
+    arch_result result = ARCH_OK;
+    uint64_t state = arch_interrupt_save();
+
+    if (journal->running + journal->reserved + blocks > JOURNAL_TRANSACTION_MAX) {
+        // Open operations would be split across transactions
+        result = journal->handles > 0 ? ARCH_ERROR : journal_commit(journal);
+    } else if (journal->failed) {
+        result = ARCH_ERROR;
+    }
+
+    if (result == ARCH_OK) {
+        journal->handles++;
+        journal->reserved += blocks;
+        journal->stats.handles++;
+    }
+
+    arch_interrupt_restore(state);
+
+    return result;
+}
+
+void *journal_get_block(journal_t *journal, uint64_t block)
+{
+    void *data = NULL;
+    uint64_t state = arch_interrupt_save();
+    journal_buffer_t *newest = journal_find(journal, block);
+
+    if (newest && newest->state == JOURNAL_BUFFER_RUNNING) {
+        journal->stats.absorbed++;
+        data = newest->data;
+    } else if (journal->handles > 0 && journal->running < JOURNAL_TRANSACTION_MAX) {
+        journal_buffer_t *buffer = NULL;
+
+        // Copies still being committed free up once they are logged and checkpointed
+        for (int attempt = 0; !buffer && attempt < 2; attempt++) {
+            for (int i = 0; i < JOURNAL_BUFFERS; i++) {
+                if (journal->buffers[i].state == JOURNAL_BUFFER_FREE) {
+                    buffer = &journal->buffers[i];
+                    break;
+                }
+            }
+            if (!buffer) {
+                journal_wait(journal);
+                journal_checkpoint(journal);
+            }
+        }
+
+        if (buffer && newest) {
+            arch_memory_copy(buffer->data, newest->data, journal->block_size);
+        } else if (buffer && journal->dev->block_ops.read_blocks(journal->dev, buffer->data,
+                                                                 block * journal->device_blocks,
+                                                                 journal->device_blocks) < 0) {
+            buffer = NULL;
+        }
+
+        if (buffer) {
+            buffer->state = JOURNAL_BUFFER_RUNNING;
+            buffer->block = block;
+            buffer->sequence = journal->sequence;
+            if (journal->running++ == 0) {
+                journal->running_ns = arch_time_ns();
+            }
+            data = buffer->data;
+        }
+    }
+
+    arch_interrupt_restore(state);
+
+    return data;
+}
+
+arch_result journal_stop(journal_t *journal)
+{
+    if (journal->handles == 0) {
+        return ARCH_INVALID;
+    }
+
+    arch_result result = ARCH_OK;
+    uint64_t state = arch_interrupt_save();
+
+    if (--journal->handles == 0) {
+        journal->reserved = 0;
+
+        if (journal->running == JOURNAL_TRANSACTION_MAX ||
+            (journal->running > 0 && arch_time_ns() - journal->running_ns >= JOURNAL_COMMIT_NS)) {
+            result = journal_commit(journal);
+        }
+
+        if (result == ARCH_OK) {
+            result = journal_checkpoint(journal);
+        }
+    }
+
+    arch_interrupt_restore(state);
+
+    return result;
+}
+
+arch_result journal_sync(journal_t *journal)
+{
+    if (!journal || !journal->dev) {
+        return ARCH_INVALID;
+    }
+
+    uint64_t state = arch_interrupt_save();
+
+    arch_result result = journal->handles > 0 ? ARCH_ERROR : journal_commit(journal);
+    journal_wait(journal);
+
+    if (result == ARCH_OK && journal->failed) {
+        result = ARCH_ERROR;
+    }
+    if (result == ARCH_OK) {
+        result = journal_checkpoint(journal);
+    }
+
+    arch_interrupt_restore(state);
+
+    return result;
+}
+
+void journal_read(journal_t *journal, void *buf, uint64_t block, uint32_t count)
+{
+    uint64_t state = arch_interrupt_save();
+
+    for (int i = 0; i < JOURNAL_BUFFERS; i++) {
+        journal_buffer_t *buffer = &journal->buffers[i];
+
+        if (buffer->state != JOURNAL_BUFFER_FREE && buffer->block >= block && buffer->block - block < count &&
+            journal_find(journal, buffer->block) == buffer) {
+            arch_memory_copy((uint8_t *)buf + (buffer->block - block) * journal->block_size, buffer->data,
+                             journal->block_size);
+        }
+    }
+
+    arch_interrupt_restore(state);
+}
+
+const journal_stats_t *journal_get_stats(journal_t *journal)
+{
+    return &journal->stats;
+}
@@ -0,0 +1,259 @@
+#include "fs/pagecache.h"
+#include "arch/x86_64/memory.h"
+
+/* Page cache
+ *
+ * A fixed set of page slots is shared by every file. A slot gets its page
+ * from the allocator the first time it is used and keeps it from then on,
+ * so dropping a file's pages only unlinks them from its tree. Eviction
+ * takes the least recently used page that no mapping holds.
+ *
+ * Mappings take consecutive pages of the window at KERNEL_MAP_BASE and
+ * install the cached pages read-only, so mapped contents cannot drift from
+ * the cache.
+ */
+
+#define PAGECACHE_WINDOW_PAGES (KERNEL_MAP_SIZE / PAGE_SIZE)
+
+typedef struct {
+    pagecache_mapping_t *mapping;    // NULL while the slot is free
+    uint64_t index;
+    uint8_t *data;                   // Kept by the slot once allocated
+    uint32_t maps;                   // Mappings the page is installed in; never evicted while set
+    uint64_t used;                   // Clock at the last access, for eviction
+} pagecache_page_t;
+
+typedef struct {
+    uint64_t address;                // 0 while the slot is free
+    pagecache_mapping_t *mapping;
+    uint64_t first;
+    uint32_t count;
+} pagecache_map_t;
+
+static pagecache_page_t pagecache_pages[PAGECACHE_PAGES];
+static pagecache_map_t pagecache_maps[PAGECACHE_MAPS];
+static bool pagecache_window[PAGECACHE_WINDOW_PAGES];
+static pagecache_stats_t pagecache_stats;
+static uint64_t pagecache_clock = 0;
+
+void pagecache_mapping_init(pagecache_mapping_t *mapping, pagecache_fill_t fill, void *owner)
+{
+    mapping->pages = (radix_tree_t)RADIX_TREE_INIT;
+    mapping->count = 0;
+    mapping->fill = fill;
+    mapping->owner = owner;
+}
+
+static void pagecache_drop(pagecache_page_t *page)
+{
+    radix_delete(&page->mapping->pages, page->index);
+    page->mapping->count--;
+    page->mapping = NULL;
+}
+
+// A slot for a new page: one never used, then a free one, then the least recently used unmapped one
+static pagecache_page_t *pagecache_victim(void)
+{
+    pagecache_page_t *victim = NULL;
+
+    for (int i = 0; i < PAGECACHE_PAGES; i++) {
+        pagecache_page_t *page = &pagecache_pages[i];
+
+        if (!page->data) {
+            void *allocated = arch_memory_allocate_page();
+            if (allocated) {
+                page->data = virtual_address(allocated);
+                return page;
+            }
+            continue;
+        }
+        if (!page->mapping) {
+            return page;
+        }
+        if (page->maps == 0 && (!victim || page->used < victim->used)) {
+            victim = page;
+        }
+    }
+
+    if (victim) {
+        pagecache_drop(victim);
+        pagecache_stats.evictions++;
+    }
+
+    return victim;
+}
+
+// Find a page of a file, filling it on a miss
+static pagecache_page_t *pagecache_get(pagecache_mapping_t *mapping, uint64_t index)
+{
+    pagecache_page_t *page = radix_lookup(&mapping->pages, index);
+
+    if (page) {
+        pagecache_stats.hits++;
+        page->used = ++pagecache_clock;
+        return page;
+    }
+
+    page = pagecache_victim();
+    if (!page || mapping->fill(mapping, index, page->data) != ARCH_OK ||
+        radix_insert(&mapping->pages, index, page) != ARCH_OK) {
+        return NULL;
+    }
+
+    pagecache_stats.misses++;
+    page->mapping = mapping;
+    page->index = index;
+    page->maps = 0;
+    page->used = ++pagecache_clock;
+    mapping->count++;
+
+    return page;
+}
+
+int pagecache_read(pagecache_mapping_t *mapping, void *buf, uint64_t offset, uint32_t length, uint64_t size)
+{
+    if (offset >= size) {
+        return 0;
+    }
+    if (length > size - offset) {
+        length = size - offset;
+    }
+    if (length > 0x7FFFFFFF) {
+        length = 0x7FFFFFFF;
+    }
+
+    uint8_t *out = buf;
+    uint32_t done = 0;
+
+    while (done < length) {
+        uint64_t position = offset + done;
+        uint32_t within = position % PAGE_SIZE;
+        uint32_t bytes = PAGE_SIZE - within;
+
+        if (bytes > length - done) {
+            bytes = length - done;
+        }
+
+        pagecache_page_t *page = pagecache_get(mapping, position / PAGE_SIZE);
+        if (!page) {
+            return -1;
+        }
+
+        arch_memory_copy(out + done, page->data + within, bytes);
+        done += bytes;
+    }
+
+    return done;
+}
+
+static void pagecache_release(pagecache_map_t *map, uint32_t installed)
+{
+    for (uint32_t i = 0; i < installed; i++) {
+        arch_memory_unmap_page(map->address + (uint64_t)i * PAGE_SIZE);
+
+        pagecache_page_t *page = radix_lookup(&map->mapping->pages, map->first + i);
+        if (page) {
+            page->maps--;
+        }
+    }
+
+    uint32_t start = (map->address - KERNEL_MAP_BASE) / PAGE_SIZE;
+    for (uint32_t i = 0; i < map->count; i++) {
+        pagecache_window[start + i] = false;
+    }
+
+    arch_memory_flush_tlb();
+    map->address = 0;
+}
+
+const void *pagecache_map(pagecache_mapping_t *mapping, uint64_t first, uint32_t count)
+{
+    if (count == 0 || count > PAGECACHE_PAGES) {
+        return NULL;
+    }
+
+    pagecache_map_t *map = NULL;
+    for (int i = 0; i < PAGECACHE_MAPS; i++) {
+        if (!pagecache_maps[i].address) {
+            map = &pagecache_maps[i];
+            break;
+        }
+    }
+
+    // First fit in the window
+    uint32_t start = 0, run = 0;
+    for (uint32_t i = 0; map && i < PAGECACHE_WINDOW_PAGES && run < count; i++) {
+        run = pagecache_window[i] ? 0 : run + 1;
+        start = i + 1 - run;
+    }
+
+    if (!map || run < count) {
+        return NULL;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        pagecache_window[start + i] = true;
+    }
+
+    map->address = KERNEL_MAP_BASE + (uint64_t)start * PAGE_SIZE;
+    map->mapping = mapping;
+    map->first = first;
+    map->count = count;
+
+    // Each page is held as soon as it is found, so filling the next cannot evict it
+    for (uint32_t i = 0; i < count; i++) {
+        pagecache_page_t *page = pagecache_get(mapping, first + i);
+
+        if (page) {
+            page->maps++;
+        }
+        if (!page || arch_memory_map_page(map->address + (uint64_t)i * PAGE_SIZE, physical_address(page->data),
+                                          PAGE_PRESENT) != ARCH_OK) {
+            if (page) {
+                page->maps--;
+            }
+            pagecache_release(map, i);
+            return NULL;
+        }
+    }
+
+    pagecache_stats.mapped += count;
+
+    return (const void *)map->address;
+}
+
+arch_result pagecache_unmap(const void *address)
+{
+    for (int i = 0; i < PAGECACHE_MAPS; i++) {
+        pagecache_map_t *map = &pagecache_maps[i];
+
+        if (map->address && map->address == (uint64_t)address) {
+            pagecache_release(map, map->count);
+            return ARCH_OK;
+        }
+    }
+
+    return ARCH_INVALID;
+}
+
+arch_result pagecache_truncate(pagecache_mapping_t *mapping)
+{
+    for (int i = 0; i < PAGECACHE_PAGES; i++) {
+        if (pagecache_pages[i].mapping == mapping && pagecache_pages[i].maps > 0) {
+            return ARCH_ERROR;
+        }
+    }
+
+    for (int i = 0; i < PAGECACHE_PAGES && mapping->count > 0; i++) {
+        if (pagecache_pages[i].mapping == mapping) {
+            pagecache_drop(&pagecache_pages[i]);
+        }
+    }
+
+    return ARCH_OK;
+}
+
+const pagecache_stats_t *pagecache_get_stats(void)
+{
+    return &pagecache_stats;
+}
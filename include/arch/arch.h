@@ -19,9 +19,16 @@ int arch_register_interrupt(unsigned vector, void (*handler)(void));
 void arch_handle_interrupt(unsigned vector);
 void arch_interrupt_enable(void);
 void arch_interrupt_disable(void);
+uint64_t arch_interrupt_save(void);              // Disable interrupts, return previous state
+void arch_interrupt_restore(uint64_t state);     // Restore state from arch_interrupt_save
+void arch_interrupt_wait(void);                  // Enable interrupts, halt until one arrives, disable again
+uint64_t arch_idle_cycles(void);                 // Cycles spent in arch_interrupt_wait since boot
 
 arch_result arch_timer_init(unsigned int frequency_hz);
+arch_result arch_timer_add_callback(void (*callback)(void));  // Run on every tick, in interrupt context
 uint64_t arch_time_ns(void);
+uint64_t arch_cycles(void);                      // Free-running CPU cycle counter
+unsigned int arch_cpu_id(void);                  // Index of the executing CPU
 arch_result arch_register_default_handlers(void);
 
 // Serial interface - arch-specific implementations  
@@ -38,6 +45,8 @@ arch_result arch_serial_init(arch_serial_device_t *device);             // Initi
 int arch_serial_write(arch_serial_device_t *device, const void *buf, size_t len);  // Write to device
 int arch_serial_read(arch_serial_device_t *device, void *buf, size_t len);         // Read from device
 bool arch_serial_data_available(arch_serial_device_t *device);                     // Check if data available
+arch_result arch_serial_set_baud(arch_serial_device_t *device, uint32_t baud);     // Change line rate
+uint32_t arch_serial_get_baud(arch_serial_device_t *device);                       // Current line rate
 
 // Parallel interface - arch-specific implementations
 typedef struct arch_parallel_device arch_parallel_device_t;  // Opaque handle
@@ -119,6 +128,7 @@ typedef struct {
 
 int arch_keyboard_get_count(void);                                           // How many devices exist?
 arch_result arch_keyboard_get_info(int index, arch_keyboard_info_t *info);  // Get info for device N
+void arch_keyboard_start(void);                                             // Begin the slow self-tests; init collects them
 arch_result arch_keyboard_init(arch_keyboard_device_t *device);             // Initialize specific device
 bool arch_keyboard_has_event(arch_keyboard_device_t *device);              // Check if event available
 arch_result arch_keyboard_read_event(arch_keyboard_device_t *device, arch_keyboard_event_t *event); // Read event
@@ -146,14 +156,41 @@ typedef struct {
     uint32_t block_size;         // Block size in bytes (typically 512)
     uint64_t block_count;        // Total number of blocks
     bool read_only;              // Device is read-only
+    uint32_t max_segments;       // Most scatter list entries per request, 0 for no limit of its own
 } arch_disk_info_t;
 
+void arch_disk_start(void);                                          // Begin identifying drives; get_count collects them
 int arch_disk_get_count(void);                                      // Get number of disk devices
 arch_result arch_disk_get_info(int index, arch_disk_info_t *info);  // Get info for device N
 arch_result arch_disk_init(arch_disk_device_t *device);            // Initialize specific device
+
+typedef struct {
+    void *buffer;
+    uint32_t block_count;
+} arch_disk_segment_t;
+
+#define ARCH_DISK_PREFLUSH (1 << 0)  // Flush the drive's write cache before the data; alone if there is none
+#define ARCH_DISK_FUA      (1 << 1)  // Complete a write only once it is on the medium
+
+typedef struct arch_disk_request {
+    void *buffer;                                          // Used when there is no segment list
+    const arch_disk_segment_t *segments;                   // Scatter list covering block_count blocks
+    uint32_t segment_count;
+    uint64_t start_block;
+    uint32_t block_count;
+    bool write;
+    uint32_t flags;                                        // ARCH_DISK_*
+    void (*complete)(struct arch_disk_request *request);  // Called from interrupt context
+    void *context;                                         // Owned by the submitter
+    arch_result result;                                    // Valid once complete is called
+    arch_disk_device_t *device;                            // Set by arch_disk_submit
+    struct arch_disk_request *next;                        // Queue link while in flight
+} arch_disk_request_t;
+
+arch_result arch_disk_submit(arch_disk_device_t *device, arch_disk_request_t *request);  // Start I/O, complete() signals the end
 arch_result arch_disk_read_blocks(arch_disk_device_t *device, void *buf, uint64_t start_block, uint32_t block_count);
 arch_result arch_disk_write_blocks(arch_disk_device_t *device, const void *buf, uint64_t start_block, uint32_t block_count);
-arch_result arch_disk_sync(arch_disk_device_t *device);            // Flush any pending writes
+arch_result arch_disk_sync(arch_disk_device_t *device);            // Flush the drive's write cache
 
 // Display interface - arch-specific implementations
 typedef struct arch_display_device arch_display_device_t;  // Opaque handle
@@ -191,6 +228,12 @@ int arch_memory_compare(const void *ptr1, const void *ptr2, uint64_t size);
 
 arch_result arch_memory_map_page(uint64_t virtual_addr, uint64_t physical_addr, int flags);
 arch_result arch_memory_unmap_page(uint64_t virtual_addr);
+
+/* Look up the physical address a virtual address is mapped to
+ *
+ * @return: ARCH_OK with *physical_addr set, or ARCH_ERROR if it is not mapped
+ */
+arch_result arch_memory_translate(uint64_t virtual_addr, uint64_t *physical_addr);
 void *arch_memory_allocate_page(void);
 void arch_memory_deallocate_page(void *page);
 void arch_memory_flush_tlb(void);
@@ -200,5 +243,8 @@ void arch_memory_map_userpages(uint64_t pdpt);
 
 
 void arch_debug_printf(const char *format, ...);
+void arch_debug_vprintf(const char *format, va_list args);
+void arch_debug_write(const char *buf, size_t length);  // Queue bytes as they are, without formatting
+void arch_debug_flush(void);                     // Drain queued debug output synchronously
 
 #endif
\ No newline at end of file
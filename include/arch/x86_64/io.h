@@ -5,8 +5,14 @@
 
 uint8_t inb(uint32_t port);
 uint16_t inw(uint32_t port);
+uint32_t inl(uint32_t port);
 
 void outb(uint32_t port, uint8_t value);
 void outw(uint32_t port, uint16_t value);
+void outl(uint32_t port, uint32_t value);
+
+// Repeated string transfers of count 16-bit words
+void insw(uint32_t port, void *buf, uint64_t count);
+void outsw(uint32_t port, const void *buf, uint64_t count);
 
 #endif
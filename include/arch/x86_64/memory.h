@@ -8,9 +8,13 @@
 
 #define CR0_PE (1 << 0)  // Protected Mode Enable bit
 #define CR0_PG (1 << 31) // Paging bit
+#define CR0_MP (1 << 1)  // Monitor coprocessor bit
+#define CR0_EM (1 << 2)  // x87 emulation bit
 
 #define CR4_PGE (1 << 7) // Page Global Enable bit
 #define CR4_PAE (1 << 5) // Physical Address Extension bit
+#define CR4_OSFXSR (1 << 9)      // FXSAVE and SSE instructions enable bit
+#define CR4_OSXMMEXCPT (1 << 10) // Unmasked SSE exceptions enable bit
 
 #define MSR_EFER 0xC0000080 // EFER model specific register
 #define EFER_LME (1 << 8)   // Long mode bit
@@ -25,6 +29,10 @@
 
 #define KERNEL_BASE 0xFFFFFF8000000000
 #define KERNEL_STACK KERNEL_BASE + 0x200000 - 1
+#define KERNEL_STACK_SIZE 0x10000  // Kept out of the page allocator below KERNEL_STACK
+#define KERNEL_PHYS 0x10000        // Where the boot sector loads the kernel image
+#define KERNEL_MAP_BASE (KERNEL_BASE + 0x200000)  // File mappings, right above the kernel's 2 MiB
+#define KERNEL_MAP_SIZE 0x200000                  // One page table's worth
 
 #define physical_address(va) ((uint64_t)(va) - KERNEL_BASE)
 #define virtual_address(pa) ((void *)((uint64_t)(pa) + KERNEL_BASE))
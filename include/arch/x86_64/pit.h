@@ -3,8 +3,11 @@
 
 #include "definitions.h"
 
-void x86_64_pit_init(unsigned int frequency_hz);
+// PIT input clock: ~1.193182 MHz
+#define PIT_FREQUENCY   1193182
+
+uint16_t x86_64_pit_init(unsigned int frequency_hz);  // Returns the programmed divisor
 void x86_64_pit_disable(void);
-uint16_t x86_64_pit_read_count(void);
+uint16_t x86_64_pit_read_count(void);                  // Channel 0 count, runs from divisor down to 1
 
 #endif
\ No newline at end of file
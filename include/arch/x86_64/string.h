@@ -0,0 +1,11 @@
+#ifndef X86_64_STRING_H
+#define X86_64_STRING_H
+
+#include "definitions.h"
+
+// SSE2 scanning routines (string.s), usable once SSE is enabled
+uint64_t x86_64_sse2_strlen(const char *str);
+int x86_64_sse2_strcmp(const char *s1, const char *s2);
+void *x86_64_sse2_memchr(const void *ptr, int c, size_t n);
+
+#endif
@@ -7,4 +7,15 @@
 
 arch_result board_init(void);
 
+typedef struct {
+    const char *name;                // Phase that ended at this reading
+    uint64_t cycles;                 // arch_cycles() at the time
+} board_boot_stamp_t;
+
+/* Cycle counter readings the bootloader took before entering the kernel
+ *
+ * @return: Number of stamps written to stamps, at most max
+ */
+uint32_t board_boot_stamps(board_boot_stamp_t *stamps, uint32_t max);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,59 @@
+#ifndef BOOT_H
+#define BOOT_H
+
+/* Boot information
+ *
+ * The boot loader fills this in just above the BIOS data area, where the
+ * page allocator never hands out memory, and the kernel reads it through
+ * virtual_address(BOOT_INFO_ADDRESS). The offsets are for boot.s and must
+ * match boot_info_t.
+ */
+
+#define BOOT_INFO_ADDRESS 0x500
+#define BOOT_INFO_MAGIC   0x4F464E49  // "INFO"
+#define BOOT_TSC_STAMPS   3           // Loader entry, kernel loaded, long mode entry
+#define BOOT_E820_MAX     32
+#define BOOT_E820_SIZE    24          // Bytes per entry, with the ACPI 3.0 attributes
+#define BOOT_E820_SMAP    0x534D4150  // "SMAP"
+
+#define BOOT_INFO_MAGIC_OFFSET   0
+#define BOOT_INFO_DRIVE          4
+#define BOOT_INFO_KERNEL_SECTORS 8
+#define BOOT_INFO_TSC            16
+#define BOOT_INFO_E820_COUNT     40
+#define BOOT_INFO_E820           48
+
+#define BOOT_READ_MAX     127         // Sectors per BIOS read, the most every BIOS accepts
+#define BOOT_READ_RETRIES 3
+
+#ifndef __ASSEMBLER__
+#include "definitions.h"
+
+#define BOOT_E820_USABLE 1
+
+typedef struct {
+    uint64_t base;
+    uint64_t length;
+    uint32_t type;                    // BOOT_E820_USABLE, or reserved in some way
+    uint32_t attributes;
+} __attribute__((packed)) boot_e820_entry_t;
+
+typedef struct {
+    uint32_t magic;                   // BOOT_INFO_MAGIC once the loader got to the kernel
+    uint32_t drive;                   // BIOS drive number the kernel was loaded from
+    uint32_t kernel_sectors;
+    uint32_t reserved;
+    uint64_t tsc[BOOT_TSC_STAMPS];
+    uint32_t e820_count;              // 0 if the BIOS has no E820 support
+    uint32_t reserved2;
+    boot_e820_entry_t e820[BOOT_E820_MAX];
+} __attribute__((packed)) boot_info_t;
+
+_Static_assert(sizeof(boot_e820_entry_t) == BOOT_E820_SIZE, "E820 entry layout");
+_Static_assert(__builtin_offsetof(boot_info_t, kernel_sectors) == BOOT_INFO_KERNEL_SECTORS, "boot_info_t layout");
+_Static_assert(__builtin_offsetof(boot_info_t, tsc) == BOOT_INFO_TSC, "boot_info_t layout");
+_Static_assert(__builtin_offsetof(boot_info_t, e820_count) == BOOT_INFO_E820_COUNT, "boot_info_t layout");
+_Static_assert(__builtin_offsetof(boot_info_t, e820) == BOOT_INFO_E820, "boot_info_t layout");
+#endif
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef X86_64_DISK_H
+#define X86_64_DISK_H
+
+#include "definitions.h"
+
+#define ATA_IRQ_PRIMARY   14
+#define ATA_IRQ_SECONDARY 15
+
+// Locate the bus-master IDE controller and wire up the channel interrupts
+void x86_disk_init(void);
+
+#endif
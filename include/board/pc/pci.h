@@ -0,0 +1,44 @@
+#ifndef X86_64_PCI_H
+#define X86_64_PCI_H
+
+#include "definitions.h"
+
+#define PCI_VENDOR_ID      0x00
+#define PCI_DEVICE_ID      0x02
+#define PCI_COMMAND        0x04
+#define PCI_CLASS_REVISION 0x08  // Class, subclass, programming interface, revision
+#define PCI_HEADER_TYPE    0x0E
+#define PCI_BAR0           0x10
+#define PCI_BAR4           0x20
+#define PCI_INTERRUPT_LINE 0x3C
+
+#define PCI_COMMAND_IO          0x0001
+#define PCI_COMMAND_BUS_MASTER  0x0004
+
+#define PCI_CLASS_STORAGE       0x01
+#define PCI_SUBCLASS_IDE        0x01
+
+typedef struct {
+    uint8_t bus;
+    uint8_t device;
+    uint8_t function;
+} pci_address_t;
+
+// Configuration mechanism #1 is absent on ISA-only machines
+bool pci_present(void);
+
+uint32_t pci_config_read32(pci_address_t address, uint8_t offset);
+uint16_t pci_config_read16(pci_address_t address, uint8_t offset);
+uint8_t pci_config_read8(pci_address_t address, uint8_t offset);
+void pci_config_write16(pci_address_t address, uint8_t offset, uint16_t value);
+
+/* Find the index'th function with the given class and subclass
+ *
+ * @return: true and the function's address in *address if found
+ */
+bool pci_find_class(uint8_t class_code, uint8_t subclass, int index, pci_address_t *address);
+
+// Find the index'th function with the given vendor and device ID
+bool pci_find_device(uint16_t vendor, uint16_t device, int index, pci_address_t *address);
+
+#endif
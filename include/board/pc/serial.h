@@ -4,9 +4,25 @@
 #include "lib/utils.h"
 
 typedef enum {
-    SERIAL_PORT_0 = 0x3F8,
+    SERIAL_PORT_0 = 0x3F8,  // COM1
+    SERIAL_PORT_1 = 0x2F8,  // COM2
+    SERIAL_PORT_2 = 0x3E8,  // COM3
+    SERIAL_PORT_3 = 0x2E8,  // COM4
 } serial_port;
 
-#define SERIAL_BUFFER_SIZE 8
+#define SERIAL_IRQ_COM1_COM3 4
+#define SERIAL_IRQ_COM2_COM4 3
 
-#endif
\ No newline at end of file
+// UART input clock (1.8432 MHz) divided by the 16x oversampling
+#define SERIAL_BASE_BAUD     115200
+#define SERIAL_DEFAULT_BAUD  115200
+
+#define SERIAL_BUFFER_SIZE 64
+
+void x86_serial_init(void);
+
+// COM1 debug output, drained from the transmit-empty interrupt
+void x86_debug_serial_interrupt(void);
+void x86_debug_enable_async(bool enable);
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef X86_64_VIRTIO_H
+#define X86_64_VIRTIO_H
+
+#include "arch/arch.h"
+
+#define VIRTIO_BLK_MAX 2  // virtio-blk functions driven at once
+
+typedef struct virtio_blk virtio_blk_t;
+
+// Find legacy virtio-blk functions on the PCI bus and bring up their request queues
+void x86_virtio_init(void);
+
+int virtio_blk_get_count(void);
+virtio_blk_t *virtio_blk_get(int index);
+
+// Fill in everything but info->device
+void virtio_blk_get_info(virtio_blk_t *blk, arch_disk_info_t *info);
+
+/* Queue a request that arch_disk_submit has checked
+ *
+ * Requests go out as soon as a slot in the ring is free and several are on
+ * the device at once, completing in whatever order it finishes them. One
+ * with ARCH_DISK_PREFLUSH waits for everything queued before it.
+ */
+arch_result virtio_blk_submit(virtio_blk_t *blk, arch_disk_request_t *request);
+
+// Submit and wait, polling the ring when interrupts are disabled
+arch_result virtio_blk_transfer(virtio_blk_t *blk, void *buf, uint64_t start_block, uint32_t block_count,
+                                bool write, uint32_t flags);
+
+#endif
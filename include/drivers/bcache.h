@@ -0,0 +1,68 @@
+#ifndef BCACHE_H
+#define BCACHE_H
+
+#include "kernel/device.h"
+
+#define BCACHE_BLOCKS          64            // Cached blocks shared by all devices
+#define BCACHE_BLOCK_SIZE      512           // Devices with larger blocks bypass the cache
+#define BCACHE_HASH_BITS       6
+#define BCACHE_BYPASS_BLOCKS   32            // Transfers this large go straight to the device
+#define BCACHE_WRITEBACK_NS    1000000000ULL // Age at which the flusher writes a dirty block
+#define BCACHE_FLUSH_PERIOD_NS 250000000ULL  // How often the flusher looks for old dirty blocks
+#define BCACHE_STREAMS         4             // Devices tracked for sequential reads at once
+#define BCACHE_READAHEAD_MIN   4             // Window once a read follows on from the last one
+#define BCACHE_READAHEAD_MAX   16            // The window doubles up to this many blocks
+
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t writebacks;         // Dirty blocks written to the device
+    uint64_t evictions;          // Blocks dropped to make room
+    uint64_t write_errors;       // Failed writebacks, retried by the flusher
+    uint64_t readahead;          // Blocks read ahead of a sequential stream
+    uint64_t readahead_hits;     // Read-ahead blocks that were asked for before eviction
+    uint64_t mapped;             // Blocks of memory-backed devices cached without a copy
+} bcache_stats_t;
+
+/* Set up the cache and start the periodic flusher
+ *
+ * @return: ARCH_OK, or ARCH_ERROR if no timer callback is free
+ */
+arch_result bcache_init(void);
+
+/* Read blocks through the cache
+ *
+ * Misses are fetched with bios submitted to dev, so a block device can use
+ * these as its read_blocks and write_blocks operations. Devices with a
+ * map_block operation have their storage mapped into the cache instead:
+ * the entry points at the block in place and is never read or written
+ * back. A read that starts
+ * where the previous one on the device ended also reads the following
+ * blocks into the cache without waiting for them; the window doubles while
+ * the stream continues and closes on the first read elsewhere.
+ *
+ * @return: block_count on success, -1 on error
+ */
+int bcache_read(device_t *dev, void *buf, uint64_t start_block, uint32_t block_count);
+
+/* Write blocks into the cache
+ *
+ * The blocks reach the device when the flusher or bcache_sync writes them
+ * back; large writes go to the device before returning.
+ *
+ * @return: block_count on success, -1 on error
+ */
+int bcache_write(device_t *dev, const void *buf, uint64_t start_block, uint32_t block_count);
+
+/* Write back every dirty block of a device and wait for it
+ *
+ * @return: ARCH_OK, or ARCH_ERROR if a block could not be written
+ */
+arch_result bcache_sync(device_t *dev);
+
+// Turn read-ahead off or back on, for comparing the two; it starts on
+void bcache_set_readahead(bool enabled);
+
+const bcache_stats_t *bcache_get_stats(void);
+
+#endif
@@ -3,6 +3,16 @@
 
 #include "arch/arch.h"
 
+#include "kernel/device.h"
+
+void disk_driver_start(void);
 arch_result disk_driver_init(void);
 
+/* Select the I/O scheduler of a disk
+ *
+ * @param name: A policy known to elevator_find()
+ * @return: ARCH_OK, ARCH_INVALID if dev is not a disk, ARCH_UNSUPPORTED for an unknown policy
+ */
+arch_result disk_set_scheduler(device_t *dev, const char *name);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,62 @@
+#ifndef ELEVATOR_H
+#define ELEVATOR_H
+
+#include "kernel/device.h"
+
+typedef struct elevator_queue elevator_queue_t;
+
+/* I/O scheduler policy
+ *
+ * select picks the bio to dispatch next without unlinking it. Policies that
+ * merge have contiguous bios of the same direction joined onto the pick.
+ */
+typedef struct {
+    const char *name;
+    bool merge;
+    bio_t *(*select)(elevator_queue_t *queue);
+} elevator_type_t;
+
+struct elevator_queue {
+    const elevator_type_t *type;
+    bio_t *fifo;                 // Arrival order through bio->next
+    bio_t *fifo_tail;
+    bio_t *sorted;               // Ascending start_block through bio->sort_next
+    bio_t *held;                 // The oldest barrier and all bios after it, in arrival order
+    bio_t *held_tail;
+    uint64_t position;           // Block after the last dispatched request
+    block_queue_stats_t *stats;  // Merge and seek counters land here
+};
+
+extern const elevator_type_t elevator_noop;      // Arrival order, no merging
+extern const elevator_type_t elevator_deadline;  // Block order until a bio expires
+extern const elevator_type_t elevator_look;      // Block order in one sweep direction
+
+#define ELEVATOR_READ_EXPIRE_NS  100000000ULL   // Deadline for a queued read
+#define ELEVATOR_WRITE_EXPIRE_NS 1000000000ULL  // Deadline for a queued write
+
+/* Find a policy by name
+ *
+ * @param name: "noop", "deadline" or "look"
+ * @return: The policy, or NULL if unknown
+ */
+const elevator_type_t *elevator_find(const char *name);
+
+void elevator_init(elevator_queue_t *queue, const elevator_type_t *type, block_queue_stats_t *stats);
+void elevator_add(elevator_queue_t *queue, bio_t *bio);
+bool elevator_pending(const elevator_queue_t *queue);
+
+/* Take the next request off the queue
+ *
+ * Overlapping bios are not ordered against each other; a submitter that
+ * cares waits for the first one to complete or marks the later one as a
+ * barrier. A barrier is dispatched alone once everything before it has
+ * been, and only then do the bios after it become eligible.
+ *
+ * @param max_bios: Most bios to merge into the request
+ * @param max_blocks: Most blocks the merged request may cover
+ * @return: The first bio of a chain in block order linked through next,
+ *          or NULL if the queue is empty
+ */
+bio_t *elevator_dispatch(elevator_queue_t *queue, uint32_t max_bios, uint32_t max_blocks);
+
+#endif
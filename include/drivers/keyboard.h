@@ -5,6 +5,7 @@
 
 void keyboard_driver_interrupt_notify(arch_keyboard_device_t *arch_device);
 
+void keyboard_driver_start(void);
 arch_result keyboard_driver_init(void);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,33 @@
+#ifndef RAMDISK_H
+#define RAMDISK_H
+
+#include "arch/arch.h"
+
+#include "kernel/device.h"
+
+#define RAMDISK_BLOCK_SIZE    512
+#define RAMDISK_MAX_DEVICES   2
+#define RAMDISK_MAX_PAGES     128  // Longest page vector behind one disk
+#define RAMDISK_DEFAULT_PAGES 64   // Size of ram0, created at driver init
+
+// Create ram0 from allocator pages
+arch_result ramdisk_driver_init(void);
+
+/* Create a RAM disk from pages of the page allocator
+ *
+ * The pages need not be contiguous; the disk keeps a vector of them.
+ *
+ * @return: The registered device, or NULL if out of pages or devices
+ */
+device_t *ramdisk_create(uint32_t pages);
+
+/* Create a RAM disk over memory that is already filled in, such as an
+ * image the boot loader placed in contiguous pages
+ *
+ * @param image: Mapped memory, owned by the disk from here on
+ * @param size: Bytes; a partial last block is left out
+ * @return: The registered device, or NULL if no device is free
+ */
+device_t *ramdisk_create_image(void *image, uint64_t size);
+
+#endif
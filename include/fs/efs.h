@@ -0,0 +1,168 @@
+#ifndef EFS_H
+#define EFS_H
+
+#include "fs/journal.h"
+#include "kernel/device.h"
+
+/* Extent file system
+
+  Images are built on the host with tools/mkefs.py. All fields are little
+  endian and every file is a list of extents of whole blocks:
+
+  - Block 0: Superblock
+  - inode_table: Inodes of EFS_INODE_SIZE bytes, inode n at offset n * EFS_INODE_SIZE
+  - journal_start: Optional write-ahead journal (fs/journal.c) of journal_blocks
+  - Data: File contents; directories hold EFS_DIRENT_SIZE byte entries,
+    starting with "." and ".."
+
+  File contents are read-only. With a journal, directory entries can be
+  changed, and every change goes through the journal.
+ */
+
+#define EFS_MAGIC      0x31534645  // "EFS1"
+#define EFS_EXTENTS    6           // Extents per inode
+#define EFS_NAME_MAX   57          // Bytes in a name, without the terminator
+#define EFS_INODE_SIZE 64
+#define EFS_DIRENT_SIZE 64
+#define EFS_BLOCK_MAX  4096        // Largest supported block size
+
+#define EFS_TYPE_FILE 1
+#define EFS_TYPE_DIR  2
+
+typedef struct {
+    uint32_t magic;
+    uint32_t block_size;           // Bytes, a power of two from 512 to EFS_BLOCK_MAX
+    uint64_t block_count;
+    uint32_t inode_count;          // Including the unused inode 0
+    uint32_t inode_table;          // First block of the inode table
+    uint32_t root;                 // Inode of the root directory
+    uint32_t journal_start;        // First block of the journal, 0 for none
+    uint32_t journal_blocks;
+    uint32_t reserved[7];
+} efs_super_t;
+
+typedef struct {
+    uint32_t start;                // First block
+    uint32_t count;                // Blocks
+} efs_extent_t;
+
+typedef struct {
+    uint16_t type;                 // EFS_TYPE_*
+    uint16_t extent_count;
+    uint32_t reserved;
+    uint64_t size;                 // Bytes
+    efs_extent_t extents[EFS_EXTENTS];
+} efs_disk_inode_t;
+
+typedef struct {
+    uint32_t inode;                // 0 for an unused slot
+    uint8_t type;
+    uint8_t name_length;
+    char name[EFS_NAME_MAX + 1];
+} efs_disk_dirent_t;
+
+#define EFS_MOUNTS        2
+#define EFS_INODE_CACHE   32       // Inodes kept in memory across all mounts
+#define EFS_INODE_HASH    16
+#define EFS_DENTRY_CACHE  64       // Names resolved to inodes, including misses
+#define EFS_DENTRY_HASH   32
+
+typedef struct efs efs_t;
+typedef struct efs_inode efs_inode_t;
+
+typedef struct {
+    uint16_t type;
+    uint64_t size;
+    uint32_t extent_count;
+} efs_stat_t;
+
+typedef struct {
+    uint32_t inode;
+    uint8_t type;
+    char name[EFS_NAME_MAX + 1];
+} efs_dirent_t;
+
+typedef struct {
+    uint64_t dentry_hits;
+    uint64_t dentry_misses;        // Lookups that scanned a directory
+    uint64_t inode_hits;
+    uint64_t inode_misses;         // Inodes read from the device
+    uint64_t requests;             // Reads handed to the block device
+    uint64_t blocks;               // File system blocks they covered
+} efs_stats_t;
+
+/* Mount the file system on a block device
+ *
+ * @param dev: An open block device, read through its read_blocks operation
+ * @return: The mount, or NULL if the device holds no valid EFS image or
+ *          every mount is in use
+ */
+efs_t *efs_mount(device_t *dev);
+
+/* Drop a mount and its cached names and inodes
+ *
+ * Commits and checkpoints the journal, if there is one.
+ *
+ * @return: ARCH_OK, or ARCH_ERROR while any of its inodes is open
+ */
+arch_result efs_unmount(efs_t *fs);
+
+/* Look up a path and hold its inode
+ *
+ * Paths are relative to the root whether or not they start with '/';
+ * "." and ".." are resolved through the directory entries.
+ *
+ * @return: The inode, or NULL if a component is missing
+ */
+efs_inode_t *efs_open(efs_t *fs, const char *path);
+void efs_close(efs_inode_t *inode);
+
+void efs_stat(const efs_inode_t *inode, efs_stat_t *stat);
+
+/* Read file contents
+ *
+ * Files are read through the page cache, which fills a missing page with
+ * one request per contiguous run of blocks in it. Directories are read
+ * through the block cache, whole blocks straight into buf.
+ *
+ * @return: Bytes read, 0 at the end of the file, -1 on error
+ */
+int efs_read(efs_inode_t *inode, void *buf, uint64_t offset, uint32_t length);
+
+/* Read the index'th entry of a directory
+ *
+ * @return: 1 with *entry filled in (inode 0 for an unused slot), 0 past
+ *          the last entry, -1 on error
+ */
+int efs_readdir(efs_inode_t *dir, uint32_t index, efs_dirent_t *entry);
+
+/* Map a file's contents read-only without copying
+ *
+ * Installs the file's page cache pages in the kernel's file mapping
+ * window. The mapping holds the inode open.
+ *
+ * @return: The contents, valid until efs_munmap, or NULL if the file is
+ *          empty or larger than the page cache
+ */
+const void *efs_mmap(efs_inode_t *inode);
+void efs_munmap(efs_inode_t *inode, const void *address);
+
+/* Rename an entry within a directory
+ *
+ * The change is durable once the journal commits it, on its own after
+ * JOURNAL_COMMIT_NS or at the next efs_sync.
+ *
+ * @return: ARCH_OK, ARCH_UNSUPPORTED without a journal, ARCH_INVALID for a
+ *          bad name, ARCH_ERROR if from is missing, to exists or I/O failed
+ */
+arch_result efs_rename(efs_t *fs, const char *dir, const char *from, const char *to);
+
+// Commit outstanding changes and wait until they are durable
+arch_result efs_sync(efs_t *fs);
+
+// The mount's journal, or NULL
+journal_t *efs_get_journal(efs_t *fs);
+
+const efs_stats_t *efs_get_stats(void);
+
+#endif
@@ -0,0 +1,120 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include "kernel/device.h"
+
+/* Write-ahead block journal
+
+  A journal owns a region of a block device and logs whole blocks of
+  metadata before they reach their home location:
+
+  - Region block 0: Superblock, rewritten only when the log wraps
+  - Then transactions, each a descriptor listing the home blocks, a copy
+    of every block and a commit block with a checksum over the copies
+
+  Operations bracket their changes with journal_start and journal_stop.
+  Their blocks gather in one running transaction until it fills, ages past
+  JOURNAL_COMMIT_NS or is synced, so a single flush covers every operation
+  in it (group commit). The commit block goes out with BIO_BARRIER |
+  BIO_PREFLUSH | BIO_FUA behind the rest of the transaction. Committed
+  blocks are then written to their home location through the device's
+  write_blocks, where the block cache writes them back in its own time.
+ */
+
+#define JOURNAL_MAGIC        0x4C4E524A  // "JRNL"
+#define JOURNAL_DESC_MAGIC   0x4353444A  // "JDSC"
+#define JOURNAL_COMMIT_MAGIC 0x4D4D434A  // "JCMM"
+
+#define JOURNAL_MAX             2
+#define JOURNAL_BUFFERS         16         // Block copies held per journal, one page each
+#define JOURNAL_TRANSACTION_MAX 8          // Blocks in one transaction
+#define JOURNAL_BLOCK_MAX       4096       // Largest block, held in one page
+#define JOURNAL_COMMIT_NS       100000000ULL  // Age at which the timer commits a transaction
+
+typedef struct {
+    uint32_t magic;
+    uint32_t block_size;
+    uint32_t length;                 // Blocks in the region, superblock included
+    uint32_t head;                   // First block of the oldest transaction to replay
+    uint64_t sequence;               // Sequence number of that transaction
+} journal_super_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t count;                  // Blocks logged after the descriptor
+    uint64_t sequence;
+    uint64_t blocks[];               // Home block of each copy
+} journal_descriptor_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t count;
+    uint64_t sequence;
+    uint32_t checksum;               // Over the descriptor and the copies
+} journal_commit_t;
+
+typedef struct {
+    uint64_t handles;                // Operations started
+    uint64_t transactions;           // Commits, each ending in one flush
+    uint64_t blocks;                 // Blocks logged
+    uint64_t absorbed;               // Changes to a block already in the running transaction
+    uint64_t checkpoints;            // Blocks written to their home location
+    uint64_t wraps;                  // Times the log was emptied to start over
+    uint64_t replayed;               // Transactions recovered at open
+    uint64_t errors;
+} journal_stats_t;
+
+typedef struct journal journal_t;
+
+/* Open the journal in a region of a device and replay what it holds
+ *
+ * Transactions committed before a crash are written to their home blocks
+ * and made durable before this returns.
+ *
+ * @param block_size: Bytes per journal and home block, a multiple of the
+ *                    device block size up to JOURNAL_BLOCK_MAX
+ * @param start: First block of the region, in block_size units
+ * @param length: Blocks in the region
+ * @return: The journal, or NULL if the region holds no journal, replay
+ *          failed or memory ran out
+ */
+journal_t *journal_open(device_t *dev, uint32_t block_size, uint64_t start, uint32_t length);
+
+// Commit, checkpoint and release the journal
+arch_result journal_close(journal_t *journal);
+
+/* Begin an operation that changes up to blocks blocks
+ *
+ * Commits the running transaction first if the operation would not fit.
+ *
+ * @return: ARCH_OK, ARCH_INVALID if blocks exceeds JOURNAL_TRANSACTION_MAX,
+ *          or ARCH_ERROR after a failed commit
+ */
+arch_result journal_start(journal_t *journal, uint32_t blocks);
+
+/* Get a block for the current operation to change
+ *
+ * @return: The block's current contents, changed in place until
+ *          journal_stop, or NULL on a read error or past the reservation
+ */
+void *journal_get_block(journal_t *journal, uint64_t block);
+
+// End an operation; its changes commit with the running transaction
+arch_result journal_stop(journal_t *journal);
+
+/* Commit the running transaction and wait until it is durable
+ *
+ * @return: ARCH_OK, or ARCH_ERROR if a journal write failed
+ */
+arch_result journal_sync(journal_t *journal);
+
+/* Copy the newest contents of blocks the journal holds over a read
+ *
+ * Reads of home blocks must pass through this to see changes that have
+ * not been checkpointed.
+ */
+void journal_read(journal_t *journal, void *buf, uint64_t block, uint32_t count);
+
+const journal_stats_t *journal_get_stats(journal_t *journal);
+
+#endif
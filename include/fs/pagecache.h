@@ -0,0 +1,71 @@
+#ifndef PAGECACHE_H
+#define PAGECACHE_H
+
+#include "arch/arch.h"
+#include "lib/radix.h"
+
+/* Page cache
+ *
+ * File contents are cached a page at a time, indexed by page within the
+ * file in a radix tree per file. The pages come from the page allocator,
+ * and mapping a file installs those same pages in the page tables, so a
+ * mapped file and read() share one copy of the data.
+ */
+
+#define PAGECACHE_PAGES 32           // Pages cached across all files
+#define PAGECACHE_MAPS  8            // File mappings at once
+
+typedef struct pagecache_mapping pagecache_mapping_t;
+
+/* Fill a page with file contents from the device
+ *
+ * @param index: Page within the file
+ * @param page: PAGE_SIZE bytes to fill; anything past the end of the file
+ *              must be zeroed
+ */
+typedef arch_result (*pagecache_fill_t)(pagecache_mapping_t *mapping, uint64_t index, void *page);
+
+// The cached pages of one file
+struct pagecache_mapping {
+    radix_tree_t pages;
+    uint32_t count;                  // Pages cached
+    pagecache_fill_t fill;
+    void *owner;                     // For fill
+};
+
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;                 // Pages filled from the device
+    uint64_t evictions;
+    uint64_t mapped;                 // Pages installed in file mappings
+} pagecache_stats_t;
+
+void pagecache_mapping_init(pagecache_mapping_t *mapping, pagecache_fill_t fill, void *owner);
+
+/* Copy file contents through the cache
+ *
+ * @param size: File size in bytes; the read stops there
+ * @return: Bytes copied, or -1 if a page could not be filled
+ */
+int pagecache_read(pagecache_mapping_t *mapping, void *buf, uint64_t offset, uint32_t length, uint64_t size);
+
+/* Map pages of a file into the kernel's file mapping window
+ *
+ * The pages stay cached until the mapping goes away.
+ *
+ * @return: The address of the first page, or NULL if the window or the
+ *          cache has no room
+ */
+const void *pagecache_map(pagecache_mapping_t *mapping, uint64_t first, uint32_t count);
+
+arch_result pagecache_unmap(const void *address);
+
+/* Drop every cached page of a file
+ *
+ * @return: ARCH_OK, or ARCH_ERROR while any of them is mapped
+ */
+arch_result pagecache_truncate(pagecache_mapping_t *mapping);
+
+const pagecache_stats_t *pagecache_get_stats(void);
+
+#endif
@@ -21,6 +21,60 @@ typedef enum {
 
 struct device;
 
+typedef enum {
+    BIO_READ = 0,
+    BIO_WRITE,
+    BIO_FLUSH                    // Make completed writes durable; carries no data
+} bio_op_t;
+
+#define BIO_PREFLUSH (1 << 0)    // Flush the device's write cache before this bio's data
+#define BIO_FUA      (1 << 1)    // Complete a write only once it is on stable media
+#define BIO_BARRIER  (1 << 2)    // Dispatched after every earlier bio and before every later one
+
+/* Block I/O request
+ *
+ * The submitter owns the bio and its buffer until end_io is called, which
+ * may happen from interrupt context and before submit_bio returns.
+ *
+ * Bios are otherwise reordered freely. To commit a journal transaction,
+ * write its blocks, then the commit block with BIO_BARRIER | BIO_PREFLUSH |
+ * BIO_FUA: one bio orders the commit, makes the transaction durable before
+ * it and the commit itself durable before completing.
+ */
+typedef struct bio {
+    bio_op_t op;
+    uint32_t flags;              // BIO_PREFLUSH, BIO_FUA, BIO_BARRIER
+    uint64_t start_block;
+    uint32_t block_count;
+    void *buffer;
+    void (*end_io)(struct bio *bio);
+    void *private;               // Submitter context for end_io
+    int status;                  // 0 on success, -1 on error; valid in end_io
+    uint64_t submit_ns;          // Set by the block layer
+    struct bio *next;            // Queue link, owned by the driver while in flight
+    struct bio *sort_next;       // Block order link, owned by the driver while queued
+} bio_t;
+
+#define BLOCK_DEPTH_BUCKETS   8   // Queue depth seen at submission, last bucket is "or more"
+#define BLOCK_LATENCY_BUCKETS 16  // Bucket i counts latencies below 2^i microseconds
+
+typedef struct {
+    uint64_t submitted;
+    uint64_t completed;
+    uint64_t errors;
+    uint32_t depth;              // Bios queued or in flight
+    uint32_t max_depth;
+    uint64_t depth_histogram[BLOCK_DEPTH_BUCKETS];
+    uint64_t latency_histogram[BLOCK_LATENCY_BUCKETS];
+    uint64_t dispatched;         // Requests handed to the device, merged bios count once
+    uint64_t front_merges;       // Bios merged in front of a dispatched request
+    uint64_t back_merges;        // Bios merged behind a dispatched request
+    uint64_t backward_seeks;     // Dispatches that started below the previous request's end
+    uint64_t seek_blocks;        // Total distance between consecutive dispatches
+    uint64_t flushes;            // Requests that flushed the device cache
+    uint64_t barriers;
+} block_queue_stats_t;
+
 typedef struct {
     int (*read)(struct device *dev, void *buf, size_t len);
     int (*write)(struct device *dev, const void *buf, size_t len);
@@ -33,6 +87,9 @@ typedef struct {
     arch_result (*sync)(struct device *dev);
     uint32_t (*get_block_size)(struct device *dev);
     uint64_t (*get_block_count)(struct device *dev);
+    int (*submit_bio)(struct device *dev, bio_t *bio);
+    const block_queue_stats_t *(*get_stats)(struct device *dev);
+    void *(*map_block)(struct device *dev, uint64_t block);  // Memory-backed devices only, else NULL
 } block_device_ops_t;
 
 typedef struct {
@@ -44,10 +101,14 @@ typedef struct {
     arch_result (*scroll_up)(struct device *dev, uint32_t lines);
 } display_device_ops_t;
 
+#define DEVICE_MAX  64               // Devices registered at once
+#define DEVICE_HASH 32               // Name hash buckets
+
 typedef struct device {
     char name[32];
     device_class_t class;
     device_state_t state;
+    uint32_t id;                     // Assigned at registration; a slot repeats an ID after 2^26 reuses
     
     arch_result (*open)(struct device *dev);
     arch_result (*close)(struct device *dev);
@@ -59,7 +120,7 @@ typedef struct device {
     };
     
     void *driver_data;
-    struct device *next;
+    struct device *hash_next;        // Name hash chain, owned by the registry
 } device_t;
 
 /* Device management API */
@@ -68,9 +129,38 @@ arch_result device_init_drivers(void);
 arch_result device_register(device_t *device);
 arch_result device_unregister(device_t *device);
 device_t* device_find_by_name(const char *name);
+
+// @return: The device registered with this ID, or NULL once it is unregistered, even if its slot was reused
+device_t* device_find_by_id(uint32_t id);
+
+/* Enumerate the ready devices of a class in registration order
+ *
+ * @return: The index'th device, or NULL past the last one
+ */
 device_t* device_find_by_class(device_class_t class, uint32_t index);
+uint32_t device_count_by_class(device_class_t class);
 void device_list_all(void);
 
+/* Format directly into a character device's write operation
+ *
+ * @return: Number of bytes written, or -1 on a device error
+ */
+int device_printf(device_t *dev, const char *format, ...);
+
+/* Queue a bio on a block device
+ *
+ * @return: 0 if queued (end_io will be called), -1 if rejected
+ */
+int submit_bio(device_t *dev, bio_t *bio);
+
+/* Submit a bio and halt until it completes
+ *
+ * Interrupts are enabled while halted.
+ *
+ * @return: The bio status, or -1 if rejected
+ */
+int submit_bio_wait(device_t *dev, bio_t *bio);
+
 const char* device_class_name(device_class_t class);
 const char* device_state_name(device_state_t state);
 
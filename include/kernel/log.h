@@ -0,0 +1,35 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include "definitions.h"
+
+/* Kernel log ring
+ *
+ * Producers (any context, including interrupt handlers) reserve space with
+ * a compare-and-swap on the head, copy their message and then publish it by
+ * setting the committed bit in the record header. A single consumer drains
+ * committed records in order; it must run with interrupts disabled.
+ */
+
+#define LOG_RING_SIZE 8192  // Must be a power of two
+
+/* Append a message to the ring
+ *
+ * @param buf: Message bytes
+ * @param len: Number of bytes
+ * @return: Number of bytes queued, or -1 if the message was dropped
+ */
+int log_write(const char *buf, size_t len);
+
+/* Take up to len committed bytes out of the ring
+ *
+ * Emits a "messages dropped" notice once the queued records have been
+ * consumed if producers overflowed the ring in the meantime.
+ *
+ * @return: Number of bytes copied into buf
+ */
+size_t log_read(char *buf, size_t len);
+
+uint64_t log_dropped(void);
+
+#endif
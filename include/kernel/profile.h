@@ -0,0 +1,29 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "definitions.h"
+
+/* Boot profile
+ *
+ * Each mark ends a boot phase at the current cycle counter reading. The
+ * first phases come from the bootloader's own readings, and since the
+ * counter runs from reset the profile covers the time since power on.
+ */
+
+#define PROFILE_MAX_PHASES 32
+
+// Start the profile with the bootloader's phases
+void profile_init(void);
+
+/* End a phase
+ *
+ * @param name: Phase name, kept by reference
+ */
+void profile_mark(const char *name);
+
+/* Print the phases as a table and as one "Boot profile:" JSON line for
+ * tools/bootprof.py
+ */
+void profile_report(void);
+
+#endif
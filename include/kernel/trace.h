@@ -0,0 +1,73 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "definitions.h"
+
+/* Binary event trace
+ *
+ * Fixed-size records stamped with the CPU cycle counter are written into a
+ * per-CPU ring that overwrites its oldest entries. Recording is a couple of
+ * stores, cheap enough for interrupt and I/O paths; decoding happens on the
+ * host (tools/trace2json.py).
+ */
+
+#define TRACE_MAX_CPUS     1
+#define TRACE_RING_RECORDS 2048  // Per CPU, must be a power of two
+
+#define TRACE_MAGIC   0x31435254  // "TRC1"
+#define TRACE_VERSION 1
+
+typedef enum {
+    TRACE_NONE = 0,
+    TRACE_IRQ_ENTRY,         // arg0: vector
+    TRACE_IRQ_EXIT,          // arg0: vector
+    TRACE_DEVICE_REGISTER,   // arg0: device class, arg1: first 8 bytes of the name
+    TRACE_DISK_READ,         // arg0: start block, arg1: block count
+    TRACE_DISK_READ_DONE,    // arg0: start block, arg1: result
+    TRACE_DISK_WRITE,        // arg0: start block, arg1: block count
+    TRACE_DISK_WRITE_DONE,   // arg0: start block, arg1: result
+    TRACE_KEYBOARD,          // arg0: unicode, arg1: logical key | pressed << 16
+    TRACE_EVENT_MAX
+} trace_event_t;
+
+typedef struct {
+    uint64_t timestamp;  // arch_cycles()
+    uint16_t event;
+    uint16_t cpu;
+    uint32_t reserved;
+    uint64_t arg0;
+    uint64_t arg1;
+} trace_record_t;
+
+/* Dump stream header, followed by record_count trace_record_t in time order per CPU */
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;
+    uint32_t cpu_count;
+    uint32_t record_count;
+    uint64_t cycles_per_second;  // 0 if not calibrated
+} trace_dump_header_t;
+
+extern bool trace_enabled;
+
+void trace_init(void);
+void trace_record(uint16_t event, uint64_t arg0, uint64_t arg1);
+
+static inline void trace_event(uint16_t event, uint64_t arg0, uint64_t arg1)
+{
+    if (trace_enabled) {
+        trace_record(event, arg0, arg1);
+    }
+}
+
+/* Write the trace rings to a character device (e.g. "/dev/serial1")
+ *
+ * Tracing is paused while the rings are copied out.
+ *
+ * @param fd: Descriptor opened for writing with vfs_open
+ * @return: Number of records written, or -1 on a device error
+ */
+int trace_dump(int fd);
+
+#endif
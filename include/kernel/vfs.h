@@ -0,0 +1,99 @@
+#ifndef VFS_H
+#define VFS_H
+
+#include "fs/efs.h"
+#include "kernel/device.h"
+
+/* Virtual file system
+ *
+ * Paths under /dev name registered devices; every other path resolves in
+ * the file system mounted with vfs_mount. Opening resolves the name once
+ * and returns a file descriptor that indexes the open file table, so each
+ * later call goes straight to the file's operations.
+ */
+
+#define VFS_MAX_FILES 32
+#define VFS_BLOCK_MAX 4096           // Largest device block read or written in part
+
+#define VFS_READ  (1 << 0)
+#define VFS_WRITE (1 << 1)
+
+typedef enum {
+    VFS_SEEK_SET = 0,
+    VFS_SEEK_CUR,
+    VFS_SEEK_END
+} vfs_whence_t;
+
+typedef enum {
+    VFS_TYPE_FILE = 0,
+    VFS_TYPE_DIR,
+    VFS_TYPE_CHAR,
+    VFS_TYPE_BLOCK,
+    VFS_TYPE_DISPLAY
+} vfs_type_t;
+
+typedef struct {
+    vfs_type_t type;
+    uint64_t size;                   // Bytes; 0 for character and display devices
+    uint32_t block_size;             // Block devices only
+} vfs_stat_t;
+
+typedef struct {
+    vfs_type_t type;
+    char name[EFS_NAME_MAX + 1];
+} vfs_dirent_t;
+
+/* Open a file, directory or device
+ *
+ * Devices are opened through their open operation and closed again when
+ * the last descriptor goes away.
+ *
+ * @param flags: VFS_READ and/or VFS_WRITE
+ * @return: A file descriptor, or -1 if the path does not resolve, the
+ *          flags are not supported or the table is full
+ */
+int vfs_open(const char *path, uint32_t flags);
+int vfs_close(int fd);
+
+/* Read or write at the file offset and advance it
+ *
+ * Block devices take any offset and length; whole aligned blocks go to the
+ * driver in a single call and only partial blocks are bounced.
+ *
+ * @return: Bytes transferred, 0 at the end, -1 on error
+ */
+int vfs_read(int fd, void *buf, uint32_t length);
+int vfs_write(int fd, const void *buf, uint32_t length);
+
+// Read at an offset without moving the file offset
+int vfs_pread(int fd, void *buf, uint32_t length, uint64_t offset);
+
+// @return: The new offset, or -1
+int64_t vfs_seek(int fd, int64_t offset, vfs_whence_t whence);
+
+int vfs_stat(int fd, vfs_stat_t *stat);
+
+/* Read the next entry of a directory opened with vfs_open
+ *
+ * @return: 1 with *entry filled in, 0 past the last entry, -1 on error
+ */
+int vfs_readdir(int fd, vfs_dirent_t *entry);
+
+/* Format into a file
+ *
+ * @return: Number of bytes written, or -1 on error
+ */
+int vfs_printf(int fd, const char *format, ...);
+
+/* Mount an EFS image from a block device as the root of the namespace
+ *
+ * @param device: Path of the device, such as "/dev/ata1"
+ * @return: The mount, or NULL if the device holds no image or a root is
+ *          already mounted
+ */
+efs_t *vfs_mount(const char *device);
+
+// @return: ARCH_OK, or ARCH_ERROR while files of the root are open
+arch_result vfs_unmount(void);
+
+#endif
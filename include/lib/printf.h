@@ -8,4 +8,18 @@
 
 int vsnprintf(int8_t *s, uint32_t n, const int8_t *format, va_list args);
 
+/* Receives formatted output in runs of up to PRINTF_BUFFER_SIZE bytes
+ *
+ * @return: Negative to abort formatting
+ */
+typedef int (*printf_sink)(void *context, const char *buf, size_t len);
+
+/* Format straight into a sink instead of a caller-sized buffer
+ *
+ * Output is not truncated; long results reach the sink as several runs.
+ *
+ * @return: Number of bytes passed to the sink, or -1 if the sink failed
+ */
+int vcbprintf(printf_sink sink, void *context, const char *format, va_list args);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,43 @@
+#ifndef RADIX_H
+#define RADIX_H
+
+#include "definitions.h"
+#include "arch/arch.h"
+
+/* Radix tree
+ *
+ * Maps 64-bit indices to pointers with RADIX_BITS of the index per level.
+ * The tree is only as tall as its largest index needs, so the pages of a
+ * small file sit in a single node. Nodes come from a static pool shared
+ * by every tree.
+ */
+
+#define RADIX_BITS  4
+#define RADIX_SLOTS (1 << RADIX_BITS)
+#define RADIX_NODES 64               // Nodes shared by all trees
+
+typedef struct radix_node radix_node_t;
+
+typedef struct {
+    radix_node_t *root;
+    uint32_t height;                 // Levels below root; 0 for an empty tree
+} radix_tree_t;
+
+#define RADIX_TREE_INIT { NULL, 0 }
+
+void *radix_lookup(const radix_tree_t *tree, uint64_t index);
+
+/* Store an item at an index
+ *
+ * @return: ARCH_OK, ARCH_INVALID if the index is taken or item is NULL, or
+ *          ARCH_ERROR if the node pool ran out
+ */
+arch_result radix_insert(radix_tree_t *tree, uint64_t index, void *item);
+
+/* Remove the item at an index, releasing nodes that become empty
+ *
+ * @return: The item, or NULL if there was none
+ */
+void *radix_delete(radix_tree_t *tree, uint64_t index);
+
+#endif
@@ -5,7 +5,27 @@
 #include "arch/x86_64/memory.h"
 
 uint64_t strlen(const char *str);
+size_t strnlen(const char *str, size_t n);
 int strcmp(const char *s1, const char *s2);
 char *strncpy(char *dest, const char *src, size_t n);
+void *memchr(const void *ptr, int c, size_t n);
+int memcmp(const void *ptr1, const void *ptr2, size_t n);
+
+/* Scanning routines with architecture-specific variants
+ *
+ * The portable word-at-a-time versions are used until the architecture
+ * installs faster ones during boot.
+ */
+typedef struct {
+	uint64_t (*strlen)(const char *str);
+	int (*strcmp)(const char *s1, const char *s2);
+	void *(*memchr)(const void *ptr, int c, size_t n);
+} string_ops_t;
+
+/* Select the scanning routines
+ *
+ * @param ops: Routines to use, or NULL for the portable ones
+ */
+void string_set_ops(const string_ops_t *ops);
 
 #endif
@@ -1,15 +1,37 @@
 #include "kernel/device.h"
+#include "kernel/profile.h"
+#include "kernel/trace.h"
 #include "lib/string.h"
+#include "lib/printf.h"
 #include "arch/arch.h"
 #include "drivers/serial.h"
 #include "drivers/keyboard.h"
 #include "drivers/parallel.h"
 #include "drivers/audio.h"
 #include "drivers/disk.h"
+#include "drivers/ramdisk.h"
+#include "drivers/bcache.h"
 #include "drivers/display.h"
 #include "drivers/console.h"
 
-static device_t *device_list_head = NULL;
+/* Device registry
+ *
+ * A device lives in a slot of device_ids. Unregistering puts the slot on a
+ * free list for the next registration, and bumps the slot's generation.
+ * The ID is the generation times DEVICE_MAX plus the slot, so an ID kept
+ * past unregistration no longer matches the slot's next device.
+ * Names are found through a hash table and ready devices of each class
+ * are kept in a dense array, so neither lookups nor enumeration scan the
+ * other devices.
+ */
+static device_t *device_ids[DEVICE_MAX];
+static uint32_t device_generations[DEVICE_MAX];
+static uint8_t device_free_slots[DEVICE_MAX];  // Freed slots, reused last in first out
+static uint32_t device_free_count = 0;
+static uint32_t device_slots_used = 0;         // Slots handed out so far; the rest have never held a device
+static device_t *device_hash[DEVICE_HASH];
+static device_t *device_classes[DEVICE_CLASS_MAX][DEVICE_MAX];
+static uint32_t device_class_counts[DEVICE_CLASS_MAX];
 static uint32_t device_count = 0;
 static bool device_subsystem_initialized = false;
 
@@ -27,13 +49,53 @@ static const char *device_state_names[] = {
     [DEVICE_STATE_REMOVED] = "removed"
 };
 
+enum {
+    DRIVER_SERIAL,
+    DRIVER_PARALLEL,
+    DRIVER_KEYBOARD,
+    DRIVER_AUDIO,
+    DRIVER_DISK,
+    DRIVER_RAMDISK,
+    DRIVER_DISPLAY,
+    DRIVER_CONSOLE,
+    DRIVER_COUNT
+};
+
+#define DRIVER(index) (1u << (index))
+
+typedef struct {
+    const char *name;
+    void (*start)(void);             // Begins slow hardware waits for init to collect, NULL if none
+    arch_result (*init)(void);
+    uint32_t depends;                // DRIVER() bits of the drivers that must initialize first
+} device_driver_t;
+
+/* Drivers and the drivers whose devices they use
+ *
+ * A driver is only started once everything it depends on has initialized,
+ * and is skipped if any of it failed. Every start hook runs before the
+ * first init, so the keyboard self-test and the ATA IDENTIFYs run while
+ * the drivers ahead of them initialize.
+ */
+static const device_driver_t device_drivers[DRIVER_COUNT] = {
+    [DRIVER_SERIAL]   = { "serial",   NULL,                  serial_driver_init,   0 },
+    [DRIVER_PARALLEL] = { "parallel", NULL,                  parallel_driver_init, 0 },
+    [DRIVER_KEYBOARD] = { "keyboard", keyboard_driver_start, keyboard_driver_init, 0 },
+    [DRIVER_AUDIO]    = { "audio",    NULL,                  audio_driver_init,    0 },
+    [DRIVER_DISK]     = { "disk",     disk_driver_start,     disk_driver_init,     0 },
+    [DRIVER_RAMDISK]  = { "ramdisk",  NULL,                  ramdisk_driver_init,  0 },
+    [DRIVER_DISPLAY]  = { "display",  NULL,                  display_driver_init,  0 },
+    [DRIVER_CONSOLE]  = { "console",  NULL,                  console_driver_init,  DRIVER(DRIVER_DISPLAY) },  // Writes to vga0
+};
+
 arch_result device_init(void)
 {
     if (device_subsystem_initialized) {
         return ARCH_OK;
     }
     
-    device_list_head = NULL;
+    device_slots_used = 0;
+    device_free_count = 0;
     device_count = 0;
     device_subsystem_initialized = true;
     
@@ -48,33 +110,82 @@ arch_result device_init_drivers(void)
     }
     
     arch_debug_printf("Initializing device drivers...\n");
-    
-    arch_result results[] = {
-        serial_driver_init(),
-        parallel_driver_init(), 
-        keyboard_driver_init(),
-        audio_driver_init(),
-        disk_driver_init(),
-        display_driver_init(),
-        console_driver_init()
-    };
-    
-    const char *driver_names[] = {
-        "serial", "parallel", "keyboard", "audio", "disk", "display", "console"
-    };
-    
+
+    uint32_t initialized = 0, failed = 0;
     int failed_count = 0;
-    for (int i = 0; i < 7; i++) {
-        if (results[i] != ARCH_OK) {
-            arch_debug_printf("❌ %s driver failed\n", driver_names[i]);
+    bool progress = true;
+
+    uint64_t probe_ns = arch_time_ns();
+    for (int i = 0; i < DRIVER_COUNT; i++) {
+        if (device_drivers[i].start) {
+            device_drivers[i].start();
+        }
+    }
+    profile_mark("probe start");
+    arch_debug_printf("  probes started: %lu us\n", (arch_time_ns() - probe_ns) / 1000);
+
+    // Each pass starts every driver whose dependencies have all finished, in table order
+    while (progress) {
+        progress = false;
+
+        for (int i = 0; i < DRIVER_COUNT; i++) {
+            const device_driver_t *driver = &device_drivers[i];
+            uint32_t finished = initialized | failed;
+
+            if ((finished & DRIVER(i)) || (driver->depends & ~finished)) {
+                continue;
+            }
+            progress = true;
+
+            if (driver->depends & failed) {
+                arch_debug_printf("❌ %s driver skipped: a dependency failed\n", driver->name);
+                failed |= DRIVER(i);
+                failed_count++;
+                continue;
+            }
+
+            uint64_t start_ns = arch_time_ns();
+            uint64_t start_cycles = arch_cycles();
+            arch_result result = driver->init();
+            uint64_t cycles = arch_cycles() - start_cycles;
+            uint64_t us = (arch_time_ns() - start_ns) / 1000;
+            profile_mark(driver->name);
+
+            if (result == ARCH_OK) {
+                initialized |= DRIVER(i);
+                arch_debug_printf("  %s driver: %lu us, %lu cycles\n", driver->name, us, cycles);
+            } else {
+                failed |= DRIVER(i);
+                failed_count++;
+                arch_debug_printf("❌ %s driver failed after %lu us, %lu cycles\n", driver->name, us, cycles);
+            }
+        }
+    }
+
+    // Whatever is left waits on itself through a cycle
+    for (int i = 0; i < DRIVER_COUNT; i++) {
+        if (!((initialized | failed) & DRIVER(i))) {
+            arch_debug_printf("❌ %s driver skipped: dependency cycle\n", device_drivers[i].name);
             failed_count++;
         }
     }
     
-    arch_debug_printf("Device drivers initialized (%d/%d successful)\n", 7 - failed_count, 7);
+    arch_debug_printf("Device drivers initialized (%d/%d successful)\n", DRIVER_COUNT - failed_count, DRIVER_COUNT);
     return (failed_count == 0) ? ARCH_OK : ARCH_ERROR;
 }
 
+// FNV-1a
+static uint32_t device_name_hash(const char *name)
+{
+    uint32_t hash = 2166136261u;
+
+    while (*name) {
+        hash = (hash ^ (uint8_t)*name++) * 16777619u;
+    }
+
+    return hash % DEVICE_HASH;
+}
+
 arch_result device_register(device_t *device)
 {
     if (!device_subsystem_initialized) {
@@ -93,19 +204,27 @@ arch_result device_register(device_t *device)
     if (device->class >= DEVICE_CLASS_MAX) {
         return ARCH_INVALID;
     }
+
+    if (device_free_count == 0 && device_slots_used == DEVICE_MAX) {
+        arch_debug_printf("Device '%s': registry full\n", device->name);
+        return ARCH_ERROR;
+    }
     
-    device->state = DEVICE_STATE_INITIALIZING;
-    device->next = NULL;
-    
-    if (device_list_head == NULL) {
-        device_list_head = device;
-    } else {
-        device_t *current = device_list_head;
-        while (current->next != NULL) {
-            current = current->next;
-        }
-        current->next = device;
+    uint64_t name_prefix = 0;
+    for (int i = 0; i < 8 && device->name[i]; i++) {
+        name_prefix |= (uint64_t)(uint8_t)device->name[i] << (i * 8);
     }
+    trace_event(TRACE_DEVICE_REGISTER, device->class, name_prefix);
+
+    uint32_t slot = device_free_count ? device_free_slots[--device_free_count] : device_slots_used++;
+
+    device->state = DEVICE_STATE_INITIALIZING;
+    device->id = device_generations[slot] * DEVICE_MAX + slot;
+    device_ids[slot] = device;
+
+    uint32_t bucket = device_name_hash(device->name);
+    device->hash_next = device_hash[bucket];
+    device_hash[bucket] = device;
     
     device_count++;
     
@@ -121,6 +240,8 @@ arch_result device_register(device_t *device)
     } else {
         device->state = DEVICE_STATE_READY;
     }
+
+    device_classes[device->class][device_class_counts[device->class]++] = device;
     
     arch_debug_printf("Registered %s device '%s'\n",
                      device_class_name(device->class), device->name);
@@ -134,17 +255,33 @@ arch_result device_unregister(device_t *device)
         return ARCH_INVALID;
     }
     
-    if (device_list_head == device) {
-        device_list_head = device->next;
-    } else {
-        device_t *current = device_list_head;
-        while (current && current->next != device) {
-            current = current->next;
+    uint32_t slot = device->id % DEVICE_MAX;
+
+    if (device_ids[slot] != device) {
+        return ARCH_ERROR;
+    }
+
+    device_ids[slot] = NULL;
+    device_generations[slot]++;  // The ID wraps in 32 bits but keeps the slot in its low bits
+    device_free_slots[device_free_count++] = slot;
+
+    device_t **link = &device_hash[device_name_hash(device->name)];
+    while (*link != device) {
+        link = &(*link)->hash_next;
+    }
+    *link = device->hash_next;
+
+    // Close the gap so the class stays in registration order
+    if (device->state == DEVICE_STATE_READY) {
+        device_t **class = device_classes[device->class];
+        uint32_t count = device_class_counts[device->class]--;
+        uint32_t i = 0;
+
+        while (class[i] != device) {
+            i++;
         }
-        if (current) {
-            current->next = device->next;
-        } else {
-            return ARCH_ERROR;
+        for (; i + 1 < count; i++) {
+            class[i] = class[i + 1];
         }
     }
     
@@ -165,37 +302,43 @@ device_t* device_find_by_name(const char *name)
         return NULL;
     }
     
-    device_t *current = device_list_head;
+    device_t *current = device_hash[device_name_hash(name)];
     while (current) {
         if (strcmp(current->name, name) == 0) {
             return current;
         }
-        current = current->next;
+        current = current->hash_next;
     }
     
     return NULL;
 }
 
+device_t* device_find_by_id(uint32_t id)
+{
+    if (!device_subsystem_initialized) {
+        return NULL;
+    }
+
+    device_t *device = device_ids[id % DEVICE_MAX];
+    return device && device->id == id ? device : NULL;
+}
+
 device_t* device_find_by_class(device_class_t class, uint32_t index)
 {
     if (!device_subsystem_initialized || class >= DEVICE_CLASS_MAX) {
         return NULL;
     }
     
-    uint32_t found_count = 0;
-    device_t *current = device_list_head;
-    
-    while (current) {
-        if (current->class == class && current->state == DEVICE_STATE_READY) {
-            if (found_count == index) {
-                return current;
-            }
-            found_count++;
-        }
-        current = current->next;
+    return index < device_class_counts[class] ? device_classes[class][index] : NULL;
+}
+
+uint32_t device_count_by_class(device_class_t class)
+{
+    if (!device_subsystem_initialized || class >= DEVICE_CLASS_MAX) {
+        return 0;
     }
-    
-    return NULL;
+
+    return device_class_counts[class];
 }
 
 void device_list_all(void)
@@ -207,14 +350,98 @@ void device_list_all(void)
     
     arch_debug_printf("Registered devices (%u total):\n", device_count);
     
-    device_t *current = device_list_head;
-    while (current) {
-        arch_debug_printf("  %s: %s device, state=%s\n",
-                         current->name,
+    for (uint32_t slot = 0; slot < device_slots_used; slot++) {
+        device_t *current = device_ids[slot];
+        if (!current) {
+            continue;
+        }
+
+        arch_debug_printf("  %u %s: %s device, state=%s\n",
+                         current->id, current->name,
                          device_class_name(current->class),
                          device_state_name(current->state));
-        current = current->next;
+
+        if (current->class == DEVICE_CLASS_BLOCK && current->block_ops.get_stats) {
+            const block_queue_stats_t *stats = current->block_ops.get_stats(current);
+
+            arch_debug_printf("    %lu bios, %lu errors, max depth %u\n",
+                             stats->completed, stats->errors, stats->max_depth);
+            arch_debug_printf("    %lu requests, %lu front and %lu back merges, %lu backward seeks, %lu blocks seeked\n",
+                             stats->dispatched, stats->front_merges, stats->back_merges,
+                             stats->backward_seeks, stats->seek_blocks);
+            arch_debug_printf("    %lu cache flushes, %lu barriers\n", stats->flushes, stats->barriers);
+            for (int i = 0; i < BLOCK_LATENCY_BUCKETS; i++) {
+                if (stats->latency_histogram[i]) {
+                    arch_debug_printf("    < %lu us: %lu\n", 1UL << i, stats->latency_histogram[i]);
+                }
+            }
+        }
+    }
+
+    const bcache_stats_t *cache = bcache_get_stats();
+    arch_debug_printf("Block cache: %lu hits, %lu misses, %lu writebacks, %lu evictions\n",
+                     cache->hits, cache->misses, cache->writebacks, cache->evictions);
+    arch_debug_printf("Block cache: %lu blocks read ahead, %lu used, %lu mapped in place\n",
+                     cache->readahead, cache->readahead_hits, cache->mapped);
+}
+
+static int device_sink(void *context, const char *buf, size_t len)
+{
+    device_t *dev = context;
+    return dev->char_ops.write(dev, buf, len) == (int)len ? 0 : -1;
+}
+
+int device_printf(device_t *dev, const char *format, ...)
+{
+    if (!dev || dev->class != DEVICE_CLASS_CHAR || !dev->char_ops.write) {
+        return -1;
+    }
+
+    va_list args;
+    va_start(args, format);
+
+    int result = vcbprintf(device_sink, dev, format, args);
+
+    va_end(args);
+
+    return result;
+}
+
+int submit_bio(device_t *dev, bio_t *bio)
+{
+    if (!dev || !bio || dev->class != DEVICE_CLASS_BLOCK || !dev->block_ops.submit_bio) {
+        return -1;
     }
+
+    return dev->block_ops.submit_bio(dev, bio);
+}
+
+static void bio_wait_end_io(bio_t *bio)
+{
+    *(volatile bool *)bio->private = true;
+}
+
+int submit_bio_wait(device_t *dev, bio_t *bio)
+{
+    volatile bool done = false;
+
+    if (!bio) {
+        return -1;
+    }
+
+    bio->end_io = bio_wait_end_io;
+    bio->private = (void *)&done;
+
+    uint64_t state = arch_interrupt_save();
+
+    int result = submit_bio(dev, bio);
+    while (result == 0 && !done) {
+        arch_interrupt_wait();
+    }
+
+    arch_interrupt_restore(state);
+
+    return result == 0 ? bio->status : result;
 }
 
 const char* device_class_name(device_class_t class)
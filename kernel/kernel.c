@@ -1,20 +1,215 @@
 #include "board/board.h"
+#include "drivers/bcache.h"
+#include "fs/efs.h"
+#include "fs/pagecache.h"
 #include "kernel/device.h"
+#include "kernel/profile.h"
+#include "kernel/trace.h"
+#include "kernel/vfs.h"
 #include "lib/string.h"
 
+#define BENCH_CHUNK_BLOCKS 4     // Blocks per read, small enough to go through the cache
+#define BENCH_MAX_BLOCKS   1024  // Span of the disk that is read
+#define SCRATCH_BLOCKS     64    // Past the cache's bypass size, so both directions reach the device
+#define SCRATCH_START      2048  // Clear of the blocks the benchmark cached
+
+static uint8_t scratch_out[SCRATCH_BLOCKS * 512];
+static uint8_t scratch_in[SCRATCH_BLOCKS * 512];
+
+// Time reads of the start of a disk in order and at random, reporting KiB/s, IOPS and CPU use
+static void disk_benchmark(int disk, const char *path)
+{
+	uint8_t buffer[BENCH_CHUNK_BLOCKS * 512];
+	vfs_stat_t stat;
+
+	if (vfs_stat(disk, &stat) != 0 || stat.block_size == 0 || stat.block_size > 512) {
+		return;
+	}
+
+	uint32_t block_size = stat.block_size;
+	uint64_t blocks = stat.size / block_size;
+	if (blocks < BENCH_CHUNK_BLOCKS * 2) {
+		return;
+	}
+	if (blocks > BENCH_MAX_BLOCKS) {
+		blocks = BENCH_MAX_BLOCKS;
+	}
+
+	uint64_t chunks = blocks / BENCH_CHUNK_BLOCKS;
+	uint64_t bytes = chunks * BENCH_CHUNK_BLOCKS * block_size;
+	uint64_t seed = arch_cycles();
+	uint64_t elapsed_ns[2];
+	uint64_t busy_percent[2];
+
+	for (int pass = 0; pass < 2; pass++) {
+		uint64_t start_ns = arch_time_ns();
+		uint64_t start_cycles = arch_cycles();
+		uint64_t start_idle = arch_idle_cycles();
+
+		for (uint64_t i = 0; i < chunks; i++) {
+			uint64_t chunk = i;
+			if (pass == 1) {
+				seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+				chunk = (seed >> 33) % chunks;
+			}
+
+			uint32_t length = BENCH_CHUNK_BLOCKS * block_size;
+			if (vfs_pread(disk, buffer, length, chunk * length) != (int)length) {
+				arch_debug_printf("Disk benchmark: read failed at block %lu\n", chunk * BENCH_CHUNK_BLOCKS);
+				return;
+			}
+		}
+
+		elapsed_ns[pass] = arch_time_ns() - start_ns;
+
+		// Time halted waiting for the disk is time the CPU had free, which is what DMA buys over PIO
+		uint64_t cycles = arch_cycles() - start_cycles;
+		uint64_t idle = arch_idle_cycles() - start_idle;
+		busy_percent[pass] = cycles ? (cycles - idle) * 100 / cycles : 0;
+	}
+
+	for (int pass = 0; pass < 2; pass++) {
+		uint64_t us = elapsed_ns[pass] / 1000 ? elapsed_ns[pass] / 1000 : 1;
+		arch_debug_printf("Disk benchmark: %s %s %lu KiB in %lu us, %lu KiB/s, %lu IOPS, CPU %lu%%\n",
+				  path, pass ? "random" : "sequential", bytes / 1024, us,
+				  bytes * 1000000 / 1024 / us, chunks * 1000000 / us, busy_percent[pass]);
+	}
+}
+
+// Write a pattern to a scratch disk in one request and check it reads back
+static void scratch_test(const char *path)
+{
+	int disk = vfs_open(path, VFS_READ | VFS_WRITE);
+	if (disk < 0) {
+		return;
+	}
+
+	uint64_t offset = SCRATCH_START * 512;
+	uint32_t length = sizeof(scratch_out);
+	vfs_stat_t stat;
+	if (vfs_stat(disk, &stat) != 0 || stat.block_size != 512 || stat.size < offset + length) {
+		vfs_close(disk);
+		return;
+	}
+
+	uint32_t seed = (uint32_t)arch_cycles();
+	for (uint32_t i = 0; i < length; i++) {
+		seed = seed * 1103515245 + 12345;
+		scratch_out[i] = seed >> 16;
+	}
+	arch_memory_set(scratch_in, 0, length);
+
+	vfs_seek(disk, offset, VFS_SEEK_SET);
+	uint64_t start_ns = arch_time_ns();
+	int written = vfs_write(disk, scratch_out, length);
+	uint64_t write_us = (arch_time_ns() - start_ns) / 1000;
+	start_ns = arch_time_ns();
+	int read = vfs_pread(disk, scratch_in, length, offset);
+	uint64_t read_us = (arch_time_ns() - start_ns) / 1000;
+	vfs_close(disk);
+
+	if (written != (int)length || read != (int)length) {
+		arch_debug_printf("❌ %s scratch test: wrote %d, read %d of %u bytes\n", path, written, read, length);
+	} else if (arch_memory_compare(scratch_out, scratch_in, length) != 0) {
+		arch_debug_printf("❌ %s scratch test: data read back differs\n", path);
+	} else {
+		arch_debug_printf("%s scratch test: %u KiB written in %lu us, read back in %lu us\n",
+				  path, length / 1024, write_us, read_us);
+	}
+}
+
+// Mount the root image, list its root directory and print /motd
+static void fs_test(const char *device)
+{
+	efs_t *fs = vfs_mount(device);
+	if (!fs) {
+		arch_debug_printf("File system: no EFS image on %s\n", device);
+		return;
+	}
+
+	int root = vfs_open("/", VFS_READ);
+	vfs_dirent_t entry;
+	while (vfs_readdir(root, &entry) > 0) {
+		arch_debug_printf("File system: %s/%s%s\n", device, entry.name, entry.type == VFS_TYPE_DIR ? "/" : "");
+	}
+	vfs_close(root);
+
+	char text[256];
+	int fd = vfs_open("/motd", VFS_READ);
+	int bytes = vfs_read(fd, text, sizeof(text) - 1);
+	if (bytes >= 0) {
+		text[bytes] = '\0';
+		arch_debug_printf("%s", text);
+	}
+	vfs_close(fd);
+
+	// The mapping is the page read() just copied from
+	efs_inode_t *motd = efs_open(fs, "/motd");
+	const char *mapped = motd ? efs_mmap(motd) : NULL;
+	if (mapped) {
+		arch_debug_printf("File system: /motd mapped at %p, %s\n", mapped,
+				  bytes >= 0 && memcmp(mapped, text, bytes) == 0 ? "matches read" : "differs from read");
+		efs_munmap(motd, mapped);
+	}
+	efs_close(motd);
+
+	const pagecache_stats_t *pages = pagecache_get_stats();
+	arch_debug_printf("Page cache: %lu hits %lu misses %lu evictions, %lu pages mapped\n",
+			  pages->hits, pages->misses, pages->evictions, pages->mapped);
+
+	const efs_stats_t *stats = efs_get_stats();
+	arch_debug_printf("File system: dentry %lu hits %lu misses, inode %lu hits %lu misses, "
+			  "%lu requests for %lu blocks\n",
+			  stats->dentry_hits, stats->dentry_misses, stats->inode_hits, stats->inode_misses,
+			  stats->requests, stats->blocks);
+
+	vfs_unmount();
+}
+
+// Rename /motd away and back through the journal; both land in the same transaction
+static void journal_test(const char *device)
+{
+	efs_t *fs = vfs_mount(device);
+	journal_t *journal = fs ? efs_get_journal(fs) : NULL;
+	if (!journal) {
+		if (fs) {
+			vfs_unmount();
+		}
+		return;
+	}
+
+	if (efs_rename(fs, "/", "motd", "motd.old") != ARCH_OK || efs_rename(fs, "/", "motd.old", "motd") != ARCH_OK ||
+	    efs_sync(fs) != ARCH_OK) {
+		arch_debug_printf("File system: journaled rename failed\n");
+	}
+
+	const journal_stats_t *log = journal_get_stats(journal);
+	arch_debug_printf("Journal: %lu operations in %lu transactions, %lu blocks logged, "
+			  "%lu checkpointed, %lu replayed\n",
+			  log->handles, log->transactions, log->blocks, log->checkpoints, log->replayed);
+
+	vfs_unmount();
+}
+
 void kernel(void)
 {
+	profile_init();
+
 	arch_result result = arch_init();
 	if (result != ARCH_OK) {
 		arch_halt();
 	}
+	profile_mark("arch init");
 
 	result = board_init();
 	if (result != ARCH_OK) {
 		arch_halt();
 	}
+	profile_mark("board init");
 
 	arch_interrupt_enable();
+
+	trace_init();
 	
 	// Initialize device subsystem
 	result = device_init();
@@ -22,6 +217,7 @@ void kernel(void)
 		arch_debug_printf("Device subsystem initialization failed\n");
 		arch_halt();
 	}
+	profile_mark("device init");
 	
 	// Initialize all device drivers
 	result = device_init_drivers();
@@ -33,26 +229,58 @@ void kernel(void)
 	arch_debug_printf("🧪 Running device tests...\n");
 	
 	// Test 1: Console device
-	device_t *console = device_find_by_name("console0");
-	if (console && console->open(console) == ARCH_OK) {
-		console->char_ops.write(console, "Console: VGA text mode working\n", 30);
-		console->close(console);
+	int console = vfs_open("/dev/console0", VFS_WRITE);
+	if (console >= 0 && vfs_printf(console, "Console: VGA text mode working\n") > 0) {
+		vfs_close(console);
 	} else {
 		arch_debug_printf("❌ Console test failed\n");
 		arch_halt();
 	}
 	
 	// Test 2: Block device
-	device_t *disk = device_find_by_name("ata0");
-	if (disk && disk->open(disk) == ARCH_OK) {
-		disk->close(disk);
+	int disk = vfs_open("/dev/ata0", VFS_READ);
+	if (disk >= 0) {
+		bcache_set_readahead(false);
+		disk_benchmark(disk, "/dev/ata0 without read-ahead");
+		bcache_set_readahead(true);
+		disk_benchmark(disk, "/dev/ata0");
+		vfs_close(disk);
 	} else {
 		arch_debug_printf("❌ Disk test failed\n");
 		arch_halt();
 	}
+
+	// Same run on a virtio disk when one is attached and on the RAM disk, for comparison
+	const char *baselines[] = { "/dev/vda", "/dev/ram0" };
+	for (int i = 0; i < 2; i++) {
+		int other = vfs_open(baselines[i], VFS_READ);
+		if (other >= 0) {
+			disk_benchmark(other, baselines[i]);
+			vfs_close(other);
+		}
+	}
+	scratch_test("/dev/vda");
 	
+	// Test 3: File system on the root image
+	fs_test("/dev/ata1");
+
+	profile_mark("device tests");
+
 	device_list_all();
+
+	// Binary trace goes out on the second serial line so it does not mix with the log
+	int trace_port = vfs_open("/dev/serial1", VFS_WRITE);
+	if (trace_port >= 0) {
+		int records = trace_dump(trace_port);
+		arch_debug_printf("Trace: dumped %d records to /dev/serial1\n", records);
+		vfs_close(trace_port);
+	}
 	
+	profile_report();
+
+	// Writes the root image, so it stays out of the profiled boot
+	journal_test("/dev/ata1");
+
 	arch_debug_printf("🎉 Tests complete!\n");
 
 	while (1) {
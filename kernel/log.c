@@ -0,0 +1,148 @@
+#include "kernel/log.h"
+#include "lib/utils.h"
+
+#define LOG_RECORD_COMMITTED (1u << 31)
+#define LOG_RECORD_PAD       (1u << 30)
+#define LOG_RECORD_LENGTH    0xFFFF
+
+#define LOG_HEADER_SIZE sizeof(uint32_t)
+#define LOG_NOTICE_SIZE 48
+
+// Unreserved space is kept zeroed so a stale header is never mistaken for a committed one
+static char log_ring[LOG_RING_SIZE] __attribute__((aligned(8)));
+
+static uint64_t log_head = 0;     // Next free byte (producers)
+static uint64_t log_tail = 0;     // Start of the oldest unconsumed record (consumer)
+static uint32_t log_offset = 0;   // Bytes already consumed from the record at log_tail
+static uint64_t log_drops = 0;
+static uint64_t log_drops_reported = 0;
+
+static char log_notice[LOG_NOTICE_SIZE];
+static uint32_t log_notice_length = 0;
+static uint32_t log_notice_offset = 0;
+
+static inline uint32_t *log_header(uint64_t position)
+{
+    return (uint32_t *)&log_ring[position & (LOG_RING_SIZE - 1)];
+}
+
+static void log_copy(uint64_t position, const char *buf, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        log_ring[(position + i) & (LOG_RING_SIZE - 1)] = buf[i];
+    }
+}
+
+int log_write(const char *buf, size_t len)
+{
+    if (!buf || len == 0) {
+        return 0;
+    }
+
+    if (len > LOG_RECORD_LENGTH || len > LOG_RING_SIZE / 2) {
+        __atomic_fetch_add(&log_drops, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+
+    uint64_t size = ALIGN_UP(LOG_HEADER_SIZE + len, LOG_HEADER_SIZE);
+    uint64_t head, start, pad;
+
+    do {
+        head = __atomic_load_n(&log_head, __ATOMIC_RELAXED);
+        uint64_t tail = __atomic_load_n(&log_tail, __ATOMIC_ACQUIRE);
+
+        // Records never wrap; fill the end of the ring with a pad record instead
+        uint64_t offset = head & (LOG_RING_SIZE - 1);
+        pad = (offset + size > LOG_RING_SIZE) ? LOG_RING_SIZE - offset : 0;
+        start = head + pad;
+
+        if (start + size - tail > LOG_RING_SIZE) {
+            __atomic_fetch_add(&log_drops, 1, __ATOMIC_RELAXED);
+            return -1;
+        }
+    } while (!__atomic_compare_exchange_n(&log_head, &head, start + size, false,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+    if (pad) {
+        __atomic_store_n(log_header(head), LOG_RECORD_COMMITTED | LOG_RECORD_PAD |
+                         (uint32_t)(pad - LOG_HEADER_SIZE), __ATOMIC_RELEASE);
+    }
+
+    log_copy(start + LOG_HEADER_SIZE, buf, len);
+    __atomic_store_n(log_header(start), LOG_RECORD_COMMITTED | (uint32_t)len, __ATOMIC_RELEASE);
+
+    return (int)len;
+}
+
+static void log_prepare_notice(uint64_t dropped)
+{
+    static const char prefix[] = "[log] ";
+    static const char suffix[] = " messages dropped\n";
+    char digits[20];
+    int n = 0;
+
+    do {
+        digits[n++] = '0' + dropped % 10;
+        dropped /= 10;
+    } while (dropped);
+
+    uint32_t length = 0;
+    for (int i = 0; prefix[i]; i++) log_notice[length++] = prefix[i];
+    while (n) log_notice[length++] = digits[--n];
+    for (int i = 0; suffix[i]; i++) log_notice[length++] = suffix[i];
+
+    log_notice_length = length;
+    log_notice_offset = 0;
+}
+
+size_t log_read(char *buf, size_t len)
+{
+    size_t copied = 0;
+
+    while (copied < len) {
+        if (log_notice_offset < log_notice_length) {
+            buf[copied++] = log_notice[log_notice_offset++];
+            continue;
+        }
+
+        uint32_t header = __atomic_load_n(log_header(log_tail), __ATOMIC_ACQUIRE);
+        if (!(header & LOG_RECORD_COMMITTED)) {
+            // Drops happen when the ring is full, so announce them once it has drained
+            uint64_t dropped = __atomic_load_n(&log_drops, __ATOMIC_RELAXED);
+            if (log_offset == 0 && dropped != log_drops_reported) {
+                log_prepare_notice(dropped - log_drops_reported);
+                log_drops_reported = dropped;
+                continue;
+            }
+            break;
+        }
+
+        uint32_t length = header & LOG_RECORD_LENGTH;
+
+        if (!(header & LOG_RECORD_PAD)) {
+            while (copied < len && log_offset < length) {
+                buf[copied++] = log_ring[(log_tail + LOG_HEADER_SIZE + log_offset) & (LOG_RING_SIZE - 1)];
+                log_offset++;
+            }
+
+            if (log_offset < length) {
+                break;
+            }
+        }
+
+        uint64_t size = ALIGN_UP(LOG_HEADER_SIZE + length, LOG_HEADER_SIZE);
+        for (uint64_t i = 0; i < size; i++) {
+            log_ring[(log_tail + i) & (LOG_RING_SIZE - 1)] = 0;
+        }
+
+        log_offset = 0;
+        __atomic_store_n(&log_tail, log_tail + size, __ATOMIC_RELEASE);
+    }
+
+    return copied;
+}
+
+uint64_t log_dropped(void)
+{
+    return __atomic_load_n(&log_drops, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,89 @@
+#include "kernel/profile.h"
+#include "arch/arch.h"
+#include "board/board.h"
+
+typedef struct {
+    const char *name;
+    uint64_t cycles;                 // Counter when the phase ended
+    uint64_t ns;                     // arch_time_ns() at the same point, 0 before the timer runs
+} profile_phase_t;
+
+static profile_phase_t profile_phases[PROFILE_MAX_PHASES];
+static uint32_t profile_count = 0;
+
+void profile_init(void)
+{
+    board_boot_stamp_t stamps[PROFILE_MAX_PHASES];
+    uint32_t count = board_boot_stamps(stamps, PROFILE_MAX_PHASES);
+
+    for (profile_count = 0; profile_count < count; profile_count++) {
+        profile_phases[profile_count] = (profile_phase_t){ stamps[profile_count].name, stamps[profile_count].cycles, 0 };
+    }
+}
+
+void profile_mark(const char *name)
+{
+    if (profile_count < PROFILE_MAX_PHASES) {
+        profile_phases[profile_count++] = (profile_phase_t){ name, arch_cycles(), arch_time_ns() };
+    }
+}
+
+// Counter rate, from the first phase that ended with the timer running up to now
+static uint64_t profile_cycles_per_second(void)
+{
+    for (uint32_t i = 0; i < profile_count; i++) {
+        if (profile_phases[i].ns == 0) {
+            continue;
+        }
+
+        uint64_t elapsed_us = (arch_time_ns() - profile_phases[i].ns) / 1000;
+        uint64_t cycles = arch_cycles() - profile_phases[i].cycles;
+
+        return elapsed_us ? cycles / elapsed_us * 1000000ULL : 0;
+    }
+
+    return 0;
+}
+
+void profile_report(void)
+{
+    uint64_t cycles_per_second = profile_cycles_per_second();
+    uint64_t mhz = cycles_per_second / 1000000;
+
+    if (profile_count == 0) {
+        return;
+    }
+
+    arch_debug_printf("Boot profile: counter at %lu MHz, %lu us from reset to %s\n", mhz,
+                      mhz ? profile_phases[profile_count - 1].cycles / mhz : 0, profile_phases[profile_count - 1].name);
+    arch_debug_printf("  %-16s %10s %10s %14s\n", "phase", "end us", "time us", "cycles");
+
+    uint64_t start = 0;
+    for (uint32_t i = 0; i < profile_count; i++) {
+        const profile_phase_t *phase = &profile_phases[i];
+        uint64_t cycles = phase->cycles - start;
+
+        arch_debug_printf("  %-16s %10lu %10lu %14lu\n", phase->name, mhz ? phase->cycles / mhz : 0,
+                          mhz ? cycles / mhz : 0, cycles);
+        start = phase->cycles;
+    }
+
+    /* With interrupts off nothing else lands in the middle of the record line,
+     * but the serial port cannot drain the log either, so each piece is
+     * flushed out before the next one is queued and the ring never fills.
+     */
+    uint64_t state = arch_interrupt_save();
+
+    arch_debug_flush();
+    arch_debug_printf("Boot profile: {\"version\":1,\"cycles_per_second\":%lu,\"phases\":[", cycles_per_second);
+    arch_debug_flush();
+    for (uint32_t i = 0; i < profile_count; i++) {
+        arch_debug_printf("%s{\"name\":\"%s\",\"end_cycles\":%lu}", i ? "," : "", profile_phases[i].name,
+                          profile_phases[i].cycles);
+        arch_debug_flush();
+    }
+    arch_debug_printf("]}\n");
+    arch_debug_flush();
+
+    arch_interrupt_restore(state);
+}
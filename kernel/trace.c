@@ -0,0 +1,108 @@
+#include "kernel/trace.h"
+#include "kernel/vfs.h"
+
+typedef struct {
+    trace_record_t records[TRACE_RING_RECORDS];
+    uint64_t head;  // Total records ever written; slot is head % TRACE_RING_RECORDS
+} trace_ring_t;
+
+bool trace_enabled = false;
+
+static trace_ring_t trace_rings[TRACE_MAX_CPUS];
+static uint64_t trace_start_cycles = 0;
+static uint64_t trace_start_ns = 0;
+
+void trace_init(void)
+{
+    for (int cpu = 0; cpu < TRACE_MAX_CPUS; cpu++) {
+        trace_rings[cpu].head = 0;
+    }
+
+    trace_start_cycles = arch_cycles();
+    trace_start_ns = arch_time_ns();
+    trace_enabled = true;
+}
+
+void trace_record(uint16_t event, uint64_t arg0, uint64_t arg1)
+{
+    unsigned int cpu = arch_cpu_id();
+    if (cpu >= TRACE_MAX_CPUS) {
+        return;
+    }
+
+    trace_ring_t *ring = &trace_rings[cpu];
+
+    /* The timestamp is read before the slot is claimed, and with interrupts
+     * off so no nested record can come between the two; slot order is then
+     * time order on this CPU
+     */
+    uint64_t state = arch_interrupt_save();
+    uint64_t timestamp = arch_cycles();
+    uint64_t slot = __atomic_fetch_add(&ring->head, 1, __ATOMIC_RELAXED);
+    arch_interrupt_restore(state);
+
+    trace_record_t *record = &ring->records[slot & (TRACE_RING_RECORDS - 1)];
+
+    record->timestamp = timestamp;
+    record->event = event;
+    record->cpu = (uint16_t)cpu;
+    record->reserved = 0;
+    record->arg0 = arg0;
+    record->arg1 = arg1;
+}
+
+static int trace_write(int fd, const void *buf, size_t len)
+{
+    return vfs_write(fd, buf, len) == (int)len ? 0 : -1;
+}
+
+int trace_dump(int fd)
+{
+    vfs_stat_t stat;
+    if (vfs_stat(fd, &stat) != 0 || stat.type != VFS_TYPE_CHAR) {
+        return -1;
+    }
+
+    bool was_enabled = trace_enabled;
+    trace_enabled = false;
+
+    trace_dump_header_t header = {
+        .magic = TRACE_MAGIC,
+        .version = TRACE_VERSION,
+        .record_size = sizeof(trace_record_t),
+        .cpu_count = TRACE_MAX_CPUS,
+        .record_count = 0,
+        .cycles_per_second = 0,
+    };
+
+    // Calibrate the cycle counter against the timer tick since trace_init
+    uint64_t elapsed_us = (arch_time_ns() - trace_start_ns) / 1000;
+    if (elapsed_us > 0) {
+        header.cycles_per_second = (arch_cycles() - trace_start_cycles) / elapsed_us * 1000000ULL;
+    }
+
+    for (int cpu = 0; cpu < TRACE_MAX_CPUS; cpu++) {
+        uint64_t head = trace_rings[cpu].head;
+        header.record_count += head < TRACE_RING_RECORDS ? head : TRACE_RING_RECORDS;
+    }
+
+    int result = trace_write(fd, &header, sizeof(header));
+
+    for (int cpu = 0; cpu < TRACE_MAX_CPUS && result == 0; cpu++) {
+        trace_ring_t *ring = &trace_rings[cpu];
+        uint64_t head = ring->head;
+        uint64_t count = head < TRACE_RING_RECORDS ? head : TRACE_RING_RECORDS;
+        uint64_t first = (head - count) & (TRACE_RING_RECORDS - 1);
+
+        // Oldest records run to the end of the array, the rest wrap to the start
+        uint64_t tail_count = TRACE_RING_RECORDS - first < count ? TRACE_RING_RECORDS - first : count;
+        result = trace_write(fd, &ring->records[first], tail_count * sizeof(trace_record_t));
+        if (result == 0 && count > tail_count) {
+            result = trace_write(fd, &ring->records[0], (count - tail_count) * sizeof(trace_record_t));
+        }
+    }
+
+    trace_enabled = was_enabled;
+
+    return result == 0 ? (int)header.record_count : -1;
+}
@@ -0,0 +1,488 @@
+#include "kernel/vfs.h"
+#include "lib/printf.h"
+#include "lib/string.h"
+
+/* Virtual file system
+ *
+ * The open file table doubles as the descriptor table: a descriptor is an
+ * index into it, and each entry carries the operations of its kind of file,
+ * picked when it was opened. Devices are looked up by name only in
+ * vfs_open and held by pointer afterwards.
+ */
+
+typedef struct vfs_file vfs_file_t;
+
+typedef struct {
+    int (*read)(vfs_file_t *file, void *buf, uint32_t length, uint64_t offset);
+    int (*write)(vfs_file_t *file, const void *buf, uint32_t length, uint64_t offset);
+    int (*readdir)(vfs_file_t *file, vfs_dirent_t *entry);
+    void (*stat)(vfs_file_t *file, vfs_stat_t *stat);
+} vfs_ops_t;
+
+struct vfs_file {
+    const vfs_ops_t *ops;            // NULL while the slot is free
+    uint32_t flags;
+    uint64_t offset;                 // Bytes, or the next entry of a directory
+    device_t *device;                // Device nodes and the /dev directory's NULL
+    efs_inode_t *inode;              // Files and directories of the root
+};
+
+static vfs_file_t vfs_files[VFS_MAX_FILES];
+static uint8_t vfs_bounce[VFS_BLOCK_MAX];
+static efs_t *vfs_root = NULL;
+static int vfs_root_fd = -1;         // Holds the root's device open
+
+static vfs_file_t *vfs_get(int fd)
+{
+    if (fd < 0 || fd >= VFS_MAX_FILES || !vfs_files[fd].ops) {
+        return NULL;
+    }
+
+    return &vfs_files[fd];
+}
+
+static int vfs_char_read(vfs_file_t *file, void *buf, uint32_t length, uint64_t offset)
+{
+    return file->device->char_ops.read(file->device, buf, length);
+}
+
+static int vfs_char_write(vfs_file_t *file, const void *buf, uint32_t length, uint64_t offset)
+{
+    return file->device->char_ops.write(file->device, buf, length);
+}
+
+static void vfs_device_stat(vfs_file_t *file, vfs_stat_t *stat)
+{
+    device_t *dev = file->device;
+
+    stat->type = dev->class == DEVICE_CLASS_CHAR ? VFS_TYPE_CHAR : VFS_TYPE_DISPLAY;
+    stat->size = 0;
+    stat->block_size = 0;
+
+    if (dev->class == DEVICE_CLASS_BLOCK) {
+        stat->type = VFS_TYPE_BLOCK;
+        stat->block_size = dev->block_ops.get_block_size(dev);
+        stat->size = (uint64_t)stat->block_size * dev->block_ops.get_block_count(dev);
+    }
+}
+
+// Whole aligned blocks go straight to the driver, partial ones through the bounce buffer
+static int vfs_block_transfer(vfs_file_t *file, uint8_t *data, uint32_t length, uint64_t offset, bool write)
+{
+    device_t *dev = file->device;
+    vfs_stat_t stat;
+
+    vfs_device_stat(file, &stat);
+    if (stat.block_size == 0 || stat.block_size > VFS_BLOCK_MAX) {
+        return -1;
+    }
+    if (offset >= stat.size) {
+        return 0;
+    }
+    if (length > stat.size - offset) {
+        length = stat.size - offset;
+    }
+    if (length > 0x7FFFFFFF) {
+        length = 0x7FFFFFFF;
+    }
+
+    uint32_t done = 0;
+
+    while (done < length) {
+        uint64_t position = offset + done;
+        uint64_t block = position / stat.block_size;
+        uint32_t within = position % stat.block_size;
+        uint32_t bytes;
+        int result;
+
+        if (within == 0 && length - done >= stat.block_size) {
+            uint32_t count = (length - done) / stat.block_size;
+
+            bytes = count * stat.block_size;
+            result = write ? dev->block_ops.write_blocks(dev, data + done, block, count)
+                           : dev->block_ops.read_blocks(dev, data + done, block, count);
+        } else {
+            bytes = stat.block_size - within;
+            if (bytes > length - done) {
+                bytes = length - done;
+            }
+
+            result = dev->block_ops.read_blocks(dev, vfs_bounce, block, 1);
+            if (result >= 0 && write) {
+                arch_memory_copy(vfs_bounce + within, data + done, bytes);
+                result = dev->block_ops.write_blocks(dev, vfs_bounce, block, 1);
+            } else if (result >= 0) {
+                arch_memory_copy(data + done, vfs_bounce + within, bytes);
+            }
+        }
+
+        if (result < 0) {
+            return done ? (int)done : -1;
+        }
+        done += bytes;
+    }
+
+    return done;
+}
+
+static int vfs_block_read(vfs_file_t *file, void *buf, uint32_t length, uint64_t offset)
+{
+    return vfs_block_transfer(file, buf, length, offset, false);
+}
+
+static int vfs_block_write(vfs_file_t *file, const void *buf, uint32_t length, uint64_t offset)
+{
+    return vfs_block_transfer(file, (uint8_t *)buf, length, offset, true);
+}
+
+// Entries of /dev are the ready devices, class by class
+static int vfs_devdir_readdir(vfs_file_t *file, vfs_dirent_t *entry)
+{
+    uint64_t index = file->offset;
+
+    for (int class = 0; class < DEVICE_CLASS_MAX; class++) {
+        uint32_t count = device_count_by_class(class);
+
+        if (index >= count) {
+            index -= count;
+            continue;
+        }
+
+        device_t *dev = device_find_by_class(class, index);
+        entry->type = class == DEVICE_CLASS_CHAR  ? VFS_TYPE_CHAR :
+                      class == DEVICE_CLASS_BLOCK ? VFS_TYPE_BLOCK : VFS_TYPE_DISPLAY;
+        strncpy(entry->name, dev->name, sizeof(entry->name) - 1);
+        entry->name[sizeof(entry->name) - 1] = '\0';
+        file->offset++;
+        return 1;
+    }
+
+    return 0;
+}
+
+static void vfs_dir_stat(vfs_file_t *file, vfs_stat_t *stat)
+{
+    stat->type = VFS_TYPE_DIR;
+    stat->size = 0;
+    stat->block_size = 0;
+}
+
+static int vfs_efs_read(vfs_file_t *file, void *buf, uint32_t length, uint64_t offset)
+{
+    return efs_read(file->inode, buf, offset, length);
+}
+
+// Unused slots are skipped, so the offset can run ahead of the entries returned
+static int vfs_efs_readdir(vfs_file_t *file, vfs_dirent_t *entry)
+{
+    efs_dirent_t dirent;
+    int result;
+
+    while ((result = efs_readdir(file->inode, file->offset, &dirent)) > 0) {
+        file->offset++;
+        if (dirent.inode != 0) {
+            entry->type = dirent.type == EFS_TYPE_DIR ? VFS_TYPE_DIR : VFS_TYPE_FILE;
+            arch_memory_copy(entry->name, dirent.name, sizeof(entry->name));
+            return 1;
+        }
+    }
+
+    return result;
+}
+
+static void vfs_efs_stat(vfs_file_t *file, vfs_stat_t *stat)
+{
+    efs_stat_t inode;
+
+    efs_stat(file->inode, &inode);
+    stat->type = inode.type == EFS_TYPE_DIR ? VFS_TYPE_DIR : VFS_TYPE_FILE;
+    stat->size = inode.type == EFS_TYPE_DIR ? 0 : inode.size;
+    stat->block_size = 0;
+}
+
+static const vfs_ops_t vfs_char_ops = { vfs_char_read, vfs_char_write, NULL, vfs_device_stat };
+static const vfs_ops_t vfs_block_ops = { vfs_block_read, vfs_block_write, NULL, vfs_device_stat };
+static const vfs_ops_t vfs_display_ops = { NULL, NULL, NULL, vfs_device_stat };
+static const vfs_ops_t vfs_devdir_ops = { NULL, NULL, vfs_devdir_readdir, vfs_dir_stat };
+static const vfs_ops_t vfs_efs_file_ops = { vfs_efs_read, NULL, NULL, vfs_efs_stat };
+static const vfs_ops_t vfs_efs_dir_ops = { NULL, NULL, vfs_efs_readdir, vfs_efs_stat };
+
+static bool vfs_device_held(device_t *dev)
+{
+    for (int i = 0; i < VFS_MAX_FILES; i++) {
+        if (vfs_files[i].ops && vfs_files[i].device == dev) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Resolve a /dev path, opening the device for its first descriptor
+static arch_result vfs_open_device(vfs_file_t *file, const char *name)
+{
+    if (*name == '\0') {
+        file->ops = &vfs_devdir_ops;
+        return ARCH_OK;
+    }
+
+    device_t *dev = device_find_by_name(name);
+    if (!dev || dev->state != DEVICE_STATE_READY) {
+        return ARCH_ERROR;
+    }
+
+    switch (dev->class) {
+    case DEVICE_CLASS_CHAR:
+        if (((file->flags & VFS_READ) && !dev->char_ops.read) ||
+            ((file->flags & VFS_WRITE) && !dev->char_ops.write)) {
+            return ARCH_UNSUPPORTED;
+        }
+        file->ops = &vfs_char_ops;
+        break;
+    case DEVICE_CLASS_BLOCK:
+        file->ops = &vfs_block_ops;
+        break;
+    default:
+        if (file->flags & (VFS_READ | VFS_WRITE)) {
+            return ARCH_UNSUPPORTED;
+        }
+        file->ops = &vfs_display_ops;
+        break;
+    }
+
+    if (!vfs_device_held(dev) && dev->open && dev->open(dev) != ARCH_OK) {
+        file->ops = NULL;
+        return ARCH_ERROR;
+    }
+
+    file->device = dev;
+
+    return ARCH_OK;
+}
+
+static arch_result vfs_open_efs(vfs_file_t *file, const char *path)
+{
+    if (!vfs_root || (file->flags & VFS_WRITE)) {
+        return ARCH_UNSUPPORTED;
+    }
+
+    efs_inode_t *inode = efs_open(vfs_root, path);
+    if (!inode) {
+        return ARCH_ERROR;
+    }
+
+    efs_stat_t stat;
+    efs_stat(inode, &stat);
+
+    file->inode = inode;
+    file->ops = stat.type == EFS_TYPE_DIR ? &vfs_efs_dir_ops : &vfs_efs_file_ops;
+
+    return ARCH_OK;
+}
+
+int vfs_open(const char *path, uint32_t flags)
+{
+    if (!path || path[0] != '/') {
+        return -1;
+    }
+
+    int fd = 0;
+    while (fd < VFS_MAX_FILES && vfs_files[fd].ops) {
+        fd++;
+    }
+    if (fd == VFS_MAX_FILES) {
+        return -1;
+    }
+
+    vfs_file_t *file = &vfs_files[fd];
+    arch_memory_zero_struct(file);
+    file->flags = flags;
+
+    arch_result result;
+    if (memcmp(path, "/dev", 4) == 0 && (path[4] == '\0' || path[4] == '/')) {
+        result = vfs_open_device(file, path[4] ? path + 5 : path + 4);
+    } else {
+        result = vfs_open_efs(file, path);
+    }
+
+    if (result != ARCH_OK) {
+        file->ops = NULL;
+        return -1;
+    }
+
+    return fd;
+}
+
+int vfs_close(int fd)
+{
+    vfs_file_t *file = vfs_get(fd);
+    if (!file) {
+        return -1;
+    }
+
+    file->ops = NULL;
+
+    if (file->inode) {
+        efs_close(file->inode);
+    }
+    if (file->device && !vfs_device_held(file->device) && file->device->close) {
+        file->device->close(file->device);
+    }
+
+    return 0;
+}
+
+int vfs_pread(int fd, void *buf, uint32_t length, uint64_t offset)
+{
+    vfs_file_t *file = vfs_get(fd);
+    if (!file || !buf || !(file->flags & VFS_READ) || !file->ops->read) {
+        return -1;
+    }
+
+    return file->ops->read(file, buf, length, offset);
+}
+
+int vfs_read(int fd, void *buf, uint32_t length)
+{
+    int result = vfs_pread(fd, buf, length, fd >= 0 && fd < VFS_MAX_FILES ? vfs_files[fd].offset : 0);
+
+    if (result > 0) {
+        vfs_files[fd].offset += result;
+    }
+
+    return result;
+}
+
+static int vfs_file_write(vfs_file_t *file, const void *buf, uint32_t length)
+{
+    if (!buf || !(file->flags & VFS_WRITE) || !file->ops->write) {
+        return -1;
+    }
+
+    int result = file->ops->write(file, buf, length, file->offset);
+    if (result > 0) {
+        file->offset += result;
+    }
+
+    return result;
+}
+
+int vfs_write(int fd, const void *buf, uint32_t length)
+{
+    vfs_file_t *file = vfs_get(fd);
+
+    return file ? vfs_file_write(file, buf, length) : -1;
+}
+
+int64_t vfs_seek(int fd, int64_t offset, vfs_whence_t whence)
+{
+    vfs_file_t *file = vfs_get(fd);
+    if (!file) {
+        return -1;
+    }
+
+    vfs_stat_t stat;
+    file->ops->stat(file, &stat);
+
+    int64_t base = whence == VFS_SEEK_SET ? 0 :
+                   whence == VFS_SEEK_CUR ? (int64_t)file->offset : (int64_t)stat.size;
+    if (base + offset < 0) {
+        return -1;
+    }
+
+    file->offset = base + offset;
+
+    return file->offset;
+}
+
+int vfs_stat(int fd, vfs_stat_t *stat)
+{
+    vfs_file_t *file = vfs_get(fd);
+    if (!file || !stat) {
+        return -1;
+    }
+
+    file->ops->stat(file, stat);
+
+    return 0;
+}
+
+int vfs_readdir(int fd, vfs_dirent_t *entry)
+{
+    vfs_file_t *file = vfs_get(fd);
+    if (!file || !entry || !file->ops->readdir) {
+        return -1;
+    }
+
+    return file->ops->readdir(file, entry);
+}
+
+static int vfs_sink(void *context, const char *buf, size_t len)
+{
+    return vfs_file_write(context, buf, len) == (int)len ? 0 : -1;
+}
+
+int vfs_printf(int fd, const char *format, ...)
+{
+    vfs_file_t *file = vfs_get(fd);
+    if (!file) {
+        return -1;
+    }
+
+    va_list args;
+    va_start(args, format);
+
+    int result = vcbprintf(vfs_sink, file, format, args);
+
+    va_end(args);
+
+    return result;
+}
+
+efs_t *vfs_mount(const char *device)
+{
+    if (vfs_root) {
+        return NULL;
+    }
+
+    int fd = vfs_open(device, VFS_READ | VFS_WRITE);
+    vfs_file_t *file = vfs_get(fd);
+    if (!file || !file->device || file->device->class != DEVICE_CLASS_BLOCK) {
+        vfs_close(fd);
+        return NULL;
+    }
+
+    vfs_root = efs_mount(file->device);
+    if (!vfs_root) {
+        vfs_close(fd);
+        return NULL;
+    }
+
+    vfs_root_fd = fd;
+
+    return vfs_root;
+}
+
+arch_result vfs_unmount(void)
+{
+    if (!vfs_root) {
+        return ARCH_INVALID;
+    }
+
+    for (int i = 0; i < VFS_MAX_FILES; i++) {
+        if (vfs_files[i].ops && vfs_files[i].inode) {
+            return ARCH_ERROR;
+        }
+    }
+
+    arch_result result = efs_unmount(vfs_root);
+    if (result != ARCH_OK) {
+        return result;
+    }
+
+    vfs_close(vfs_root_fd);
+    vfs_root = NULL;
+    vfs_root_fd = -1;
+
+    return ARCH_OK;
+}
@@ -10,59 +10,207 @@
 #define FLAGS_SHORT     (1 << 7)
 #define FLAGS_CHAR      (1 << 8)
 
+// Enough for a 64-bit value in octal
+#define NUMBER_BUFFER_SIZE 24
+
+static const char digit_pairs[201] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+static const char hex_lower[16] = "0123456789abcdef";
+static const char hex_upper[16] = "0123456789ABCDEF";
+
+typedef struct {
+	char *buffer;
+	size_t length;
+	size_t limit;        // Capacity excluding the terminating NUL
+	printf_sink sink;    // When set, buffer is a staging chunk handed to sink when full
+	void *context;
+	size_t flushed;      // Bytes already passed to sink
+	bool failed;
+} printf_output;
+
 static bool is_digit(const char c)
 {
 	return (c >= '0' && c <= '9');
 }
 
-static int atoi(const char *str)
+// Make room in a sink-backed output; a plain buffer that is full stays full
+static bool flush(printf_output *out)
 {
-	int i = 0;
+	if (!out->sink || out->failed) {
+		return false;
+	}
 
-	while (is_digit(*str)) {
-		i = i * 10 + *(str++) - '0';
+	if (out->length > 0) {
+		if (out->sink(out->context, out->buffer, out->length) < 0) {
+			out->failed = true;
+			return false;
+		}
+		out->flushed += out->length;
+		out->length = 0;
 	}
 
-	return i;
+	return true;
 }
 
-static int ntoar(unsigned long value, char *str, unsigned int base)
+static inline bool full(printf_output *out)
 {
-	int length = 0;
-	int n = 0;
+	return out->length >= out->limit && (!out->sink || out->failed);
+}
 
-	do {
-		char digit = (char)(value % base);
-		str[n++] = digit < 10 ? '0' + digit : 'a' + digit - 10;
-		value /= base;
-	} while (value && n < 32);
+static void emit(printf_output *out, const char *s, size_t len)
+{
+	while (len > 0) {
+		size_t room = out->limit - out->length;
+		if (room == 0) {
+			if (!flush(out)) {
+				return;
+			}
+			continue;
+		}
 
-	length = n;
+		size_t n = len < room ? len : room;
+		char *dst = out->buffer + out->length;
+		for (size_t i = 0; i < n; i++) {
+			dst[i] = s[i];
+		}
+		out->length += n;
+		s += n;
+		len -= n;
+	}
+}
 
-	return length;
+static void emit_repeat(printf_output *out, char c, size_t count)
+{
+	while (count > 0) {
+		size_t room = out->limit - out->length;
+		if (room == 0) {
+			if (!flush(out)) {
+				return;
+			}
+			continue;
+		}
+
+		size_t n = count < room ? count : room;
+		char *dst = out->buffer + out->length;
+		for (size_t i = 0; i < n; i++) {
+			dst[i] = c;
+		}
+		out->length += n;
+		count -= n;
+	}
 }
 
-int vsnprintf(int8_t *str, unsigned int n, const int8_t *format, va_list args)
+// Copy a NUL-terminated run up to stop without measuring it first
+static const char *emit_until(printf_output *out, const char *s, char stop)
 {
-	unsigned int characters, length, width, base, flags;
-	bool negative = false;
+	for (;;) {
+		char *dst = out->buffer + out->length;
+		char *limit = out->buffer + out->limit;
 
-	length = 0;
+		while (dst < limit && *s != 0 && *s != stop) {
+			*dst++ = *s++;
+		}
 
-	char buffer[64];
+		out->length = dst - out->buffer;
 
-	while (*format != 0 && length < n - 1) {
+		if (*s == 0 || *s == stop || !flush(out)) {
+			return s;
+		}
+	}
+}
 
-		width = 0;
-		negative = false;
-		flags = 0;
+/* Digit generators fill the buffer backwards from end and return the first digit.
+ * The base is fixed per function so division by 100 compiles to a multiply and
+ * power-of-two bases never divide at all. */
 
-		// Format specifier: %[flags][width][.precision][length]specifier
+static char *format_decimal(uint64_t value, char *end)
+{
+	while (value >= 100) {
+		const char *pair = &digit_pairs[(value % 100) * 2];
+		value /= 100;
+		*--end = pair[1];
+		*--end = pair[0];
+	}
+
+	if (value >= 10) {
+		const char *pair = &digit_pairs[value * 2];
+		*--end = pair[1];
+		*--end = pair[0];
+	} else {
+		*--end = (char)('0' + value);
+	}
+
+	return end;
+}
+
+static char *format_hex(uint64_t value, char *end, const char *digits)
+{
+	do {
+		*--end = digits[value & 0xF];
+		value >>= 4;
+	} while (value);
+
+	return end;
+}
+
+static char *format_octal(uint64_t value, char *end)
+{
+	do {
+		*--end = (char)('0' + (value & 0x7));
+		value >>= 3;
+	} while (value);
+
+	return end;
+}
+
+static void emit_field(printf_output *out, const char *prefix, size_t prefix_len,
+		       const char *body, size_t body_len, unsigned int width, unsigned int flags)
+{
+	size_t total = prefix_len + body_len;
+	size_t padding = width > total ? width - total : 0;
+
+	if (flags & FLAGS_LEFT) {
+		emit(out, prefix, prefix_len);
+		emit(out, body, body_len);
+		emit_repeat(out, ' ', padding);
+	} else if (flags & FLAGS_ZERO) {
+		emit(out, prefix, prefix_len);
+		emit_repeat(out, '0', padding);
+		emit(out, body, body_len);
+	} else {
+		emit_repeat(out, ' ', padding);
+		emit(out, prefix, prefix_len);
+		emit(out, body, body_len);
+	}
+}
+
+static void format_output(printf_output *out, const char *format, va_list args)
+{
+	char number[NUMBER_BUFFER_SIZE];
+	char *end = number + NUMBER_BUFFER_SIZE;
+
+	while (*format != 0 && !full(out)) {
+
+		// Copy the literal run up to the next specifier in one go
 		if (*format != '%') {
-			length++;
-			*(str++) = *format++;
+			format = emit_until(out, format, '%');
 			continue;
 		}
+
+		// Format specifier: %[flags][width][.precision][length]specifier
+		unsigned int width = 0;
+		unsigned int flags = 0;
+
 		// Flags
 		format++;
 		for (bool done = false; !done;) {
@@ -95,9 +243,8 @@ int vsnprintf(int8_t *str, unsigned int n, const int8_t *format, va_list args)
 
 		// Width
 		if (is_digit(*format)) {
-			width = atoi(format);
 			while (is_digit(*format)) {
-				format++;
+				width = width * 10 + *(format++) - '0';
 			}
 		} else if (*format == '*') {
 			const int w = va_arg(args, int);
@@ -112,131 +259,120 @@ int vsnprintf(int8_t *str, unsigned int n, const int8_t *format, va_list args)
 		// TODO: Precision
 
 		// Length
-		switch (*format) {
-		case 'l':
+		while (*format == 'l') {
 			flags |= FLAGS_LONG;
 			format++;
-			break;
-
-		default:
-			break;
 		}
 
 		// Specifier
+		char sign = 0;
+		const char *digits;
+		uint64_t value;
 
 		switch (*format) {
 		case 'i':
-		case 'd':
-			base = 10;
+		case 'd': {
+			const int64_t signed_value = (flags & FLAGS_LONG) ? va_arg(args, long) : va_arg(args, int);
 
-			if (flags & FLAGS_LONG) {
-				const long value = va_arg(args, long);
-				negative = value < 0;
-				characters = ntoar((unsigned long)(negative ? 0 - value : value), buffer, base);
+			if (signed_value < 0) {
+				sign = '-';
+				value = 0 - (uint64_t)signed_value;
 			} else {
-				const int value = va_arg(args, int);
-				negative = value < 0;
-				characters = ntoar((unsigned long)(negative ? 0 - value : value), buffer, base);
+				sign = (flags & FLAGS_PLUS) ? '+' : (flags & FLAGS_SPACE) ? ' ' : 0;
+				value = (uint64_t)signed_value;
 			}
 
+			digits = format_decimal(value, end);
+			emit_field(out, &sign, sign ? 1 : 0, digits, end - digits, width, flags);
 			break;
-		case 'u':
-			base = 10;
-
-			if (flags & FLAGS_LONG) {
-				const unsigned long value = va_arg(args, long);
-				characters = ntoar((unsigned long)(value > 0 ? value : 0 - value), buffer, base);
-			} else {
-				const unsigned int value = va_arg(args, int);
-				characters = ntoar((unsigned long)(value > 0 ? value : 0 - value), buffer, base);
-			}
+		}
 
+		case 'u':
+			value = (flags & FLAGS_LONG) ? va_arg(args, unsigned long) : va_arg(args, unsigned int);
+			digits = format_decimal(value, end);
+			emit_field(out, NULL, 0, digits, end - digits, width, flags);
 			break;
 
 		case 'o':
-			base = 8;
-
-			if (flags & FLAGS_LONG) {
-				const unsigned long value = va_arg(args, long);
-				characters = ntoar((unsigned long)(value > 0 ? value : 0 - value), buffer, base);
-			} else {
-				const unsigned int value = va_arg(args, int);
-				characters = ntoar((unsigned long)(value > 0 ? value : 0 - value), buffer, base);
-			}
-
+			value = (flags & FLAGS_LONG) ? va_arg(args, unsigned long) : va_arg(args, unsigned int);
+			digits = format_octal(value, end);
+			emit_field(out, "0", (flags & FLAGS_HASH) && value ? 1 : 0, digits, end - digits, width, flags);
 			break;
 
 		case 'p':
+			flags |= FLAGS_LONG | FLAGS_HASH;
+			// fallthrough
 		case 'x':
 		case 'X':
-			base = 16;
-
-			if (flags & FLAGS_LONG) {
-				const unsigned long value = va_arg(args, long);
-				characters = ntoar((unsigned long)(value > 0 ? value : 0 - value), buffer, base);
-			} else {
-				const unsigned int value = va_arg(args, int);
-				characters = ntoar((unsigned long)(value > 0 ? value : 0 - value), buffer, base);
+			if (*format == 'X') {
+				flags |= FLAGS_UPPERCASE;
 			}
 
+			value = (flags & FLAGS_LONG) ? va_arg(args, unsigned long) : va_arg(args, unsigned int);
+			digits = format_hex(value, end, (flags & FLAGS_UPPERCASE) ? hex_upper : hex_lower);
+			emit_field(out, (flags & FLAGS_UPPERCASE) ? "0X" : "0x", (flags & FLAGS_HASH) && value ? 2 : 0,
+				   digits, end - digits, width, flags);
 			break;
 
-		case 'c':
-			buffer[0] = (char)va_arg(args, int);
-			characters = 1;
-
+		case 'c': {
+			const char c = (char)va_arg(args, int);
+			emit_field(out, NULL, 0, &c, 1, width, flags & ~FLAGS_ZERO);
 			break;
+		}
+
+		case 's': {
+			const char *s = va_arg(args, const char *);
+			if (!s) {
+				s = "(null)";
+			}
 
-		case 's':
-			const char *c = va_arg(args, const char *);
-			characters = strlen(c);
-			for (int i = characters - 1; i >= 0; i--) {
-				buffer[i] = *(c++);
+			if (width == 0) {
+				emit_until(out, s, 0);
+			} else {
+				emit_field(out, NULL, 0, s, strlen(s), width, flags & ~FLAGS_ZERO);
 			}
 			break;
+		}
+
+		case '%':
+			emit(out, "%", 1);
+			break;
 
 			// TODO: f,F,e,E,g,G
 		default:
+			// Unknown specifier; emit it as literal text
 			continue;
 		}
 
 		format++;
+	}
+}
 
-		// Left padding
-		if ((flags & FLAGS_ZERO) && !(flags & FLAGS_LEFT)) {
-
-			while (characters < width) {
-				buffer[characters++] = '0';
-			}
-
-		}
-
-		if (negative || (flags & FLAGS_PLUS)) {
-			buffer[characters++] = negative ? '-' : '+';
-		}
+int vsnprintf(int8_t *str, unsigned int n, const int8_t *fmt, va_list args)
+{
+	printf_output out = { .buffer = str, .length = 0, .limit = n ? n - 1 : 0 };
 
-		if (!(flags & FLAGS_ZERO) && !(flags & FLAGS_LEFT)) {
+	format_output(&out, fmt, args);
 
-			while (characters < width) {
-				buffer[characters++] = ' ';
-			}
+	if (n) {
+		str[out.length] = 0;
+	}
 
-		}
+	return out.length;
+}
 
-		for (int i = characters - 1; i >= 0; i--) {
-			*(str++) = buffer[i];
-		}
+int vcbprintf(printf_sink sink, void *context, const char *fmt, va_list args)
+{
+	if (!sink) {
+		return -1;
+	}
 
-		// Right padding
-		if (flags & FLAGS_LEFT) {
-			while (characters < width) {
-				*(str++) = ' ';
-				characters++;
-			}
-		}
+	char chunk[PRINTF_BUFFER_SIZE];
+	printf_output out = { .buffer = chunk, .length = 0, .limit = sizeof(chunk),
+			      .sink = sink, .context = context };
 
-		length += characters;
-	}
+	format_output(&out, fmt, args);
+	flush(&out);
 
-	return length;
-}
\ No newline at end of file
+	return out.failed ? -1 : (int)out.flushed;
+}
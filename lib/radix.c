@@ -0,0 +1,168 @@
+#include "lib/radix.h"
+
+struct radix_node {
+    void *slots[RADIX_SLOTS];        // Child nodes, or items in the bottom level
+    uint32_t count;                  // Slots in use
+    bool used;                       // Taken from the pool
+};
+
+#define RADIX_MAX_HEIGHT ((64 + RADIX_BITS - 1) / RADIX_BITS)
+
+static radix_node_t radix_nodes[RADIX_NODES];
+
+static radix_node_t *radix_node_alloc(void)
+{
+    for (int i = 0; i < RADIX_NODES; i++) {
+        radix_node_t *node = &radix_nodes[i];
+
+        if (!node->used) {
+            arch_memory_zero_struct(node);
+            node->used = true;
+            return node;
+        }
+    }
+
+    return NULL;
+}
+
+static uint32_t radix_nodes_free(void)
+{
+    uint32_t free = 0;
+
+    for (int i = 0; i < RADIX_NODES; i++) {
+        free += !radix_nodes[i].used;
+    }
+
+    return free;
+}
+
+static void radix_node_free(radix_node_t *node)
+{
+    node->used = false;
+}
+
+static uint32_t radix_slot(uint64_t index, uint32_t level)
+{
+    return (index >> (level * RADIX_BITS)) & (RADIX_SLOTS - 1);
+}
+
+// Whether a tree of this height has room for index
+static bool radix_fits(uint32_t height, uint64_t index)
+{
+    return height >= RADIX_MAX_HEIGHT || (index >> (height * RADIX_BITS)) == 0;
+}
+
+void *radix_lookup(const radix_tree_t *tree, uint64_t index)
+{
+    if (!tree->root || !radix_fits(tree->height, index)) {
+        return NULL;
+    }
+
+    radix_node_t *node = tree->root;
+    for (uint32_t level = tree->height - 1; level > 0 && node; level--) {
+        node = node->slots[radix_slot(index, level)];
+    }
+
+    return node ? node->slots[radix_slot(index, 0)] : NULL;
+}
+
+arch_result radix_insert(radix_tree_t *tree, uint64_t index, void *item)
+{
+    if (!item) {
+        return ARCH_INVALID;
+    }
+
+    // Enough nodes for a new path from a grown root, so a failure leaves no empty nodes behind
+    uint32_t height = tree->root ? tree->height : 1;
+    while (!radix_fits(height, index)) {
+        height++;
+    }
+    if (radix_nodes_free() < height) {
+        return ARCH_ERROR;
+    }
+
+    if (!tree->root) {
+        tree->height = 1;
+        while (!radix_fits(tree->height, index)) {
+            tree->height++;
+        }
+        if (!(tree->root = radix_node_alloc())) {
+            tree->height = 0;
+            return ARCH_ERROR;
+        }
+    }
+
+    // Grow upwards: the old root becomes the first child of a new one
+    while (!radix_fits(tree->height, index)) {
+        radix_node_t *root = radix_node_alloc();
+        if (!root) {
+            return ARCH_ERROR;
+        }
+
+        root->slots[0] = tree->root;
+        root->count = 1;
+        tree->root = root;
+        tree->height++;
+    }
+
+    radix_node_t *node = tree->root;
+    for (uint32_t level = tree->height - 1; level > 0; level--) {
+        void **slot = &node->slots[radix_slot(index, level)];
+
+        if (!*slot) {
+            if (!(*slot = radix_node_alloc())) {
+                return ARCH_ERROR;
+            }
+            node->count++;
+        }
+        node = *slot;
+    }
+
+    void **slot = &node->slots[radix_slot(index, 0)];
+    if (*slot) {
+        return ARCH_INVALID;
+    }
+
+    *slot = item;
+    node->count++;
+
+    return ARCH_OK;
+}
+
+void *radix_delete(radix_tree_t *tree, uint64_t index)
+{
+    if (!tree->root || !radix_fits(tree->height, index)) {
+        return NULL;
+    }
+
+    radix_node_t *path[RADIX_MAX_HEIGHT];
+    radix_node_t *node = tree->root;
+
+    for (uint32_t level = tree->height - 1; level > 0; level--) {
+        path[level] = node;
+        node = node->slots[radix_slot(index, level)];
+        if (!node) {
+            return NULL;
+        }
+    }
+    path[0] = node;
+
+    void *item = node->slots[radix_slot(index, 0)];
+    if (!item) {
+        return NULL;
+    }
+
+    // Clear the slot and free every node on the way up that is left empty
+    for (uint32_t level = 0; level < tree->height; level++) {
+        path[level]->slots[radix_slot(index, level)] = NULL;
+        if (--path[level]->count > 0) {
+            return item;
+        }
+        radix_node_free(path[level]);
+    }
+
+    tree->root = NULL;
+    tree->height = 0;
+
+    return item;
+}
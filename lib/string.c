@@ -1,35 +1,178 @@
 #include "lib/string.h"
+#include "arch/arch.h"
 
-uint64_t strlen(const char *str)
+/* The generic routines scan a machine word at a time. Aligned loads never
+ * straddle a page, so reading the bytes after a terminator that share its
+ * word is safe. A word contains a zero byte iff
+ * (w - 0x01..01) & ~w & 0x80..80 is non-zero, and the lowest set bit
+ * marks the first zero byte exactly. */
+
+typedef uint64_t __attribute__((may_alias)) word_t;
+typedef uint64_t __attribute__((may_alias, aligned(1))) unaligned_word_t;
+
+#define WORD_SIZE     sizeof(word_t)
+#define WORD_ONES     0x0101010101010101UL
+#define WORD_HIGHS    0x8080808080808080UL
+#define WORD_ALIGNED(p) (((uint64_t)(p) & (WORD_SIZE - 1)) == 0)
+
+static inline uint64_t zero_bytes(uint64_t w)
 {
-	uint64_t length = 0;
-	while (*str++ != 0) {
-		length++;
+	return (w - WORD_ONES) & ~w & WORD_HIGHS;
+}
+
+// Index of the first flagged byte in a zero_bytes() mask (little endian)
+static inline unsigned int first_byte(uint64_t mask)
+{
+	return __builtin_ctzl(mask) / 8;
+}
+
+static uint64_t word_strlen(const char *str)
+{
+	const char *s = str;
+
+	while (!WORD_ALIGNED(s)) {
+		if (*s == 0) {
+			return s - str;
+		}
+		s++;
 	}
 
-	return length;
+	const word_t *w = (const word_t *)s;
+	uint64_t mask;
+	while ((mask = zero_bytes(*w)) == 0) {
+		w++;
+	}
+
+	return (const char *)w + first_byte(mask) - str;
 }
 
-int strcmp(const char *s1, const char *s2)
+// A word load from p stays within p's page
+#define WORD_IN_PAGE(p) (((uint64_t)(p) & (PAGE_SIZE - 1)) <= PAGE_SIZE - WORD_SIZE)
+
+/* Compare a word at a time from wherever the strings start, with unaligned
+ * loads. Like an aligned load, a load that stays within one page cannot
+ * fault, so only the bytes next to a page end go one at a time. That keeps
+ * mutually misaligned strings and short names on the word path.
+ */
+static int word_strcmp(const char *s1, const char *s2)
 {
-	while (*s1 && (*s1 == *s2)) {
-		s1++;
-		s2++;
+	for (;;) {
+		if (!WORD_IN_PAGE(s1) || !WORD_IN_PAGE(s2)) {
+			if (*s1 == 0 || *s1 != *s2) {
+				return *(unsigned char *)s1 - *(unsigned char *)s2;
+			}
+			s1++;
+			s2++;
+			continue;
+		}
+
+		uint64_t v1 = *(const unaligned_word_t *)s1;
+		uint64_t v2 = *(const unaligned_word_t *)s2;
+		uint64_t zeros = zero_bytes(v1);
+
+		if (v1 != v2 || zeros != 0) {
+			// The result comes from the first differing byte or the terminator, whichever is first
+			unsigned int end = zeros ? first_byte(zeros) : WORD_SIZE;
+			unsigned int differ = v1 != v2 ? __builtin_ctzl(v1 ^ v2) / 8 : WORD_SIZE;
+			unsigned int shift = (differ < end ? differ : end) * 8;
+
+			return (int)((v1 >> shift) & 0xFF) - (int)((v2 >> shift) & 0xFF);
+		}
+		s1 += WORD_SIZE;
+		s2 += WORD_SIZE;
 	}
-	return *(unsigned char *)s1 - *(unsigned char *)s2;
 }
 
-char *strncpy(char *dest, const char *src, size_t n)
+static void *word_memchr(const void *ptr, int c, size_t n)
 {
-	size_t i;
-	
-	for (i = 0; i < n && src[i] != '\0'; i++) {
-		dest[i] = src[i];
+	const unsigned char *s = ptr;
+	const unsigned char value = (unsigned char)c;
+
+	while (n > 0 && !WORD_ALIGNED(s)) {
+		if (*s == value) {
+			return (void *)s;
+		}
+		s++;
+		n--;
+	}
+
+	const uint64_t pattern = WORD_ONES * value;
+	const word_t *w = (const word_t *)s;
+	while (n >= WORD_SIZE && zero_bytes(*w ^ pattern) == 0) {
+		w++;
+		n -= WORD_SIZE;
 	}
-	
-	for (; i < n; i++) {
-		dest[i] = '\0';
+
+	for (s = (const unsigned char *)w; n > 0; s++, n--) {
+		if (*s == value) {
+			return (void *)s;
+		}
 	}
-	
+
+	return NULL;
+}
+
+static const string_ops_t word_string_ops = {
+	.strlen = word_strlen,
+	.strcmp = word_strcmp,
+	.memchr = word_memchr,
+};
+
+static const string_ops_t *string_ops = &word_string_ops;
+
+void string_set_ops(const string_ops_t *ops)
+{
+	string_ops = ops ? ops : &word_string_ops;
+}
+
+uint64_t strlen(const char *str)
+{
+	return string_ops->strlen(str);
+}
+
+int strcmp(const char *s1, const char *s2)
+{
+	return string_ops->strcmp(s1, s2);
+}
+
+void *memchr(const void *ptr, int c, size_t n)
+{
+	return string_ops->memchr(ptr, c, n);
+}
+
+size_t strnlen(const char *str, size_t n)
+{
+	const char *end = memchr(str, 0, n);
+	return end ? (size_t)(end - str) : n;
+}
+
+int memcmp(const void *ptr1, const void *ptr2, size_t n)
+{
+	const unsigned char *a = ptr1;
+	const unsigned char *b = ptr2;
+
+	// Skip the equal prefix a word at a time; the bytes decide the order
+	while (n >= WORD_SIZE && *(const unaligned_word_t *)a == *(const unaligned_word_t *)b) {
+		a += WORD_SIZE;
+		b += WORD_SIZE;
+		n -= WORD_SIZE;
+	}
+
+	for (; n > 0; a++, b++, n--) {
+		if (*a != *b) {
+			return *a - *b;
+		}
+	}
+
+	return 0;
+}
+
+char *strncpy(char *dest, const char *src, size_t n)
+{
+	size_t length = strnlen(src, n);
+
+	arch_memory_copy(dest, src, length);
+	arch_memory_set(dest + length, 0, n - length);
+
 	return dest;
 }
@@ -3,14 +3,25 @@
 #include "lib/string.h"
 #include "lib/printf.h"
 
+static int fatal_sink(void *context, const char *buf, size_t len)
+{
+	(void)context;
+
+	arch_debug_write(buf, len);
+	return 0;
+}
+
 void fatal(const int8_t *format, ...)
 {
 	va_list args;
 	va_start(args, format);
 
-	int8_t buffer[PRINTF_BUFFER_SIZE];
-	vsnprintf(buffer, PRINTF_BUFFER_SIZE, format, args);
-	arch_debug_printf("Fatal error: %s\n", buffer);
+	// Nothing else gets between the parts of the message, and it is formatted in a single pass
+	arch_interrupt_save();
+	arch_debug_write("Fatal error: ", 13);
+	vcbprintf(fatal_sink, NULL, format, args);
+	arch_debug_write("\n", 1);
+	arch_debug_flush();
 
 	va_end(args);
 
@@ -0,0 +1,67 @@
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <x86intrin.h>
+
+static volatile uint64_t bench_sunk;
+
+// The kernel objects call into the architecture layer for bulk copies and fills
+void new_arch_memory_copy(void *dest, const void *src, uint64_t size)
+{
+    memcpy(dest, src, size);
+}
+
+void new_arch_memory_set(void *ptr, uint8_t value, uint64_t size)
+{
+    memset(ptr, value, size);
+}
+
+uint64_t bench_cycles(void (*run)(void *arg, uint32_t iterations), void *arg, uint32_t iterations)
+{
+    uint64_t best = UINT64_MAX;
+
+    run(arg, iterations);            // Warm the caches and branch predictors
+
+    for (int i = 0; i < BENCH_RUNS; i++) {
+        uint64_t start = __rdtsc();
+        run(arg, iterations);
+        uint64_t cycles = __rdtsc() - start;
+
+        if (cycles < best) {
+            best = cycles;
+        }
+    }
+
+    return best / iterations;
+}
+
+void bench_sink(uint64_t value)
+{
+    bench_sunk += value;
+}
+
+void bench_fill(char *buf, size_t length, uint32_t seed)
+{
+    for (size_t i = 0; i < length; i++) {
+        seed = seed * 1103515245 + 12345;
+        buf[i] = ' ' + (seed >> 16) % 95;
+    }
+}
+
+char *bench_guarded(size_t length)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t size = (length + page - 1) / page * page;
+    char *base = mmap(NULL, size + page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (base == MAP_FAILED || mprotect(base + size, page, PROT_NONE) != 0) {
+        perror("bench_guarded");
+        exit(1);
+    }
+
+    return base + size - length;
+}
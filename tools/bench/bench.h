@@ -0,0 +1,38 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+/* Host benchmarks for kernel library code
+ *
+ * The kernel objects are linked in with their symbols prefixed: "new_" for
+ * the code in the tree and "old_" for the baseline it replaced (see the
+ * bench target in the Makefile), so both run side by side with the
+ * kernel's compiler flags.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define BENCH_RUNS 15                // Each result is the fastest of this many runs
+
+/* Time a call repeatedly
+ *
+ * @param run: Called with the argument; calls its code once per iteration
+ * @param iterations: Calls per timed run
+ * @return: Fewest cycles per iteration over BENCH_RUNS runs
+ */
+uint64_t bench_cycles(void (*run)(void *arg, uint32_t iterations), void *arg, uint32_t iterations);
+
+// Keep a result alive so the compiler cannot drop the call that made it
+void bench_sink(uint64_t value);
+
+// Fill with pseudo-random printable bytes; the same seed gives the same bytes
+void bench_fill(char *buf, size_t length, uint32_t seed);
+
+/* Allocate so that the buffer ends right before an unmapped page
+ *
+ * Reading one byte past the end faults, which catches scans that stray
+ * over the end of a string.
+ */
+char *bench_guarded(size_t length);
+
+#endif
@@ -0,0 +1,138 @@
+/* printf benchmark
+ *
+ * Compares vsnprintf from lib/printf.c (new) with the implementation it
+ * replaced (old) on lines like the kernel's own log messages. The new
+ * output is checked against the host's snprintf first.
+ *
+ *     make bench
+ */
+
+#include "bench.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int old_vsnprintf(char *s, uint32_t n, const char *format, va_list args);
+int new_vsnprintf(char *s, uint32_t n, const char *format, va_list args);
+int new_vcbprintf(int (*sink)(void *context, const char *buf, size_t len), void *context, const char *format,
+                  va_list args);
+
+typedef int (*printfbench_format_t)(char *s, uint32_t n, const char *format, ...);
+
+static int old_snprintf(char *s, uint32_t n, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int length = old_vsnprintf(s, n, format, args);
+    va_end(args);
+    return length;
+}
+
+static int host_snprintf(char *s, uint32_t n, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(s, n, format, args);
+    va_end(args);
+    return length;
+}
+
+static int new_snprintf(char *s, uint32_t n, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int length = new_vsnprintf(s, n, format, args);
+    va_end(args);
+    return length;
+}
+
+// Like the console and serial sinks: take the run and report success
+static int printfbench_sink(void *context, const char *buf, size_t len)
+{
+    bench_sink(buf[0] + len);
+    return 0;
+}
+
+static int new_cbprintf(char *s, uint32_t n, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int length = new_vcbprintf(printfbench_sink, NULL, format, args);
+    va_end(args);
+    return length;
+}
+
+typedef struct {
+    const char *name;
+    void (*run)(printfbench_format_t format, char *buf);
+} printfbench_line_t;
+
+static void line_register(printfbench_format_t format, char *buf)
+{
+    format(buf, 256, "Registered %s device '%s' id=%d size=%lu addr=%lx\n", "block", "ata0", 3, 16777216UL,
+           0xFFFFFF8000012340UL);
+}
+
+static void line_table(printfbench_format_t format, char *buf)
+{
+    format(buf, 256, "  %-16s %10lu %10lu %14lu\n", "drivers", 51234UL, 1871UL, 5612345UL);
+}
+
+static void line_text(printfbench_format_t format, char *buf)
+{
+    format(buf, 256, "efs: mounted %s, %s\n", "/dev/ata1", "journal replayed, 12 transactions, 96 blocks");
+}
+
+static printfbench_line_t printfbench_lines[] = {
+    { "log line", line_register },
+    { "table row", line_table },
+    { "strings", line_text },
+};
+
+typedef struct {
+    printfbench_format_t format;
+    const printfbench_line_t *line;
+    char buf[256];
+} printfbench_t;
+
+static void printfbench_run(void *arg, uint32_t iterations)
+{
+    printfbench_t *p = arg;
+
+    for (uint32_t i = 0; i < iterations; i++) {
+        p->line->run(p->format, p->buf);
+        bench_sink(p->buf[0]);
+    }
+}
+
+static uint64_t printfbench_cycles(printfbench_format_t format, const printfbench_line_t *line)
+{
+    printfbench_t p = { format, line, { 0 } };
+
+    return bench_cycles(printfbench_run, &p, 20000);
+}
+
+int main(void)
+{
+    printf("Cycles per formatted line, fewest of %d runs\n", BENCH_RUNS);
+    printf("%-10s %10s %14s %14s\n", "line", "old", "new", "new (sink)");
+
+    for (size_t i = 0; i < sizeof(printfbench_lines) / sizeof(printfbench_lines[0]); i++) {
+        const printfbench_line_t *line = &printfbench_lines[i];
+        char buf[256], expected[256];
+
+        line->run(new_snprintf, buf);
+        line->run(host_snprintf, expected);
+        if (strcmp(buf, expected) != 0) {
+            fprintf(stderr, "printfbench: %s came out as \"%s\", expected \"%s\"\n", line->name, buf, expected);
+            return 1;
+        }
+
+        printf("%-10s %10lu %14lu %14lu\n", line->name, printfbench_cycles(old_snprintf, line),
+               printfbench_cycles(new_snprintf, line), printfbench_cycles(new_cbprintf, line));
+    }
+
+    return 0;
+}
@@ -0,0 +1,139 @@
+/* String routine benchmark
+ *
+ * Compares the byte loops lib/string.c used to have (old), the portable
+ * word-at-a-time routines (word) and the SSE2 routines from
+ * arch/x86_64/string.s (sse2). Every string ends right before an unmapped
+ * page, so a routine that reads past the terminator crashes the run.
+ *
+ *     make bench
+ */
+
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+uint64_t old_strlen(const char *str);
+int old_strcmp(const char *s1, const char *s2);
+char *old_strncpy(char *dest, const char *src, size_t n);
+
+uint64_t new_strlen(const char *str);           // Word routines until string_set_ops is called
+int new_strcmp(const char *s1, const char *s2);
+void *new_memchr(const void *ptr, int c, size_t n);
+char *new_strncpy(char *dest, const char *src, size_t n);
+
+uint64_t new_x86_64_sse2_strlen(const char *str);
+int new_x86_64_sse2_strcmp(const char *s1, const char *s2);
+void *new_x86_64_sse2_memchr(const void *ptr, int c, size_t n);
+
+typedef struct {
+    const char *a;                   // NUL-terminated, ending at a guard page
+    const char *b;                   // Same contents as a, at a different alignment
+    char *dest;
+    size_t length;
+} strbench_t;
+
+#define STRBENCH_RUN(name, call)                                    \
+    static void name(void *arg, uint32_t iterations)                \
+    {                                                               \
+        strbench_t *s = arg;                                        \
+        for (uint32_t i = 0; i < iterations; i++) {                 \
+            bench_sink((uint64_t)(call));                           \
+        }                                                           \
+    }
+
+STRBENCH_RUN(run_old_strlen, old_strlen(s->a))
+STRBENCH_RUN(run_word_strlen, new_strlen(s->a))
+STRBENCH_RUN(run_sse2_strlen, new_x86_64_sse2_strlen(s->a))
+STRBENCH_RUN(run_old_strcmp, old_strcmp(s->a, s->b))
+STRBENCH_RUN(run_word_strcmp, new_strcmp(s->a, s->b))
+STRBENCH_RUN(run_sse2_strcmp, new_x86_64_sse2_strcmp(s->a, s->b))
+STRBENCH_RUN(run_byte_memchr, memchr(s->a, 0, s->length + 1))   // No old memchr; libc's is the reference
+STRBENCH_RUN(run_word_memchr, new_memchr(s->a, 0, s->length + 1))
+STRBENCH_RUN(run_sse2_memchr, new_x86_64_sse2_memchr(s->a, 0, s->length + 1))
+STRBENCH_RUN(run_old_strncpy, old_strncpy(s->dest, s->a, s->length + 16))
+STRBENCH_RUN(run_word_strncpy, new_strncpy(s->dest, s->a, s->length + 16))
+
+static void strbench_check(const strbench_t *s)
+{
+    const char *end = s->a + s->length;
+    int ok = old_strlen(s->a) == s->length && new_strlen(s->a) == s->length &&
+             new_x86_64_sse2_strlen(s->a) == s->length &&
+             old_strcmp(s->a, s->b) == 0 && new_strcmp(s->a, s->b) == 0 &&
+             new_x86_64_sse2_strcmp(s->a, s->b) == 0 &&
+             new_memchr(s->a, 0, s->length + 1) == end && new_x86_64_sse2_memchr(s->a, 0, s->length + 1) == end &&
+             strcmp(new_strncpy(s->dest, s->a, s->length + 16), s->a) == 0;
+
+    if (!ok) {
+        fprintf(stderr, "strbench: wrong result for a %zu byte string\n", s->length);
+        exit(1);
+    }
+}
+
+static int strbench_sign(int value)
+{
+    return (value > 0) - (value < 0);
+}
+
+// strcmp against the host's for strings that differ or end at each position in turn
+static void strbench_check_strcmp(const strbench_t *s)
+{
+    char *b = (char *)s->b;
+
+    for (size_t i = 0; i < s->length; i++) {
+        char saved = b[i];
+        const char changes[] = { saved + 1, saved - 1, '\0', (char)0xC0 };
+
+        for (size_t j = 0; j < sizeof(changes); j++) {
+            b[i] = changes[j];
+            int expected = strbench_sign(strcmp(s->a, b));
+
+            if (strbench_sign(new_strcmp(s->a, b)) != expected || strbench_sign(new_strcmp(b, s->a)) != -expected ||
+                strbench_sign(new_x86_64_sse2_strcmp(s->a, b)) != expected) {
+                fprintf(stderr, "strbench: strcmp wrong for a %zu byte string changed at %zu\n", s->length, i);
+                exit(1);
+            }
+        }
+        b[i] = saved;
+    }
+}
+
+int main(void)
+{
+    static const size_t lengths[] = { 7, 31, 255, 4095 };
+
+    printf("Cycles per call, fewest of %d runs (old / word / sse2)\n", BENCH_RUNS);
+    printf("%6s %20s %20s %20s %20s\n", "bytes", "strlen", "strcmp", "memchr (libc)", "strncpy (old/word)");
+
+    for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+        size_t length = lengths[i];
+        char *a = bench_guarded(length + 1);
+        char *b = bench_guarded(length + 2);  // Off by one against a, so the two differ in alignment
+
+        bench_fill(a, length, (uint32_t)length);
+        a[length] = '\0';
+        memcpy(b, a, length + 1);
+
+        strbench_t s = { a, b, malloc(length + 16), length };
+        strbench_check(&s);
+        strbench_check_strcmp(&s);
+
+        uint32_t iterations = 1000000 / (length + 16);
+        char cell[4][32];
+
+        snprintf(cell[0], sizeof(cell[0]), "%lu/%lu/%lu", bench_cycles(run_old_strlen, &s, iterations),
+                 bench_cycles(run_word_strlen, &s, iterations), bench_cycles(run_sse2_strlen, &s, iterations));
+        snprintf(cell[1], sizeof(cell[1]), "%lu/%lu/%lu", bench_cycles(run_old_strcmp, &s, iterations),
+                 bench_cycles(run_word_strcmp, &s, iterations), bench_cycles(run_sse2_strcmp, &s, iterations));
+        snprintf(cell[2], sizeof(cell[2]), "%lu/%lu/%lu", bench_cycles(run_byte_memchr, &s, iterations),
+                 bench_cycles(run_word_memchr, &s, iterations), bench_cycles(run_sse2_memchr, &s, iterations));
+        snprintf(cell[3], sizeof(cell[3]), "%lu/%lu", bench_cycles(run_old_strncpy, &s, iterations),
+                 bench_cycles(run_word_strncpy, &s, iterations));
+
+        printf("%6zu %20s %20s %20s %20s\n", length, cell[0], cell[1], cell[2], cell[3]);
+        free(s.dest);
+    }
+
+    return 0;
+}
@@ -0,0 +1,83 @@
+#!/usr/bin/env python3
+"""Check the boot profile record (kernel/profile.c) in a boot log.
+
+The kernel prints one "Boot profile: {...}" line on the debug serial port
+at the end of boot. This prints the phases in milliseconds and exits with
+status 1 if the boot, or any phase given with --phase, took too long.
+
+    make run | tee boot.log
+    tools/bootprof.py boot.log --max-ms 500 --phase "kernel load=50"
+"""
+
+import argparse
+import json
+import sys
+
+PREFIX = "Boot profile: {"
+
+
+def load(path):
+    with open(path, errors="replace") as log:
+        for line in log:
+            start = line.find(PREFIX)
+            if start >= 0:
+                return parse(path, line[start + len(PREFIX) - 1:])
+    sys.exit(f"{path}: no boot profile record")
+
+
+def parse(path, text):
+    """A truncated or garbled record fails the check instead of raising."""
+    try:
+        record = json.loads(text)
+        phases = record["phases"]
+        if not isinstance(record["cycles_per_second"], int) or not all(
+                isinstance(p["name"], str) and isinstance(p["end_cycles"], int) for p in phases):
+            raise TypeError("unexpected field types")
+    except (ValueError, KeyError, TypeError) as error:
+        sys.exit(f"{path}: malformed boot profile record ({error}): {text.strip()[:80]}")
+    return record
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("log", help="serial output of a boot")
+    parser.add_argument("--max-ms", type=float, help="limit from reset to the last phase")
+    parser.add_argument("--phase", action="append", default=[], metavar="NAME=MS",
+                        help="limit for one phase, may be repeated")
+    args = parser.parse_args()
+
+    record = load(args.log)
+    if record.get("version") != 1:
+        sys.exit(f"unsupported boot profile version {record.get('version')}")
+
+    hz = record["cycles_per_second"]
+    if not hz:
+        sys.exit("boot profile has no counter rate")
+
+    durations = {}
+    start = 0
+    for phase in record["phases"]:
+        durations[phase["name"]] = (phase["end_cycles"] - start) * 1000 / hz
+        start = phase["end_cycles"]
+        print(f"{phase['name']:<16} {durations[phase['name']]:10.3f} ms")
+
+    total = start * 1000 / hz
+    print(f"{'total':<16} {total:10.3f} ms")
+
+    failed = args.max_ms is not None and total > args.max_ms
+    if failed:
+        print(f"boot took {total:.3f} ms, limit {args.max_ms} ms", file=sys.stderr)
+
+    for limit in args.phase:
+        name, _, ms = limit.rpartition("=")
+        if name not in durations:
+            sys.exit(f"no phase named {name!r}")
+        if durations[name] > float(ms):
+            print(f"{name} took {durations[name]:.3f} ms, limit {ms} ms", file=sys.stderr)
+            failed = True
+
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,69 @@
+#!/usr/bin/env python3
+"""Compare the disk benchmark (kernel/kernel.c) across machine types.
+
+make disk-bench boots each machine once and keeps the "Disk benchmark:"
+lines, prefixed with the machine name. This lines the machines up per
+disk and pattern, with pc's throughput relative to isapc's, and exits
+with status 1 if a machine printed no results.
+
+    make disk-bench > bench.log
+    tools/diskbench.py bench.log
+"""
+
+import argparse
+import re
+import sys
+
+LINE = re.compile(r"^(\w+): Disk benchmark: (.+?) (sequential|random) \d+ KiB in \d+ us, "
+                  r"(\d+) KiB/s, (\d+) IOPS, CPU (\d+)%")
+
+
+def load(path, machines):
+    results = {machine: {} for machine in machines}
+    with open(path, errors="replace") as log:
+        for line in log:
+            match = LINE.match(line)
+            if match and match[1] in results:
+                machine, disk, pattern = match[1], match[2], match[3]
+                results[machine][disk, pattern] = tuple(int(match[i]) for i in (4, 5, 6))
+    return results
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("log", help="output of make disk-bench")
+    parser.add_argument("--machines", default="isapc,pc",
+                        help="comma separated, the first is the baseline (default: isapc,pc)")
+    args = parser.parse_args()
+
+    machines = args.machines.split(",")
+    results = load(args.log, machines)
+
+    missing = [machine for machine in machines if not results[machine]]
+    for machine in missing:
+        print(f"{machine}: no disk benchmark results", file=sys.stderr)
+
+    keys = sorted({key for machine in machines for key in results[machine]})
+    print(f"{'disk':<28} {'pattern':<12}" +
+          "".join(f" {machine + ' KiB/s':>14} {'IOPS':>7} {'CPU':>5}" for machine in machines) +
+          f" {'speedup':>8}")
+
+    base = machines[0]
+    for disk, pattern in keys:
+        row = f"{disk:<28} {pattern:<12}"
+        for machine in machines:
+            if (disk, pattern) in results[machine]:
+                kib, iops, cpu = results[machine][disk, pattern]
+                row += f" {kib:>14} {iops:>7} {cpu:>4}%"
+            else:
+                row += f" {'-':>14} {'-':>7} {'-':>5}"
+        base_kib = results[base].get((disk, pattern), (0,))[0]
+        last_kib = results[machines[-1]].get((disk, pattern), (0,))[0]
+        row += f" {last_kib / base_kib:>7.2f}x" if base_kib and last_kib else f" {'-':>8}"
+        print(row)
+
+    sys.exit(1 if missing else 0)
+
+
+if __name__ == "__main__":
+    main()
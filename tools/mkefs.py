@@ -0,0 +1,145 @@
+#!/usr/bin/env python3
+"""Build an extent file system image (fs/efs.c) from a host directory.
+
+Every file and directory is stored in a single extent, so the kernel reads
+each with one request and can map files in place on a RAM disk. Images get
+an empty journal (fs/journal.c) unless -j 0 is given.
+
+    tools/mkefs.py rootfs bin/root.img
+"""
+
+import argparse
+import os
+import struct
+import sys
+
+EFS_MAGIC = 0x31534645
+EFS_NAME_MAX = 57
+EFS_TYPE_FILE, EFS_TYPE_DIR = 1, 2
+JOURNAL_MAGIC = 0x4C4E524A
+JOURNAL_MIN = 11  # JOURNAL_TRANSACTION_MAX + 3
+
+# Must match efs_super_t, efs_disk_inode_t and efs_disk_dirent_t in include/fs/efs.h
+SUPER = struct.Struct("<IIQIIIII28x")
+INODE = struct.Struct("<HHIQ12I")
+DIRENT = struct.Struct("<IBB58s")
+# Must match journal_super_t in include/fs/journal.h
+JOURNAL_SUPER = struct.Struct("<IIIIQ")
+
+
+class Node:
+    def __init__(self, path, kind, parent):
+        self.path = path
+        self.kind = kind
+        self.parent = parent or self
+        self.children = []
+        self.number = 0
+        self.data = b""
+
+
+def scan(root):
+    """Collect the tree breadth first, so the root is inode 1."""
+    nodes = [Node(root, EFS_TYPE_DIR, None)]
+    for node in nodes:
+        if node.kind != EFS_TYPE_DIR:
+            continue
+        for name in sorted(os.listdir(node.path)):
+            path = os.path.join(node.path, name)
+            if len(name.encode()) > EFS_NAME_MAX:
+                sys.exit(f"{path}: name longer than {EFS_NAME_MAX} bytes")
+            if os.path.isdir(path):
+                child = Node(path, EFS_TYPE_DIR, node)
+            elif os.path.isfile(path):
+                child = Node(path, EFS_TYPE_FILE, node)
+            else:
+                print(f"warning: skipping {path}", file=sys.stderr)
+                continue
+            node.children.append((name, child))
+            nodes.append(child)
+
+    for number, node in enumerate(nodes, start=1):
+        node.number = number
+    return nodes
+
+
+def dirent(name, node):
+    encoded = name.encode()
+    return DIRENT.pack(node.number, node.kind, len(encoded), encoded)
+
+
+def build(root, block_size, size, journal_blocks):
+    nodes = scan(root)
+
+    for node in nodes:
+        if node.kind == EFS_TYPE_FILE:
+            with open(node.path, "rb") as f:
+                node.data = f.read()
+        else:
+            entries = [dirent(".", node), dirent("..", node.parent)]
+            entries += [dirent(name, child) for name, child in node.children]
+            node.data = b"".join(entries)
+
+    inode_count = len(nodes) + 1
+    inode_table = 1
+    journal_start = inode_table + -(-inode_count * INODE.size // block_size)
+    block = journal_start + journal_blocks
+
+    extents = {}
+    for node in nodes:
+        count = -(-len(node.data) // block_size)
+        extents[node.number] = (block, count)
+        block += count
+
+    block_count = block
+    if size:
+        if size // block_size < block_count:
+            sys.exit(f"contents need {block_count * block_size} bytes, image is {size}")
+        block_count = size // block_size
+
+    image = bytearray(block_count * block_size)
+    SUPER.pack_into(image, 0, EFS_MAGIC, block_size, block_count, inode_count, inode_table, 1,
+                    journal_start if journal_blocks else 0, journal_blocks)
+    if journal_blocks:
+        JOURNAL_SUPER.pack_into(image, journal_start * block_size, JOURNAL_MAGIC, block_size,
+                                journal_blocks, 1, 1)
+
+    for node in nodes:
+        start, count = extents[node.number]
+        fields = [start, count] if count else []
+        fields += [0] * (12 - len(fields))
+        INODE.pack_into(image, inode_table * block_size + node.number * INODE.size,
+                        node.kind, 1 if count else 0, 0, len(node.data), *fields)
+        image[start * block_size:start * block_size + len(node.data)] = node.data
+
+    return image, len(nodes)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("root", help="directory to copy into the image")
+    parser.add_argument("image", help="output image")
+    parser.add_argument("-b", "--block-size", type=int, default=512,
+                        help="file system block size, a power of two from 512 to 4096")
+    parser.add_argument("-j", "--journal", type=int, default=32,
+                        help="journal blocks, 0 for a read-only image")
+    parser.add_argument("-s", "--size", type=int, default=0,
+                        help="image size in bytes, default just large enough")
+    args = parser.parse_args()
+
+    if args.block_size not in (512, 1024, 2048, 4096):
+        sys.exit(f"unsupported block size {args.block_size}")
+
+    if 0 < args.journal < JOURNAL_MIN:
+        sys.exit(f"journal needs at least {JOURNAL_MIN} blocks")
+
+    image, count = build(args.root, args.block_size, args.size, args.journal)
+
+    with open(args.image, "wb") as f:
+        f.write(image)
+
+    print(f"{args.image}: {count} inodes, {len(image) // args.block_size} blocks of {args.block_size}",
+          file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
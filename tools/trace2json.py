@@ -0,0 +1,104 @@
+#!/usr/bin/env python3
+"""Convert a kernel trace dump (kernel/trace.c) into Chrome trace JSON.
+
+The kernel writes the dump to the second serial port; `make run` captures
+it in trace.bin. Load the output in chrome://tracing or ui.perfetto.dev.
+
+    tools/trace2json.py trace.bin > trace.json
+"""
+
+import argparse
+import json
+import struct
+import sys
+
+TRACE_MAGIC = 0x31435254
+HEADER = struct.Struct("<IHHIIQ")
+RECORD = struct.Struct("<QHHIQQ")
+
+# Must match trace_event_t in include/kernel/trace.h
+IRQ_ENTRY, IRQ_EXIT, DEVICE_REGISTER = 1, 2, 3
+DISK_READ, DISK_READ_DONE, DISK_WRITE, DISK_WRITE_DONE = 4, 5, 6, 7
+KEYBOARD = 8
+
+DEVICE_CLASSES = ["char", "block", "display"]
+
+
+def find_header(data):
+    offset = data.find(struct.pack("<I", TRACE_MAGIC))
+    if offset < 0:
+        sys.exit("no trace header found")
+    return offset
+
+
+def decode(data, cycles_override):
+    offset = find_header(data)
+    magic, version, record_size, cpu_count, count, cycles_per_second = HEADER.unpack_from(data, offset)
+    if version != 1 or record_size != RECORD.size:
+        sys.exit(f"unsupported trace version {version} (record size {record_size})")
+
+    cycles_per_second = cycles_override or cycles_per_second
+    if not cycles_per_second:
+        sys.exit("dump has no cycle calibration; pass --cycles-per-second")
+
+    offset += HEADER.size
+    available = (len(data) - offset) // RECORD.size
+    if available < count:
+        print(f"warning: dump truncated, {available}/{count} records", file=sys.stderr)
+        count = available
+
+    records = [RECORD.unpack_from(data, offset + i * RECORD.size) for i in range(count)]
+    if not records:
+        return []
+
+    base = min(r[0] for r in records)
+    events = []
+
+    for timestamp, event, cpu, _, arg0, arg1 in records:
+        ts = (timestamp - base) * 1e6 / cycles_per_second
+        common = {"ts": ts, "pid": 0, "tid": cpu}
+
+        if event in (IRQ_ENTRY, IRQ_EXIT):
+            events.append({**common, "name": f"irq 0x{arg0:02x}", "cat": "irq",
+                           "ph": "B" if event == IRQ_ENTRY else "E"})
+        elif event in (DISK_READ, DISK_WRITE):
+            op = "read" if event == DISK_READ else "write"
+            events.append({**common, "name": f"disk {op}", "cat": "disk", "ph": "B",
+                           "args": {"block": arg0, "count": arg1}})
+        elif event in (DISK_READ_DONE, DISK_WRITE_DONE):
+            op = "read" if event == DISK_READ_DONE else "write"
+            result = arg1 - (1 << 64) if arg1 >= 1 << 63 else arg1
+            events.append({**common, "name": f"disk {op}", "cat": "disk", "ph": "E",
+                           "args": {"result": result}})
+        elif event == DEVICE_REGISTER:
+            name = arg1.to_bytes(8, "little").rstrip(b"\0").decode(errors="replace")
+            cls = DEVICE_CLASSES[arg0] if arg0 < len(DEVICE_CLASSES) else str(arg0)
+            events.append({**common, "name": f"register {name}", "cat": "device", "ph": "i",
+                           "s": "t", "args": {"class": cls}})
+        elif event == KEYBOARD:
+            events.append({**common, "name": "key", "cat": "input", "ph": "i", "s": "t",
+                           "args": {"unicode": arg0, "key": arg1 & 0xFFFF,
+                                    "pressed": bool(arg1 >> 16)}})
+        else:
+            events.append({**common, "name": f"event {event}", "ph": "i", "s": "t",
+                           "args": {"arg0": arg0, "arg1": arg1}})
+
+    return events
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("dump", help="binary dump captured from the trace serial port")
+    parser.add_argument("--cycles-per-second", type=int, default=0,
+                        help="override the calibration stored in the dump")
+    args = parser.parse_args()
+
+    with open(args.dump, "rb") as f:
+        data = f.read()
+
+    json.dump({"traceEvents": decode(data, args.cycles_per_second),
+               "displayTimeUnit": "ns"}, sys.stdout)
+
+
+if __name__ == "__main__":
+    main()